@@ -65,6 +65,7 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOFilterInterruptEventSource.h>
+#include <IOKit/IOUserClient.h>
 #include <pexpert/i386/protos.h>
 #include <IOAC97CodecDevice.h>
 #include <IOKit/audio/IOAudioEngine.h>
@@ -73,6 +74,7 @@
 #include "EnsoniqAudioPCI.h"
 #include "es137x.h"
 #include "es137x_xtra.h"
+#include "PositionClock.h"
 
 #define DMA_STATES_SIZE (sizeof(DMAEngineState) * kDMAEngineCount)
 
@@ -83,6 +85,19 @@
 #define FORMAT_8BIT 0
 #define FORMAT_16BIT 2
 
+#define LATENCY_PARTITIONS 4U		// interrupt periods per buffer
+#define LATENCY_MIN_PERIOD 32U		// frames
+#define LATENCY_MAX_PERIOD 4096U	// frames
+#define LATENCY_MIN_OFFSET 32U		// frames
+#define LATENCY_MAX_MS 100U
+
+#define POLL_SPIN 64U				// reads before backing off
+#define POLL_MAX_DELAY 16U			// microseconds
+#define POLL_BUDGET 8192U			// microseconds
+#define POLL_WINDOW_SPIN 4096U		// reads, for waits that must not sleep
+
+#define SRC_DIS_MASK (ES1371_DIS_SRC | ES1371_DIS_P1 | ES1371_DIS_P2 | ES1371_DIS_R1)
+
 #define CLASS EnsoniqAudioPCI
 #define super IOAC97Controller
 OSDefineMetaClassAndStructors(EnsoniqAudioPCI, IOAC97Controller);
@@ -142,6 +157,8 @@ struct DMAEngineState
 	void* interruptTarget;					// offset 16
 	IOAC97DMAEngineAction interruptAction;	// offset 20
 	void* interruptParam;					// offset 24
+
+	PositionClock clock;					// see clockUpdate
 };
 
 static int const gDMAEngineDir[2] = { kIOAC97DMADataDirectionOutput, kIOAC97DMADataDirectionInput };
@@ -177,6 +194,7 @@ IOReturn CLASS::startDMAEngine(IOAC97DMAEngineID engine, IOOptionBits options)
 		return kIOReturnSuccess;
 	if (dma->flags & kEngineInterrupt)
 		dma->interruptReady = true;
+	dma->clock.valid = false;
 	eschan_trigger(ENGINE_TO_CHANNEL(engine), 2);
 	dma->flags |= kEngineRunning;
 	return kIOReturnSuccess;
@@ -195,18 +213,33 @@ void CLASS::stopDMAEngine(IOAC97DMAEngineID engine)
 	IOSleep(10);
 	dma->interruptReady = false;
 	dma->flags &= ~kEngineRunning;
+	if (dma->clock.valid)
+		setProperty("EnsoniqAudioPCIMeasuredRate", static_cast<UInt64>(clockSampleRate(&dma->clock)), 32U);
 }
 
+/*
+ * Note: The hardware pointer is only read at interrupts, so for output
+ *   the position is interpolated in between, see clockPosition.
+ */
 IOByteCount CLASS::getDMAEngineHardwarePointer(IOAC97DMAEngineID engine)
 {
+	if (engine == kDMAEnginePCMOut && fInterpolate)
+		return clockPosition(&fDMAState[engine].clock, fFrameCountCache[ENGINE_TO_CHANNEL(engine)], mach_absolute_time());
 	return fFrameCountCache[ENGINE_TO_CHANNEL(engine)];
 }
 
 IOReturn CLASS::codecRead(IOAC97CodecID codec, IOAC97CodecOffset offset, IOAC97CodecWord* word)
 {
+	UInt data;
+
 	if (codec > 1 || offset >= kCodecRegisterCount)
 		return kIOReturnBadArgument;
-	*word = static_cast<IOAC97CodecWord>(es1371_rdcd(static_cast<int>(offset)));
+	if (codecShadowLookup(&fCodecShadow, offset, word))
+		return kIOReturnSuccess;
+	if (!es1371_rdcd(static_cast<int>(offset), &data))
+		return kIOReturnTimeout;
+	*word = static_cast<IOAC97CodecWord>(data);
+	codecShadowFill(&fCodecShadow, offset, *word);
 	return kIOReturnSuccess;
 }
 
@@ -214,7 +247,8 @@ IOReturn CLASS::codecWrite(IOAC97CodecID codec, IOAC97CodecOffset offset, IOAC97
 {
 	if (codec > 1 || offset >= kCodecRegisterCount)
 		return kIOReturnBadArgument;
-	es1371_wrcd(static_cast<int>(offset), word);
+	if (codecShadowWrite(&fCodecShadow, offset, word))
+		es1371_wrcd(static_cast<int>(offset), word);
 	return kIOReturnSuccess;
 }
 
@@ -235,6 +269,7 @@ IOReturn CLASS::activateAudioConfiguration(IOAC97AudioConfig* config, void* targ
     IOAC97DMAEngineID engine;
 	IOByteCount size;
 	IOReturn r;
+	UInt bufferBytes, numPages, periodFrames;
 
 	if (!config)
 		return kIOReturnBadArgument;
@@ -245,10 +280,24 @@ IOReturn CLASS::activateAudioConfiguration(IOAC97AudioConfig* config, void* targ
 	if (dma->flags != kEngineIdle)
 		return kIOReturnBusy;
 	hwActivateConfiguration(config);	// Added
+	if (fLatencyMs || fLatencyFrames) {
+		selectBufferGeometry(config->getSampleRate(), &bufferBytes, &periodFrames);
+	} else {
+		bufferBytes = fBufferNumPages << PAGE_SHIFT;
+		periodFrames = fBufferNumPages << (PAGE_SHIFT - 3);
+	}
+	numPages = (bufferBytes + PAGE_MASK) >> PAGE_SHIFT;
+	if (dma->sampleMemory &&
+		dma->sampleMemory->getCapacity() != (static_cast<IOByteCount>(numPages) << PAGE_SHIFT)) {
+		dma->sampleMemory->complete();
+		dma->sampleMemory->release();
+		dma->sampleMemory = 0;
+		dma->sampleMemoryPhysAddr = 0;
+	}
 	if (!dma->sampleMemory) {
 		dma->sampleMemory = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task,
 																			 kIOMemoryPhysicallyContiguous,
-																			 static_cast<mach_vm_size_t>(fBufferNumPages) << PAGE_SHIFT,
+																			 static_cast<mach_vm_size_t>(numPages) << PAGE_SHIFT,
 																			 0xFFFFFFFFULL & -PAGE_SIZE);
 		if (!dma->sampleMemory)
 			return kIOReturnNoMemory;
@@ -274,15 +323,28 @@ IOReturn CLASS::activateAudioConfiguration(IOAC97AudioConfig* config, void* targ
 		dma->flags |= kEngineInterrupt;
 	}
 	dma->flags |= kEngineActive;
+	clockReset(&dma->clock, config->getSampleRate(), bufferBytes, periodFrames);
+	if (engine == kDMAEnginePCMOut) {
+		fPeriodBytes = (fLatencyMs || fLatencyFrames) ? periodFrames << 2 : 0U;
+		fJitterPeak = 0U;
+		fSampleOffset = fSampleOffsetBase;
+		setProperty("EnsoniqAudioPCIPeriodFrames", static_cast<UInt64>(periodFrames), 32U);
+		setProperty("EnsoniqAudioPCIBufferBytes", static_cast<UInt64>(bufferBytes), 32U);
+	}
 	eschan_prepare(ENGINE_TO_CHANNEL(engine),
 				   static_cast<UInt>(dma->sampleMemoryPhysAddr),
-				   fBufferNumPages << PAGE_SHIFT,
-				   fBufferNumPages << (PAGE_SHIFT - 3),
+				   bufferBytes,
+				   periodFrames,
 				   FORMAT_STEREO | FORMAT_16BIT,
 				   /* kIOAC97SampleRate48K */ config->getSampleRate());		// Added
 	config->setDMABufferMemory(dma->sampleMemory);
-	config->setDMABufferCount(fBufferNumPages);
-	config->setDMABufferSize(PAGE_SIZE);
+	if (bufferBytes >= PAGE_SIZE) {
+		config->setDMABufferCount(bufferBytes >> PAGE_SHIFT);
+		config->setDMABufferSize(PAGE_SIZE);
+	} else {
+		config->setDMABufferCount(1U);
+		config->setDMABufferSize(bufferBytes);
+	}
 	r = super::activateAudioConfiguration(config, target, action, param);
 	if (r != kIOReturnSuccess)
 		deactivateAudioConfiguration(config);
@@ -366,30 +428,82 @@ void CLASS::es_wr(int regno, UInt data, int size)
 	}
 }
 
+/*
+ * Added: bounded polling
+ *   Spins briefly, then backs off exponentially with IODelay up to
+ *   POLL_BUDGET microseconds.  If backoff is false, spins for at most
+ *   POLL_WINDOW_SPIN reads, for short hardware windows that must not be missed.
+ */
+__attribute__((visibility("hidden")))
+bool CLASS::es_poll(int regno, UInt mask, UInt value, UInt* result, bool backoff)
+{
+	UInt t, r, delay, waited;
+	bool ok;
+
+	ok = false;
+	r = 0;
+	for (t = 0; !ok && t < (backoff ? POLL_SPIN : POLL_WINDOW_SPIN); ++t)
+		ok = (((r = es_rd(regno, 4)) & mask) == value);
+	for (delay = 1U, waited = 0U; !ok && backoff && waited < POLL_BUDGET; waited += delay) {
+		IODelay(delay);
+		ok = (((r = es_rd(regno, 4)) & mask) == value);
+		if (delay < POLL_MAX_DELAY)
+			delay <<= 1;
+	}
+	if (result)
+		*result = r;
+	return ok;
+}
+
 __attribute__((visibility("hidden")))
 UInt CLASS::es1371_wait_src_ready()
 {
-	UInt t, r;
+	UInt r;
 
-	for (t = 0; t < 4096U; ++t) {
-		if (!((r = es_rd(ES1371_REG_SMPRATE, 4)) &
-			  ES1371_SRC_RAM_BUSY))
-			return r;
-		IODelay(2);
-	}
+	if (es_poll(ES1371_REG_SMPRATE, ES1371_SRC_RAM_BUSY, 0, &r, true))
+		return r;
 	IOLog("%s: wait src ready timeout 0x%x [0x%x]\n", getName(), ES1371_REG_SMPRATE, r);
 	return 0;
 }
 
+/*
+ * Added: batched SRC RAM programming
+ *   Disable bits are sampled once for the whole batch, redundant writes
+ *   are dropped, and a timeout aborts the rest of the batch.
+ */
+__attribute__((visibility("hidden")))
+bool CLASS::es1371_src_write_batch(SRCWrite const* writes, int count)
+{
+	UInt r, dis;
+	int i;
+
+	dis = ~0U;
+	for (i = 0; i < count; ++i) {
+		UInt16 reg = writes[i].reg & (SRC_RAM_SIZE - 1U);
+		if (srcShadowMatches(&fSRCShadow, reg, writes[i].data, 0xFFFFU))
+			continue;
+		if (!es_poll(ES1371_REG_SMPRATE, ES1371_SRC_RAM_BUSY, 0, &r, true)) {
+			IOLog("%s: src write timeout at 0x%x [0x%x]\n", getName(), reg, r);
+			fSRCShadow.valid = false;
+			return false;
+		}
+		if (dis == ~0U)
+			dis = r & SRC_DIS_MASK;
+		es_wr(ES1371_REG_SMPRATE, dis | ES1371_SRC_RAM_ADDRO(reg) |
+			  ES1371_SRC_RAM_DATAO(writes[i].data) | ES1371_SRC_RAM_WE, 4);
+		fSRCShadow.regs[reg] = writes[i].data;
+	}
+	return true;
+}
+
 __attribute__((visibility("hidden")))
 void CLASS::es1371_src_write(UInt16 reg, UInt16 data)
 {
-	UInt r;
+	SRCWrite w;
 
-	r = es1371_wait_src_ready() & (ES1371_DIS_SRC | ES1371_DIS_P1 |
-								   ES1371_DIS_P2 | ES1371_DIS_R1);
-	r |= ES1371_SRC_RAM_ADDRO(reg) |  ES1371_SRC_RAM_DATAO(data);
-	es_wr(ES1371_REG_SMPRATE, r | ES1371_SRC_RAM_WE, 4);
+	w.reg = reg;
+	w.data = data;
+	es1371_src_write_batch(&w, 1);
 }
 
 __attribute__((visibility("hidden")))
@@ -397,13 +511,24 @@ UInt CLASS::es1371_src_read(UInt16 reg)
 {
 	UInt r;
 
-	r = es1371_wait_src_ready() & (ES1371_DIS_SRC | ES1371_DIS_P1 |
-								   ES1371_DIS_P2 | ES1371_DIS_R1);
+	r = es1371_wait_src_ready() & SRC_DIS_MASK;
 	r |= ES1371_SRC_RAM_ADDRO(reg);
 	es_wr(ES1371_REG_SMPRATE, r, 4);
 	return (ES1371_SRC_RAM_DATAI(es1371_wait_src_ready()));
 }
 
+/*
+ * Added: read-modify-write of the driver-owned bits in mask,
+ *   skipped when the shadow shows them unchanged.
+ */
+__attribute__((visibility("hidden")))
+void CLASS::es1371_src_update(UInt16 reg, UInt16 data, UInt16 mask)
+{
+	if (srcShadowMatches(&fSRCShadow, reg, data, mask))
+		return;
+	es1371_src_write(reg, (es1371_src_read(reg) & ~mask) | (data & mask));
+}
+
 __attribute__((visibility("hidden")))
 UInt CLASS::es1371_dac_rate(UInt rate, int channel)
 {
@@ -418,12 +543,9 @@ UInt CLASS::es1371_dac_rate(UInt rate, int channel)
 
 	dac = (channel == ES_DAC1) ? ES_SMPREG_DAC1 : ES_SMPREG_DAC2;
 	dis = (channel == ES_DAC1) ? ES1371_DIS_P2 : ES1371_DIS_P1;
-	r = (es1371_wait_src_ready() & (ES1371_DIS_SRC | ES1371_DIS_P1 |
-									ES1371_DIS_P2 | ES1371_DIS_R1));
+	r = (es1371_wait_src_ready() & SRC_DIS_MASK);
 	es_wr(ES1371_REG_SMPRATE, r, 4);
-	es1371_src_write(dac + ES_SMPREG_INT_REGS,
-					 (es1371_src_read(dac + ES_SMPREG_INT_REGS) & 0x00ff) |
-					 ((freq >> 5) & 0xfc00));
+	es1371_src_update(dac + ES_SMPREG_INT_REGS, (freq >> 5) & 0xfc00, 0xfc00);
 	es1371_src_write(dac + ES_SMPREG_VFREQ_FRAC, freq & 0x7fff);
 	r = (es1371_wait_src_ready() &
 		 (ES1371_DIS_SRC | dis | ES1371_DIS_R1));
@@ -435,6 +557,7 @@ __attribute__((visibility("hidden")))
 UInt CLASS::es1371_adc_rate(UInt rate, int channel)
 {
 	UInt n, truncm, freq, result;
+	SRCWrite w[3];
 
 	if (rate > kIOAC97SampleRate48K)
 		rate = kIOAC97SampleRate48K;
@@ -458,17 +581,32 @@ UInt CLASS::es1371_adc_rate(UInt rate, int channel)
 			es1371_src_write(ES_SMPREG_ADC + ES_SMPREG_TRUNC_N,
 							 0x8000 | (((119 - truncm) >> 1) << 9) | (n << 4));
 		}
-		es1371_src_write(ES_SMPREG_ADC + ES_SMPREG_INT_REGS,
-						 (es1371_src_read(ES_SMPREG_ADC + ES_SMPREG_INT_REGS) &
-						  0x00ff) | ((freq >> 5) & 0xfc00));
-		es1371_src_write(ES_SMPREG_ADC + ES_SMPREG_VFREQ_FRAC,
-						 freq & 0x7fff);
-		es1371_src_write(ES_SMPREG_VOL_ADC, n << 8);
-		es1371_src_write(ES_SMPREG_VOL_ADC + 1, n << 8);
+		es1371_src_update(ES_SMPREG_ADC + ES_SMPREG_INT_REGS, (freq >> 5) & 0xfc00, 0xfc00);
+		w[0].reg = ES_SMPREG_ADC + ES_SMPREG_VFREQ_FRAC;
+		w[0].data = freq & 0x7fff;
+		w[1].reg = ES_SMPREG_VOL_ADC;
+		w[1].data = n << 8;
+		w[2].reg = ES_SMPREG_VOL_ADC + 1;
+		w[2].data = n << 8;
+		es1371_src_write_batch(&w[0], 3);
 	}
 	return (result);
 }
 
+static SRCWrite const gSRCDefaults[] =
+{
+	{ ES_SMPREG_DAC1 + ES_SMPREG_TRUNC_N, 16 << 4 },
+	{ ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS, 16 << 10 },
+	{ ES_SMPREG_DAC2 + ES_SMPREG_TRUNC_N, 16 << 4 },
+	{ ES_SMPREG_DAC2 + ES_SMPREG_INT_REGS, 16 << 10 },
+	{ ES_SMPREG_VOL_ADC, 1 << 12 },
+	{ ES_SMPREG_VOL_ADC + 1, 1 << 12 },
+	{ ES_SMPREG_VOL_DAC1, 1 << 12 },
+	{ ES_SMPREG_VOL_DAC1 + 1, 1 << 12 },
+	{ ES_SMPREG_VOL_DAC2, 1 << 12 },
+	{ ES_SMPREG_VOL_DAC2 + 1, 1 << 12 }
+};
+
 __attribute__((visibility("hidden")))
 int CLASS::es1371_init()
 {
@@ -477,6 +615,7 @@ int CLASS::es1371_init()
 	UInt devid, revid, subdev;
 #endif
 	int idx;
+	SRCWrite w[SRC_RAM_SIZE];
 
 	/* This is NOT ES1370 */
 #if 0
@@ -485,6 +624,8 @@ int CLASS::es1371_init()
 #endif
 	ctrl = 0;	// Added
 	sctrl = 0;
+	codecShadowInvalidate(&fCodecShadow);
+	fSRCShadow.valid = false;
 #if 0
 	cssr = 0;
 	devid = pci_get_devid(es->dev);
@@ -538,18 +679,12 @@ int CLASS::es1371_init()
 	es1371_wait_src_ready();
 	/* Init the sample rate converter */
 	es_wr(ES1371_REG_SMPRATE, ES1371_DIS_SRC, 4);
-	for (idx = 0; idx < 0x80; ++idx)
-		es1371_src_write(idx, 0);
-	es1371_src_write(ES_SMPREG_DAC1 + ES_SMPREG_TRUNC_N, 16 << 4);
-	es1371_src_write(ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS, 16 << 10);
-	es1371_src_write(ES_SMPREG_DAC2 + ES_SMPREG_TRUNC_N, 16 << 4);
-	es1371_src_write(ES_SMPREG_DAC2 + ES_SMPREG_INT_REGS, 16 << 10);
-	es1371_src_write(ES_SMPREG_VOL_ADC, 1 << 12);
-	es1371_src_write(ES_SMPREG_VOL_ADC + 1, 1 << 12);
-	es1371_src_write(ES_SMPREG_VOL_DAC1, 1 << 12);
-	es1371_src_write(ES_SMPREG_VOL_DAC1 + 1, 1 << 12);
-	es1371_src_write(ES_SMPREG_VOL_DAC2, 1 << 12);
-	es1371_src_write(ES_SMPREG_VOL_DAC2 + 1, 1 << 12);
+	for (idx = 0; idx < SRC_RAM_SIZE; ++idx) {
+		w[idx].reg = static_cast<UInt16>(idx);
+		w[idx].data = 0;
+	}
+	fSRCShadow.valid = es1371_src_write_batch(&w[0], SRC_RAM_SIZE);
+	es1371_src_write_batch(&gSRCDefaults[0], sizeof gSRCDefaults / sizeof gSRCDefaults[0]);
 	es1371_adc_rate(22050, ES_ADC);
 	es1371_dac_rate(22050, ES_DAC1);
 	es1371_dac_rate(22050, ES_DAC2);
@@ -569,85 +704,51 @@ int CLASS::es1371_init()
 	return (0);
 }
 
+/*
+ * Added: common part of es1371_wrcd and es1371_rdcd
+ */
 __attribute__((visibility("hidden")))
-int CLASS::es1371_wrcd(int addr, UInt data)
+void CLASS::es1371_codec_command(UInt cmd)
 {
-	UInt t, x, orig;
+	UInt x, orig;
 
-	for (t = 0; t < 4096U; ++t) {
-		if (!(es_rd(ES1371_REG_CODEC, 4) & CODEC_WIP))		// Note: bugfix
-			break;
-	}
+	es_poll(ES1371_REG_CODEC, CODEC_WIP, 0, 0, true);		// Note: bugfix
 	/* save the current state for later */
 	x = orig = es_rd(ES1371_REG_SMPRATE, 4);
 	/* enable SRC state data in SRC mux */
-	es_wr(ES1371_REG_SMPRATE, (x & (ES1371_DIS_SRC | ES1371_DIS_P1 |
-									ES1371_DIS_P2 | ES1371_DIS_R1)) | 0x00010000, 4);
+	es_wr(ES1371_REG_SMPRATE, (x & SRC_DIS_MASK) | 0x00010000, 4);
 	/* busy wait */
-	for (t = 0; t < 4096U; ++t) {
-	  	if ((es_rd(ES1371_REG_SMPRATE, 4) & 0x00870000) ==
-		    0x00000000)
-			break;
-	}
+	es_poll(ES1371_REG_SMPRATE, 0x00870000, 0x00000000, 0, false);
 	/* wait for a SAFE time to write addr/data and then do it, dammit */
-	for (t = 0; t < 4096U; ++t) {
-		if ((es_rd(ES1371_REG_SMPRATE, 4) & 0x00870000) ==
-			0x00010000)
-			break;
-	}
+	es_poll(ES1371_REG_SMPRATE, 0x00870000, 0x00010000, 0, false);
 
-	es_wr(ES1371_REG_CODEC, ((addr << CODEC_POADD_SHIFT) &
-							 CODEC_POADD_MASK) | ((data << CODEC_PODAT_SHIFT) &
-													  CODEC_PODAT_MASK), 4);
+	es_wr(ES1371_REG_CODEC, cmd, 4);
 	/* restore SRC reg */
 	es1371_wait_src_ready();
 	es_wr(ES1371_REG_SMPRATE, orig, 4);
+}
 
+__attribute__((visibility("hidden")))
+int CLASS::es1371_wrcd(int addr, UInt data)
+{
+	es1371_codec_command(((addr << CODEC_POADD_SHIFT) & CODEC_POADD_MASK) |
+						 ((data << CODEC_PODAT_SHIFT) & CODEC_PODAT_MASK));
 	return (0);
 }
 
 __attribute__((visibility("hidden")))
-int CLASS::es1371_rdcd(int addr)
+bool CLASS::es1371_rdcd(int addr, UInt* data)
 {
-	UInt t, x, orig;
-
-	for (t = 0; t < 4096U; ++t) {
-		if (!(es_rd(ES1371_REG_CODEC, 4) & CODEC_WIP))
-			break;
-	}
-
-	/* save the current state for later */
-	x = orig = es_rd(ES1371_REG_SMPRATE, 4);
-	/* enable SRC state data in SRC mux */
-	es_wr(ES1371_REG_SMPRATE, (x & (ES1371_DIS_SRC | ES1371_DIS_P1 |
-									ES1371_DIS_P2 | ES1371_DIS_R1)) | 0x00010000, 4);
-	/* busy wait */
-	for (t = 0; t < 4096U; ++t) {
-		if ((es_rd(ES1371_REG_SMPRATE, 4) & 0x00870000) ==
-			0x00000000)
-			break;
-	}
-	/* wait for a SAFE time to write addr/data and then do it, dammit */
-	for (t = 0; t < 4096U; ++t) {
-		if ((es_rd(ES1371_REG_SMPRATE, 4) & 0x00870000) ==
-			0x00010000)
-			break;
-	}
-
-	es_wr(ES1371_REG_CODEC, ((addr << CODEC_POADD_SHIFT) &
-							 CODEC_POADD_MASK) | CODEC_PORD, 4);
-
-	/* restore SRC reg */
-	es1371_wait_src_ready();
-	es_wr(ES1371_REG_SMPRATE, orig, 4);
+	UInt x;
 
+	es1371_codec_command(((addr << CODEC_POADD_SHIFT) & CODEC_POADD_MASK) | CODEC_PORD);
 	/* now wait for the stinkin' data (RDY) */
-	for (t = 0; t < 4096U; ++t) {
-		if ((x = es_rd(ES1371_REG_CODEC, 4)) & CODEC_RDY)
-			break;
+	if (!es_poll(ES1371_REG_CODEC, CODEC_RDY, CODEC_RDY, &x, true)) {	// Added: report the timeout
+		IOLog("%s: codec read timeout at 0x%x [0x%x]\n", getName(), addr, x);
+		return false;
 	}
-
-	return ((x & CODEC_PIDAT_MASK) >> CODEC_PIDAT_SHIFT);
+	*data = (x & CODEC_PIDAT_MASK) >> CODEC_PIDAT_SHIFT;
+	return true;
 }
 
 __attribute__((visibility("hidden")))
@@ -816,6 +917,63 @@ UInt CLASS::es_intr()
 	return intsrc & (STAT_ADC | STAT_DAC2 | STAT_DAC1);
 }
 
+#pragma mark -
+#pragma mark Latency Mode
+#pragma mark -
+
+/*
+ * Note: Picks the largest power-of-two interrupt period not above the
+ *   latency target, and a buffer of LATENCY_PARTITIONS periods.  Buffers
+ *   of a page or more are whole pages, as that's how the engine splits them.
+ */
+__attribute__((visibility("hidden")))
+void CLASS::selectBufferGeometry(UInt rate, UInt* bufferBytes, UInt* periodFrames) const
+{
+	UInt target, period;
+
+	target = fLatencyMs ? (rate * fLatencyMs) / 1000U : fLatencyFrames;
+	if (target > LATENCY_MAX_PERIOD)
+		target = LATENCY_MAX_PERIOD;
+	for (period = LATENCY_MIN_PERIOD; (period << 1) <= target; period <<= 1);
+	*periodFrames = period;
+	*bufferBytes = (period * LATENCY_PARTITIONS) << 2;
+	if (*bufferBytes > PAGE_SIZE)
+		*bufferBytes &= -PAGE_SIZE;
+}
+
+/*
+ * Note: Called from the interrupt filter with the PCM out position.
+ *   The distance past the period boundary is how late the interrupt
+ *   was seen.  The sample offset follows twice the decaying peak of
+ *   that, rising at once and only dropping once it falls by a quarter.
+ */
+__attribute__((visibility("hidden")))
+void CLASS::trackInterruptJitter(UInt ptr)
+{
+	UInt late, offset;
+
+	late = (ptr % fPeriodBytes) >> 2;
+	if (late >= fJitterPeak)
+		fJitterPeak = late;
+	else
+		fJitterPeak -= (fJitterPeak - late + 63U) >> 6;
+	offset = fSampleOffsetBase + (fJitterPeak << 1);
+	if (offset > fSampleOffset ||
+		offset + (fSampleOffset >> 2) < fSampleOffset) {
+		fSampleOffset = offset;
+		fSampleOffsetPending = 1U;
+	}
+}
+
+__attribute__((visibility("hidden")))
+IOReturn CLASS::sampleOffsetAction(OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3)
+{
+	IOAudioEngine* engine = static_cast<IOAudioEngine*>(target);
+	if (engine)
+		engine->setSampleOffset(static_cast<UInt32>(reinterpret_cast<uintptr_t>(arg0)));
+	return kIOReturnSuccess;
+}
+
 #pragma mark -
 #pragma mark Overridden Methods from IOService
 #pragma mark -
@@ -839,6 +997,16 @@ bool CLASS::init(OSDictionary* dictionary)
 	ctrl = 0;
 	sctrl = 0;
 	fBufferNumPages = 32U;
+	fLatencyMs = 0U;
+	fLatencyFrames = 0U;
+	fPeriodBytes = 0U;
+	fJitterPeak = 0U;
+	fSampleOffsetBase = LATENCY_MIN_OFFSET;
+	fSampleOffset = LATENCY_MIN_OFFSET;
+	fSampleOffsetPending = 0U;
+	fInterpolate = true;
+	codecShadowInvalidate(&fCodecShadow);
+	fSRCShadow.valid = false;
 	return true;
 }
 
@@ -958,6 +1126,35 @@ IOReturn CLASS::setPowerState(unsigned long powerStateOrdinal, IOService* whatDe
 	return (10 * 1000 * 1000);	// 10 seconds
 }
 
+/*
+ * Note: EnsoniqAudioPCILatency (ms, 0 = fixed geometry) takes effect
+ *   the next time the engine is activated.
+ */
+IOReturn CLASS::setProperties(OSObject* properties)
+{
+	OSDictionary* dict;
+	OSNumber* num;
+
+	dict = OSDynamicCast(OSDictionary, properties);
+	if (!dict)
+		return kIOReturnBadArgument;
+	num = OSDynamicCast(OSNumber, dict->getObject("EnsoniqAudioPCILatency"));
+	if (!num)
+		return kIOReturnUnsupported;
+	if (num->unsigned32BitValue() > LATENCY_MAX_MS)
+		return kIOReturnBadArgument;
+	/*
+	 * Note: changes the DMA geometry for every client, so admin only
+	 */
+	if (IOUserClient::clientHasPrivilege(current_task(), kIOClientPrivilegeAdministrator) != kIOReturnSuccess)
+		return kIOReturnNotPrivileged;
+	fLatencyMs = num->unsigned32BitValue();
+	if (!fLatencyMs)
+		fLatencyFrames = 0U;
+	setProperty("EnsoniqAudioPCILatency", static_cast<UInt64>(fLatencyMs), 32U);
+	return kIOReturnSuccess;
+}
+
 #pragma mark -
 #pragma mark Private Methods
 #pragma mark -
@@ -976,8 +1173,10 @@ void CLASS::handleSetPowerState(thread_call_param_t param0, thread_call_param_t
 					self->waitCodecReady(i);
 			self->fACLinkPowerDown = false;
 		}
-	} else
+	} else {
 		self->fACLinkPowerDown = true;
+		codecShadowInvalidate(&self->fCodecShadow);
+	}
 	self->acknowledgeSetPowerState();
 	self->release();
 }
@@ -987,7 +1186,7 @@ bool CLASS::interruptFilter(OSObject* owner, IOFilterInterruptEventSource* sourc
 {
 	CLASS* self = static_cast<CLASS*>(owner);
 	DMAEngineState* dma;
-	UInt r;
+	UInt r, dac;
 #ifdef FAST_ERASE
 	bool bDACIntr = false;
 #endif
@@ -996,10 +1195,17 @@ bool CLASS::interruptFilter(OSObject* owner, IOFilterInterruptEventSource* sourc
 #ifdef FAST_ERASE
 	bDACIntr = ((r & (STAT_DAC2 | STAT_DAC1)) != 0);
 #endif
+	dac = r & (STAT_DAC2 | STAT_DAC1);
 	if ((r & STAT_DAC2) && self->eschan_getptr_and_cache(ES_DAC2))
 		r &= ~STAT_DAC2;
 	if ((r & STAT_DAC1) && self->eschan_getptr_and_cache(ES_DAC1))
 		r &= ~STAT_DAC1;
+	if (dac && (self->fDMAState[kDMAEnginePCMOut].flags & kEngineRunning)) {
+		UInt ptr = self->fFrameCountCache[ENGINE_TO_CHANNEL(kDMAEnginePCMOut)];
+		clockUpdate(&self->fDMAState[kDMAEnginePCMOut].clock, ptr, mach_absolute_time());
+		if (self->fPeriodBytes)
+			self->trackInterruptJitter(ptr);
+	}
 	if ((r & STAT_ADC) && self->eschan_getptr_and_cache(ES_ADC))
 		r &= ~STAT_ADC;
 	dma = &self->fDMAState[kDMAEnginePCMOut];
@@ -1025,13 +1231,12 @@ bool CLASS::interruptFilter(OSObject* owner, IOFilterInterruptEventSource* sourc
 		self->fEnginePCMOut != 0)
 		return true;
 #endif
-	return false;
+	return self->fSampleOffsetPending != 0 && self->fEnginePCMOut != 0;
 }
 
 __attribute__((visibility("hidden")))
 void CLASS::interruptOccurred(OSObject* owner, IOInterruptEventSource* source, int count)
 {
-#ifdef FAST_ERASE
 	CLASS* me = static_cast<CLASS*>(owner);
 	IOWorkLoop* wl;
 
@@ -1040,6 +1245,9 @@ void CLASS::interruptOccurred(OSObject* owner, IOInterruptEventSource* source, i
 	wl = me->fEnginePCMOut->getWorkLoop();
 	if (!wl)
 		return;
+	if (OSCompareAndSwap(1U, 0U, &me->fSampleOffsetPending))
+		wl->runAction(sampleOffsetAction, me->fEnginePCMOut, reinterpret_cast<void*>(static_cast<uintptr_t>(me->fSampleOffset)), 0, 0, 0);
+#ifdef FAST_ERASE
 	wl->runAction(engineAction, me->fEnginePCMOut, 0, 0, 0, 0);
 #endif /* FAST_ERASE */
 }
@@ -1092,8 +1300,10 @@ void CLASS::processBootOptions()
 {
 	UInt boot_arg;
 
-	if (PE_parse_boot_argn("es_oso", &boot_arg, sizeof boot_arg))
+	if (PE_parse_boot_argn("es_oso", &boot_arg, sizeof boot_arg)) {
 		setProperty(kIOAudioEngineSampleOffsetKey, static_cast<UInt64>(boot_arg), 32U);
+		fSampleOffsetBase = boot_arg;
+	}
 	if (PE_parse_boot_argn("es_iso", &boot_arg, sizeof boot_arg))
 		setProperty(kIOAudioEngineInputSampleOffsetKey, static_cast<UInt64>(boot_arg), 32U);
 	if (PE_parse_boot_argn("es_osl", &boot_arg, sizeof boot_arg))
@@ -1104,14 +1314,29 @@ void CLASS::processBootOptions()
 		setProperty("IOAudioEngineMixClipOverhead", static_cast<UInt64>(boot_arg), 32U);
 	if (PE_parse_boot_argn("es_stable", &boot_arg, sizeof boot_arg))
 		setProperty(kIOAudioEngineClockIsStableKey, boot_arg ? true : false);
-	if (PE_parse_boot_argn("es_cabfs", &boot_arg, sizeof boot_arg))
+	if (PE_parse_boot_argn("es_cabfs", &boot_arg, sizeof boot_arg)) {
 		setProperty("IOAudioEngineCoreAudioBufferFrameSize", static_cast<UInt64>(boot_arg), 32U);
+		fLatencyFrames = boot_arg;
+	}
 	if (PE_parse_boot_argn("-es_debug", &boot_arg, sizeof boot_arg))
 		setProperty("IOAudioEngineDebug", true);
 	if (PE_parse_boot_argn("es_bm", &boot_arg, sizeof boot_arg))
 		if (1U <= boot_arg && boot_arg <= 64U)
 			fBufferNumPages = boot_arg;
 	setProperty("EnsoniqAudioPCIBufferNumPages", static_cast<UInt64>(fBufferNumPages), 32U);
+	/*
+	 * Note: es_lat selects latency mode, with a target in ms, or
+	 *   if 0, a period of the CoreAudio buffer size set by es_cabfs.
+	 */
+	if (PE_parse_boot_argn("es_lat", &boot_arg, sizeof boot_arg) &&
+		boot_arg <= LATENCY_MAX_MS &&
+		(boot_arg || fLatencyFrames))
+		fLatencyMs = boot_arg;
+	else
+		fLatencyFrames = 0U;
+	setProperty("EnsoniqAudioPCILatency", static_cast<UInt64>(fLatencyMs), 32U);
+	if (PE_parse_boot_argn("es_interp", &boot_arg, sizeof boot_arg))
+		fInterpolate = (boot_arg != 0);
 }
 
 __attribute__((visibility("hidden")))
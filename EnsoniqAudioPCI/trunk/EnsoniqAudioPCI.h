@@ -33,6 +33,7 @@
 #define __ENSONIQ_AUDIOPCI_H__
 
 #include <IOAC97Controller.h>
+#include "RegisterShadow.h"
 
 class IOPCIDevice;
 class IOWorkLoop;
@@ -62,26 +63,44 @@ private:
 	IOAudioEngine* fEnginePCMOut;
 	UInt fBufferNumPages;
 
+	UInt fLatencyMs;						// 0 = fixed geometry from es_bm
+	UInt fLatencyFrames;					// period hint from es_cabfs
+	UInt fPeriodBytes;						// PCM out interrupt period
+	UInt fJitterPeak;						// frames, decaying peak
+	UInt fSampleOffsetBase;
+	UInt fSampleOffset;
+	UInt32 volatile fSampleOffsetPending;
+	bool fInterpolate;						// interpolate PCM out position between interrupts
+	CodecShadow fCodecShadow;
+	SRCShadow fSRCShadow;
+
 	UInt es_rd(int regno, int size);
 	void es_wr(int regno, UInt data, int size);
+	bool es_poll(int regno, UInt mask, UInt value, UInt* result, bool backoff);
 	UInt es1371_wait_src_ready();
+	bool es1371_src_write_batch(SRCWrite const* writes, int count);
 	void es1371_src_write(UInt16 reg, UInt16 data);
 	UInt es1371_src_read(UInt16 reg);
+	void es1371_src_update(UInt16 reg, UInt16 data, UInt16 mask);
 	UInt es1371_dac_rate(UInt rate, int channel);
 	UInt es1371_adc_rate(UInt rate, int channel);
 	int es1371_init();
+	void es1371_codec_command(UInt cmd);
 	int es1371_wrcd(int addr, UInt data);
-	int es1371_rdcd(int addr);
+	bool es1371_rdcd(int addr, UInt* data);
 	UInt eschan_prepare(int channel, UInt snd_dbuf, UInt bufsz, UInt cnt, UInt format, UInt rate);
 	int eschan_trigger(int channel, int go);
 	UInt eschan_getptr(int channel);
 	UInt eschan_getptr_and_cache(int channel);
 	UInt eschan_getSampleCounter(int channel);
 	UInt es_intr();
+	void selectBufferGeometry(UInt rate, UInt* bufferBytes, UInt* periodFrames) const;
+	void trackInterruptJitter(UInt ptr);
 
 	static void handleSetPowerState(thread_call_param_t param0, thread_call_param_t param1);
 	static bool interruptFilter(OSObject* owner, IOFilterInterruptEventSource* source);
 	static void interruptOccurred(OSObject* owner, IOInterruptEventSource* source, int count);
+	static IOReturn sampleOffsetAction(OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3);
 #ifdef FAST_ERASE
 	static IOReturn engineAction(OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3);
 #endif
@@ -110,6 +129,7 @@ public:
 	void free();
 	IOWorkLoop* getWorkLoop() const { return fWorkLoop; }
 	IOReturn setPowerState(unsigned long powerStateOrdinal, IOService* whatDevice);
+	IOReturn setProperties(OSObject* properties);
 
 	IOReturn prepareAudioConfiguration(IOAC97AudioConfig* config);
 	IOReturn activateAudioConfiguration(IOAC97AudioConfig* config, void* target = 0, IOAC97DMAEngineAction action = 0, void* param = 0);
@@ -0,0 +1,166 @@
+/*
+ *  PositionClock.h
+ *  EnsoniqAudioPCI
+ *
+ *  Created by Zenith432 on July 21 2009.
+ *  Copyright 2009 Zenith432. All rights reserved.
+ *
+ */
+
+#ifndef __POSITIONCLOCK_H__
+#define __POSITIONCLOCK_H__
+
+#include <IOKit/IOTypes.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
+
+#define CLOCK_POS_SHIFT 4			// DLL position gain 1/16
+#define CLOCK_RATE_SHIFT 9			// DLL rate gain 1/512
+#define CLOCK_RATE_RANGE_SHIFT 3	// rate kept within 1/8 of nominal
+#define CLOCK_EPOCH_SHIFT 48		// reported holds epoch:16, frames:48
+#define CLOCK_FRAMES_MASK ((1ULL << CLOCK_EPOCH_SHIFT) - 1ULL)
+
+struct PositionClock
+{
+	UInt32 volatile seq;					// odd while being updated
+	UInt32 epoch;							// resync count
+	bool valid;
+	UInt bufferBytes;
+	UInt lastPtr;							// bytes
+	UInt64 measuredFrames;					// unwrapped hardware position
+	UInt64 frames;							// filtered position, 48.16
+	UInt64 time;							// abs time of frames
+	UInt64 rate;							// frames per abs time unit, 32.32
+	UInt64 nominalRate;
+	UInt64 ticksPerSecond;
+	UInt64 maxExtrapolation;				// abs time
+	UInt64 volatile reported;				// see clockPosition
+};
+
+static inline void clockReset(PositionClock* clk, UInt rate, UInt bufferBytes, UInt periodFrames)
+{
+	UInt64 ticks;
+
+	nanoseconds_to_absolutetime(NSEC_PER_SEC, &ticks);
+	clk->valid = false;
+	clk->bufferBytes = bufferBytes;
+	clk->ticksPerSecond = ticks;
+	clk->nominalRate = (static_cast<UInt64>(rate) << 32) / ticks;
+	clk->rate = clk->nominalRate;
+	clk->maxExtrapolation = (static_cast<UInt64>(periodFrames) * ticks) / rate;
+	clk->epoch = 0U;
+	clk->reported = 0ULL;
+}
+
+/*
+ * Note: Called from the interrupt filter with the position just read.
+ *   A second order DLL runs on (time, unwrapped position) pairs: the
+ *   filtered position takes 1/16 of the prediction error and the rate
+ *   1/512 of it per period, close to critical damping.  Errors of half
+ *   a buffer or more (missed wraps, restarts) resync the clock and start
+ *   a new epoch.  seq lets readers on other CPUs see a consistent state
+ *   without a lock.  The reported position belongs to the readers and
+ *   is never written here.
+ */
+static inline void clockUpdate(PositionClock* clk, UInt ptr, UInt64 now)
+{
+	UInt delta;
+	UInt64 predicted, dt, limit;
+	SInt64 err;
+
+	++clk->seq;
+	OSMemoryBarrier();
+	if (!clk->valid || !clk->bufferBytes)
+		goto resync;
+	delta = ptr >= clk->lastPtr ? ptr - clk->lastPtr : ptr + clk->bufferBytes - clk->lastPtr;
+	clk->lastPtr = ptr;
+	clk->measuredFrames += delta >> 2;
+	dt = now - clk->time;
+	predicted = clk->frames + ((dt * clk->rate) >> 16);
+	err = static_cast<SInt64>((clk->measuredFrames << 16) - predicted);
+	if ((err < 0 ? -err : err) >= (static_cast<SInt64>(clk->bufferBytes) << 13))
+		goto resync;
+	clk->frames = predicted + (err >> CLOCK_POS_SHIFT);
+	clk->time = now;
+	if (dt)
+		clk->rate += ((err * 65536) / static_cast<SInt64>(dt)) >> CLOCK_RATE_SHIFT;
+	limit = clk->nominalRate >> CLOCK_RATE_RANGE_SHIFT;
+	if (clk->rate > clk->nominalRate + limit)
+		clk->rate = clk->nominalRate + limit;
+	else if (clk->rate < clk->nominalRate - limit)
+		clk->rate = clk->nominalRate - limit;
+	goto done;
+
+resync:
+	clk->lastPtr = ptr;
+	clk->measuredFrames = ptr >> 2;
+	clk->frames = clk->measuredFrames << 16;
+	clk->time = now;
+	clk->rate = clk->nominalRate;
+	++clk->epoch;
+	clk->valid = true;
+done:
+	OSMemoryBarrier();
+	++clk->seq;
+}
+
+/*
+ * Note: Extrapolates the filtered position to now, by at most one
+ *   interrupt period, and never reports less than the hardware
+ *   position last seen or than what was reported before in the same
+ *   epoch.  The result is also capped at a lower bound of the hardware
+ *   pointer (the last one read, advanced at the slowest rate the clock
+ *   allows) so the erase head never clears samples not yet fetched.
+ *   Readers on several CPUs race to raise the reported position, so it
+ *   only moves with a compare and swap, and a reader whose snapshot
+ *   predates the current epoch leaves it alone.  now is read by the
+ *   caller before the snapshot.
+ */
+static inline UInt clockPosition(PositionClock* clk, UInt cached, UInt64 now)
+{
+	UInt32 seq, epoch;
+	UInt lastPtr;
+	UInt64 frames, time, rate, nominal, measured, elapsed, pos, bound, old, prev, out;
+
+	do {
+		seq = clk->seq;
+		OSMemoryBarrier();
+		if (!clk->valid)
+			return cached;
+		epoch = clk->epoch & 0xFFFFU;
+		lastPtr = clk->lastPtr;
+		measured = clk->measuredFrames;
+		frames = clk->frames;
+		time = clk->time;
+		rate = clk->rate;
+		nominal = clk->nominalRate;
+		OSMemoryBarrier();
+	} while ((seq & 1U) || seq != clk->seq);
+	elapsed = now > time ? now - time : 0ULL;	// interrupt on another CPU since now was read
+	if (elapsed > clk->maxExtrapolation)
+		elapsed = clk->maxExtrapolation;
+	pos = (frames + ((elapsed * rate) >> 16)) >> 16;
+	bound = measured + ((elapsed * (nominal - (nominal >> CLOCK_RATE_RANGE_SHIFT))) >> 32);
+	if (pos > bound)
+		pos = bound;
+	if (pos < measured)
+		pos = measured;
+	do {
+		old = clk->reported;
+		out = pos;
+		if ((old >> CLOCK_EPOCH_SHIFT) == epoch) {
+			prev = old & CLOCK_FRAMES_MASK;
+			if (out < prev && prev - out < (clk->bufferBytes >> 3))
+				out = prev;
+		} else if (static_cast<SInt16>(static_cast<UInt16>((old >> CLOCK_EPOCH_SHIFT) - epoch)) > 0)
+			break;
+	} while (!OSCompareAndSwap64(old, (static_cast<UInt64>(epoch) << CLOCK_EPOCH_SHIFT) | (out & CLOCK_FRAMES_MASK), &clk->reported));
+	return static_cast<UInt>((lastPtr + ((out - measured) << 2)) % clk->bufferBytes);
+}
+
+static inline UInt clockSampleRate(PositionClock const* clk)
+{
+	return static_cast<UInt>((clk->rate * clk->ticksPerSecond + (1ULL << 31)) >> 32);
+}
+
+#endif /* __POSITIONCLOCK_H__ */
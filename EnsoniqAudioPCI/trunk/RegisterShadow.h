@@ -0,0 +1,120 @@
+/*
+ *  RegisterShadow.h
+ *  EnsoniqAudioPCI
+ *
+ *  Created by Zenith432 on July 21 2009.
+ *  Copyright 2009 Zenith432. All rights reserved.
+ *
+ */
+
+#ifndef __REGISTERSHADOW_H__
+#define __REGISTERSHADOW_H__
+
+#include <IOAC97Types.h>
+#include "es137x.h"
+
+#define SRC_RAM_SIZE 0x80
+
+/*
+ * Note: AC'97 registers whose contents change behind our back (reset,
+ *   page select, status bits, vendor space) are never served from the shadow.
+ */
+#define CODEC_UNCACHED ((1ULL << (kCodecAudioReset >> 1)) | \
+						(1ULL << (kCodecInterruptAndPage >> 1)) | \
+						(1ULL << (kCodecPowerdown >> 1)) | \
+						(1ULL << (kCodecExtAudioStatus >> 1)) | \
+						0x3FFFFFFF00000000ULL)
+
+struct SRCWrite
+{
+	UInt16 reg;
+	UInt16 data;
+};
+
+struct CodecShadow
+{
+	UInt64 valid;							// bit per register
+	IOAC97CodecWord regs[kCodecRegisterCount >> 1];
+};
+
+struct SRCShadow
+{
+	bool valid;
+	UInt16 regs[SRC_RAM_SIZE];
+};
+
+static inline void codecShadowInvalidate(CodecShadow* shadow)
+{
+	shadow->valid = 0ULL;
+}
+
+static inline bool codecShadowLookup(CodecShadow const* shadow, IOAC97CodecOffset offset, IOAC97CodecWord* word)
+{
+	if (!(shadow->valid & (1ULL << (offset >> 1))))
+		return false;
+	*word = shadow->regs[offset >> 1];
+	return true;
+}
+
+/*
+ * Note: Only for a value actually read back from the codec, since it
+ *   silently drops unimplemented bits.  A read that timed out must not
+ *   come here.
+ */
+static inline void codecShadowFill(CodecShadow* shadow, IOAC97CodecOffset offset, IOAC97CodecWord word)
+{
+	UInt64 bit = 1ULL << (offset >> 1);
+
+	if (bit & CODEC_UNCACHED)
+		return;
+	shadow->regs[offset >> 1] = word;
+	shadow->valid |= bit;
+}
+
+/*
+ * Note: Returns false if the write matches the readback and can be
+ *   skipped.  Any other write invalidates the entry, reset and power
+ *   down the whole shadow.
+ */
+static inline bool codecShadowWrite(CodecShadow* shadow, IOAC97CodecOffset offset, IOAC97CodecWord word)
+{
+	UInt64 bit = 1ULL << (offset >> 1);
+
+	if ((shadow->valid & bit) && shadow->regs[offset >> 1] == word)
+		return false;
+	shadow->valid &= ~bit;
+	if (offset == kCodecAudioReset || offset == kCodecPowerdown)
+		shadow->valid = 0ULL;
+	return true;
+}
+
+/*
+ * Note: Only registers the driver owns outright are compared.  The
+ *   accumulators and the low byte of INT_REGS are updated by the SRC.
+ */
+static inline bool srcIsConfig(UInt16 reg)
+{
+	if (reg == ES_SMPREG_VOL_ADC || reg == ES_SMPREG_VOL_ADC + 1 || reg >= ES_SMPREG_VOL_DAC1)
+		return true;
+	if (reg < ES_SMPREG_DAC1)
+		return false;
+	reg &= 3U;
+	return reg == ES_SMPREG_TRUNC_N || reg == ES_SMPREG_VFREQ_FRAC;
+}
+
+/*
+ * Note: True if the bits in mask already hold data.  Registers the
+ *   SRC updates itself only ever match through a mask of driver-owned
+ *   bits.
+ */
+static inline bool srcShadowMatches(SRCShadow const* shadow, UInt16 reg, UInt16 data, UInt16 mask)
+{
+	reg &= SRC_RAM_SIZE - 1U;
+	if (!shadow->valid)
+		return false;
+	if (mask == 0xFFFFU && !srcIsConfig(reg))
+		return false;
+	return (shadow->regs[reg] & mask) == (data & mask);
+}
+
+#endif /* __REGISTERSHADOW_H__ */
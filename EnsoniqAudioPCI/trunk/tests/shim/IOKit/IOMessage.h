@@ -0,0 +1,11 @@
+/*
+ *  IOMessage.h (host shim)
+ *  EnsoniqAudioPCI host checks
+ *
+ *  IOAC97Types.h only uses it in macros the checks don't expand.
+ */
+
+#ifndef __IOMESSAGE_H__
+#define __IOMESSAGE_H__
+
+#endif /* __IOMESSAGE_H__ */
@@ -0,0 +1,32 @@
+/*
+ *  IOTypes.h (host shim)
+ *  EnsoniqAudioPCI host checks
+ *
+ *  The few kernel types and constants the headers under test use,
+ *  so they build unchanged in user space.
+ */
+
+#ifndef __IOTYPES_H__
+#define __IOTYPES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int UInt;
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int16_t SInt16;
+typedef int32_t SInt32;
+typedef int64_t SInt64;
+typedef unsigned char Boolean;
+typedef int IOReturn;
+
+#define kIOReturnSuccess		0
+#define kIOReturnBadArgument	((IOReturn) 0xE00002C2)
+#define kIOReturnTimeout		((IOReturn) 0xE00002D6)
+
+#endif /* __IOTYPES_H__ */
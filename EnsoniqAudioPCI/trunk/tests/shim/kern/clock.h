@@ -0,0 +1,20 @@
+/*
+ *  clock.h (host shim)
+ *  EnsoniqAudioPCI host checks
+ *
+ *  Absolute time runs in nanoseconds.
+ */
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <IOKit/IOTypes.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static inline void nanoseconds_to_absolutetime(UInt64 nanoseconds, UInt64* result)
+{
+	*result = nanoseconds;
+}
+
+#endif /* __CLOCK_H__ */
@@ -0,0 +1,32 @@
+/*
+ *  OSAtomic.h (host shim)
+ *  EnsoniqAudioPCI host checks
+ *
+ *  OSCompareAndSwap64 runs gCompareAndSwapHook once, if set, before
+ *  the swap, to stand in for another CPU getting there first.
+ */
+
+#ifndef __OSATOMIC_H__
+#define __OSATOMIC_H__
+
+#include <IOKit/IOTypes.h>
+
+static inline void OSMemoryBarrier(void)
+{
+	__sync_synchronize();
+}
+
+static void (*gCompareAndSwapHook)(void);
+
+static inline Boolean OSCompareAndSwap64(UInt64 oldValue, UInt64 newValue, UInt64 volatile* address)
+{
+	void (*hook)(void) = gCompareAndSwapHook;
+
+	if (hook) {
+		gCompareAndSwapHook = 0;
+		hook();
+	}
+	return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+#endif /* __OSATOMIC_H__ */
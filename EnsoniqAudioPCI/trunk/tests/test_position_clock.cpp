@@ -0,0 +1,350 @@
+/*
+ *  test_position_clock.cpp
+ *  EnsoniqAudioPCI host checks
+ *
+ *  Replays simulated interrupt traces (skewed sample clock, late
+ *  interrupts, missed wraps) through the position clock DLL in
+ *  PositionClock.h, unchanged, and checks what clockPosition reports
+ *  against the true hardware pointer.  Readers are interleaved with
+ *  each other and with restarts through the swap hook in the OSAtomic
+ *  shim, and raced on real threads.  Run with -b for the lag table.
+ */
+
+#include "PositionClock.h"
+#include <pthread.h>
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+#define RATE 44100U
+#define BUFFER_BYTES 16384U		// 4096 frames
+#define PERIOD_FRAMES 1024U
+#define QUERIES 8				// per interrupt period
+
+struct Trace
+{
+	double skew;				// hardware rate error, 0.003 = +0.3%
+	UInt64 jitter;				// ns, interrupt delivery delay
+	UInt64 stamp;				// ns, read to timestamp delay
+	int drop;					// interrupt at which 4 in a row are lost, -1 none
+	int seconds;
+};
+
+struct Result
+{
+	UInt64 maxLag;				// frames behind the hardware, after settling
+	UInt64 sumLag;
+	UInt64 maxCachedLag;		// same, for the last interrupt's pointer
+	UInt64 sumCachedLag;
+	UInt64 queries;
+	UInt ahead;					// reports past the hardware pointer
+	UInt backwards;				// reports behind the previous one, same epoch
+	UInt32 epochs;
+	UInt measuredRate;
+	double hwRate;
+};
+
+static UInt64 rnd(UInt64 range)
+{
+	return range ? static_cast<UInt64>(rand()) % range : 0ULL;
+}
+
+static UInt hwPointer(double hwRate, UInt64 t)
+{
+	return static_cast<UInt>((static_cast<UInt64>(static_cast<double>(t) * hwRate / 1e9) << 2) % BUFFER_BYTES);
+}
+
+static UInt ringDistance(UInt from, UInt to)
+{
+	return (to + BUFFER_BYTES - from) % BUFFER_BYTES;
+}
+
+static Result replay(Trace const& trace)
+{
+	PositionClock clk;
+	Result r;
+	UInt64 t, now, next, q, settle, lag;
+	UInt cached, ret, prev, hwp;
+	UInt32 epoch;
+	int k, i, interrupts;
+	bool lost;
+
+	memset(&clk, 0, sizeof clk);
+	memset(&r, 0, sizeof r);
+	srand(1);
+	r.hwRate = RATE * (1.0 + trace.skew);
+	clockReset(&clk, RATE, BUFFER_BYTES, PERIOD_FRAMES);
+	interrupts = static_cast<int>(trace.seconds * r.hwRate / PERIOD_FRAMES);
+	settle = 2ULL * NSEC_PER_SEC;
+	prev = 0U;
+	epoch = 0U;
+	cached = 0U;
+	now = 0ULL;
+	for (k = 1; k < interrupts; ++k) {
+		t = static_cast<UInt64>(k * (PERIOD_FRAMES / r.hwRate) * 1e9) + rnd(trace.jitter);
+		next = static_cast<UInt64>((k + 1) * (PERIOD_FRAMES / r.hwRate) * 1e9);
+		lost = trace.drop >= 0 && k >= trace.drop && k < trace.drop + 4;
+		if (!lost) {
+			cached = hwPointer(r.hwRate, t);
+			now = t + rnd(trace.stamp);
+			clockUpdate(&clk, cached, now);
+		}
+		for (i = 0; i != QUERIES; ++i) {
+			q = now + (next - now) * static_cast<UInt64>(i) / QUERIES;
+			ret = clockPosition(&clk, cached, q);
+			hwp = hwPointer(r.hwRate, q);
+			if (!lost && ringDistance(ret, hwp) >= BUFFER_BYTES / 2U)	// lag is ambiguous past half a buffer
+				++r.ahead;
+			if (clk.epoch == epoch && ringDistance(prev, ret) >= BUFFER_BYTES / 2U)
+				++r.backwards;
+			epoch = clk.epoch;
+			prev = ret;
+			if (q < settle || (trace.drop >= 0 && k >= trace.drop && k < trace.drop + 8))
+				continue;
+			lag = ringDistance(ret, hwp) >> 2;
+			r.sumLag += lag;
+			if (lag > r.maxLag)
+				r.maxLag = lag;
+			lag = ringDistance(cached, hwp) >> 2;
+			r.sumCachedLag += lag;
+			if (lag > r.maxCachedLag)
+				r.maxCachedLag = lag;
+			++r.queries;
+		}
+	}
+	r.epochs = clk.epoch;
+	r.measuredRate = clockSampleRate(&clk);
+	return r;
+}
+
+static Trace makeTrace(double skew, UInt64 jitter, int drop)
+{
+	Trace trace;
+
+	trace.skew = skew;
+	trace.jitter = jitter;
+	trace.stamp = 50000ULL;
+	trace.drop = drop;
+	trace.seconds = 10;
+	return trace;
+}
+
+static bool rateWithin(Result const& r, double tolerance)
+{
+	double d = r.measuredRate - r.hwRate;
+
+	return (d < 0 ? -d : d) <= r.hwRate * tolerance;
+}
+
+/*
+ * Note: +-0.3% sample clock skew with interrupts up to 1.5ms late.
+ *   The clock must never run past the hardware, never step back, lock
+ *   onto the real rate, and lag far less than the raw pointer.
+ */
+static void test_skew_and_jitter(void)
+{
+	static double const skews[] = { 0.0, 0.003, -0.003 };
+	Result r;
+	size_t i;
+
+	for (i = 0U; i != sizeof skews / sizeof skews[0]; ++i) {
+		r = replay(makeTrace(skews[i], 1500000ULL, -1));
+		CHECK(r.ahead == 0U);
+		CHECK(r.backwards == 0U);
+		CHECK(r.epochs == 1U);
+		CHECK(rateWithin(r, 0.0005));
+		CHECK(r.maxLag < PERIOD_FRAMES / 4U);
+		CHECK(r.sumLag * 4U < r.sumCachedLag);
+	}
+}
+
+/*
+ * Note: Four lost interrupts hide a whole wrap.  The clock must resync
+ *   into a new epoch without ever running ahead, then settle again.
+ */
+static void test_missed_wrap(void)
+{
+	Result r;
+
+	r = replay(makeTrace(0.003, 1500000ULL, 200));
+	CHECK(r.ahead == 0U);
+	CHECK(r.backwards == 0U);
+	CHECK(r.epochs == 2U);
+	CHECK(rateWithin(r, 0.0005));
+	CHECK(r.maxLag < PERIOD_FRAMES / 4U);
+}
+
+static PositionClock gClock;
+static UInt64 gHookTime;
+static UInt gHookResult;
+
+static void laterReader(void)
+{
+	gHookResult = clockPosition(&gClock, 0U, gHookTime);
+}
+
+static void restart(void)
+{
+	gClock.valid = false;
+	clockUpdate(&gClock, 64U, gHookTime);
+}
+
+/*
+ * Note: A reader on another CPU that reports a later position between
+ *   this reader's load and its swap wins, this one must not pull the
+ *   position back.  A restart in the same window starts a new epoch
+ *   that the stale reader must leave alone.
+ */
+static void test_interleaved_readers(void)
+{
+	UInt64 step;
+	UInt early, later, after;
+
+	memset(&gClock, 0, sizeof gClock);
+	clockReset(&gClock, RATE, BUFFER_BYTES, PERIOD_FRAMES);
+	step = (PERIOD_FRAMES * NSEC_PER_SEC) / RATE;
+	clockUpdate(&gClock, 0U, step);
+	clockUpdate(&gClock, PERIOD_FRAMES << 2, 2U * step);
+	gHookTime = 2U * step + step / 2U;
+	gCompareAndSwapHook = laterReader;
+	early = clockPosition(&gClock, 0U, 2U * step + step / 8U);
+	later = gHookResult;
+	CHECK(later > (PERIOD_FRAMES << 2) + 256U);			// extrapolated well past the interrupt
+	CHECK(early == later);
+	after = clockPosition(&gClock, 0U, 2U * step + step / 4U);
+	CHECK(after == later);
+
+	gHookTime = 2U * step + step / 2U;
+	gCompareAndSwapHook = restart;
+	clockPosition(&gClock, 0U, 2U * step + 3U * step / 4U);
+	CHECK(gClock.epoch == 2U);
+	CHECK((gClock.reported >> CLOCK_EPOCH_SHIFT) != 2U);
+	after = clockPosition(&gClock, 0U, gHookTime);
+	CHECK(after == 64U);
+	CHECK((gClock.reported >> CLOCK_EPOCH_SHIFT) == 2U);
+}
+
+#define RACE_READERS 3
+#define RACE_UPDATES 200000
+
+struct Race
+{
+	PositionClock clk;
+	UInt64 volatile now;
+	int volatile done;
+	UInt backwards[RACE_READERS];
+};
+
+struct Reader
+{
+	Race* race;
+	int index;
+};
+
+/*
+ * Note: Interrupt side, advances simulated time by 1/8 period per step
+ *   and updates the clock every 8 steps, with a restart every 4096.
+ */
+static void* raceUpdater(void* arg)
+{
+	Race* race = static_cast<Race*>(arg);
+	UInt64 step;
+	int i;
+
+	step = (PERIOD_FRAMES * NSEC_PER_SEC) / (8U * RATE);
+	for (i = 0; i != RACE_UPDATES; ++i) {
+		__sync_fetch_and_add(&race->now, step);
+		if (i % 8 == 7)
+			clockUpdate(&race->clk, hwPointer(RATE, race->now), race->now);
+		if (i % 4096 == 4095)
+			race->clk.valid = false;
+	}
+	race->done = 1;
+	return 0;
+}
+
+static void* raceReader(void* arg)
+{
+	Reader* reader = static_cast<Reader*>(arg);
+	Race* race = reader->race;
+	UInt ret, prev;
+	UInt32 epoch, e;
+
+	prev = 0U;
+	epoch = 0U;
+	while (!race->done) {
+		e = race->clk.epoch;
+		ret = clockPosition(&race->clk, 0U, race->now);
+		if (e == epoch && race->clk.epoch == e && ringDistance(prev, ret) >= BUFFER_BYTES / 2U)
+			++race->backwards[reader->index];
+		epoch = race->clk.epoch == e ? e : 0U;
+		prev = ret;
+	}
+	return 0;
+}
+
+/*
+ * Note: Readers on other CPUs race each other and the interrupt side.
+ *   Within an epoch no reader may ever see the position go backwards.
+ */
+static void test_reader_race(void)
+{
+	static Race race;
+	Reader readers[RACE_READERS];
+	pthread_t threads[RACE_READERS + 1];
+	int i;
+
+	memset(&race, 0, sizeof race);
+	clockReset(&race.clk, RATE, BUFFER_BYTES, PERIOD_FRAMES);
+	for (i = 0; i != RACE_READERS; ++i) {
+		readers[i].race = &race;
+		readers[i].index = i;
+		pthread_create(&threads[i], 0, raceReader, &readers[i]);
+	}
+	pthread_create(&threads[RACE_READERS], 0, raceUpdater, &race);
+	for (i = 0; i != RACE_READERS + 1; ++i)
+		pthread_join(threads[i], 0);
+	for (i = 0; i != RACE_READERS; ++i)
+		CHECK(race.backwards[i] == 0U);
+	CHECK(race.clk.epoch > 1U);
+}
+
+static void bench(void)
+{
+	static double const skews[] = { 0.0, 0.001, 0.003, -0.003 };
+	static UInt64 const jitters[] = { 0ULL, 500000ULL, 1500000ULL };
+	Result r;
+	size_t i, j;
+
+	printf("%8s %10s %10s %10s %12s %12s %10s\n", "skew", "jitter us", "mean lag", "max lag",
+		   "cached mean", "cached max", "rate err");
+	for (i = 0U; i != sizeof skews / sizeof skews[0]; ++i)
+		for (j = 0U; j != sizeof jitters / sizeof jitters[0]; ++j) {
+			r = replay(makeTrace(skews[i], jitters[j], -1));
+			printf("%7.1f%% %10llu %10.1f %10llu %12.1f %12llu %9.0fppm\n", skews[i] * 100.0,
+				   static_cast<unsigned long long>(jitters[j] / 1000ULL),
+				   static_cast<double>(r.sumLag) / r.queries,
+				   static_cast<unsigned long long>(r.maxLag),
+				   static_cast<double>(r.sumCachedLag) / r.queries,
+				   static_cast<unsigned long long>(r.maxCachedLag),
+				   (r.measuredRate - r.hwRate) * 1e6 / r.hwRate);
+		}
+}
+
+int main(int argc, char* argv[])
+{
+	test_skew_and_jitter();
+	test_missed_wrap();
+	test_interleaved_readers();
+	test_reader_race();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_position_clock: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_position_clock: ok\n");
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ *  test_register_shadow.cpp
+ *  EnsoniqAudioPCI host checks
+ *
+ *  Drives the codec and SRC RAM shadows in RegisterShadow.h, unchanged,
+ *  against simulated hardware: a codec that drops unimplemented bits
+ *  and times out on reads, and an SRC that updates its accumulators.
+ *  The driver side repeats the sequences in codecRead, codecWrite,
+ *  es1371_src_write_batch and es1371_src_update.  Run with -b for the
+ *  write savings table.
+ */
+
+#include "RegisterShadow.h"
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+#define NUM_CODEC_REGS (kCodecRegisterCount >> 1)
+
+struct FakeCodec
+{
+	IOAC97CodecWord regs[NUM_CODEC_REGS];
+	IOAC97CodecWord implemented[NUM_CODEC_REGS];
+	UInt timeoutOneIn;			// 0 - never
+	UInt64 reads;
+	UInt64 writes;
+	UInt64 timeouts;
+
+	void reset()
+	{
+		memset(regs, 0, sizeof regs);
+		regs[kCodecAudioReset >> 1] = 0x0D50U;
+		regs[kCodecVendorID1 >> 1] = 0x8384U;
+		regs[kCodecVendorID2 >> 1] = 0x7609U;
+	}
+
+	/*
+	 * Note: CODEC_RDY never came, the data lines hold whatever was
+	 *   on them.
+	 */
+	bool read(IOAC97CodecOffset offset, UInt* data)
+	{
+		++reads;
+		if (timeoutOneIn && !(rand() % timeoutOneIn)) {
+			++timeouts;
+			*data = static_cast<UInt>(rand()) & CODEC_PIDAT_MASK;
+			return false;
+		}
+		*data = regs[offset >> 1];
+		if (offset == kCodecPowerdown)
+			regs[offset >> 1] ^= 0x000FU;	// ready bits move on their own
+		return true;
+	}
+
+	void write(IOAC97CodecOffset offset, IOAC97CodecWord word)
+	{
+		++writes;
+		if (offset == kCodecAudioReset) {
+			reset();
+			return;
+		}
+		regs[offset >> 1] = word & implemented[offset >> 1];
+	}
+};
+
+/*
+ * Note: codecRead and codecWrite, with es1371_rdcd and es1371_wrcd
+ *   going to the fake codec.
+ */
+struct Driver
+{
+	CodecShadow shadow;
+	FakeCodec* codec;
+
+	IOReturn codecRead(IOAC97CodecOffset offset, IOAC97CodecWord* word)
+	{
+		UInt data;
+
+		if (offset >= kCodecRegisterCount)
+			return kIOReturnBadArgument;
+		if (codecShadowLookup(&shadow, offset, word))
+			return kIOReturnSuccess;
+		if (!codec->read(offset, &data))
+			return kIOReturnTimeout;
+		*word = static_cast<IOAC97CodecWord>(data);
+		codecShadowFill(&shadow, offset, *word);
+		return kIOReturnSuccess;
+	}
+
+	IOReturn codecWrite(IOAC97CodecOffset offset, IOAC97CodecWord word)
+	{
+		if (offset >= kCodecRegisterCount)
+			return kIOReturnBadArgument;
+		if (codecShadowWrite(&shadow, offset, word))
+			codec->write(offset, word);
+		return kIOReturnSuccess;
+	}
+};
+
+static void initCodec(FakeCodec* codec, Driver* driver, UInt timeoutOneIn)
+{
+	UInt i;
+
+	memset(codec, 0, sizeof *codec);
+	for (i = 0U; i != NUM_CODEC_REGS; ++i)
+		codec->implemented[i] = static_cast<IOAC97CodecWord>(0x9F1FU >> (i & 3U));
+	codec->reset();
+	codec->timeoutOneIn = timeoutOneIn;
+	memset(driver, 0, sizeof *driver);
+	driver->codec = codec;
+}
+
+/*
+ * Note: A timed out read fails, leaves the shadow alone, and the
+ *   next read goes back to the codec.
+ */
+static void test_read_timeout(void)
+{
+	FakeCodec codec;
+	Driver driver;
+	IOAC97CodecWord word;
+
+	initCodec(&codec, &driver, 0U);
+	CHECK(driver.codecWrite(kCodecMasterVolume, 0x8808U) == kIOReturnSuccess);
+	codec.timeoutOneIn = 1U;
+	CHECK(driver.codecRead(kCodecMasterVolume, &word) == kIOReturnTimeout);
+	CHECK(!codecShadowLookup(&driver.shadow, kCodecMasterVolume, &word));
+	codec.timeoutOneIn = 0U;
+	CHECK(driver.codecRead(kCodecMasterVolume, &word) == kIOReturnSuccess);
+	CHECK(word == (0x8808U & codec.implemented[kCodecMasterVolume >> 1]));
+	CHECK(codec.reads == 2U);
+	CHECK(driver.codecRead(kCodecMasterVolume, &word) == kIOReturnSuccess);
+	CHECK(codec.reads == 2U);
+}
+
+/*
+ * Note: Uncached registers always reach the codec, a write matching
+ *   the readback is dropped, reset drops the whole shadow.
+ */
+static void test_write_skip_and_reset(void)
+{
+	FakeCodec codec;
+	Driver driver;
+	IOAC97CodecWord word;
+
+	initCodec(&codec, &driver, 0U);
+	CHECK(driver.codecRead(kCodecPowerdown, &word) == kIOReturnSuccess);
+	CHECK(driver.codecRead(kCodecPowerdown, &word) == kIOReturnSuccess);
+	CHECK(codec.reads == 2U);
+	CHECK(driver.codecWrite(kCodecPCMOutVolume, 0x0808U) == kIOReturnSuccess);
+	CHECK(driver.codecRead(kCodecPCMOutVolume, &word) == kIOReturnSuccess);
+	CHECK(driver.codecWrite(kCodecPCMOutVolume, word) == kIOReturnSuccess);
+	CHECK(codec.writes == 1U);
+	CHECK(driver.codecWrite(kCodecAudioReset, 0U) == kIOReturnSuccess);
+	CHECK(driver.shadow.valid == 0ULL);
+	CHECK(driver.codecRead(kCodecPCMOutVolume, &word) == kIOReturnSuccess && word == 0U);
+}
+
+/*
+ * Note: Random reads, writes and resets with 1 read in `timeoutOneIn`
+ *   timing out.  Every read that succeeds must return what the codec
+ *   holds, whether it came from the shadow or not.
+ */
+static UInt64 soak(UInt timeoutOneIn, int ops, UInt64* writesSent)
+{
+	static IOAC97CodecOffset const mixer[] = {
+		kCodecMasterVolume, kCodecAuxOutVolume, kCodecPCMOutVolume, kCodecLineInVolume,
+		kCodecCDVolume, kCodecRecordSelect, kCodecRecordGain, kCodecPowerdown,
+		kCodecExtAudioStatus, kCodecPCMFrontDACRate, kCodecVendorID1
+	};
+	FakeCodec codec;
+	Driver driver;
+	IOAC97CodecOffset offset;
+	IOAC97CodecWord word;
+	UInt64 wrong, issued;
+	int i, op;
+
+	srand(7);
+	initCodec(&codec, &driver, timeoutOneIn);
+	wrong = 0ULL;
+	issued = 0ULL;
+	for (i = 0; i != ops; ++i) {
+		offset = mixer[static_cast<size_t>(rand()) % (sizeof mixer / sizeof mixer[0])];
+		op = rand() % 64;
+		if (op == 0) {
+			driver.codecWrite(kCodecAudioReset, 0U);
+			++issued;
+		} else if (op < 24) {
+			driver.codecWrite(offset, static_cast<IOAC97CodecWord>((rand() % 4) * 0x0404));
+			++issued;
+		} else if (driver.codecRead(offset, &word) == kIOReturnSuccess &&
+				   offset != kCodecPowerdown &&
+				   word != codec.regs[offset >> 1])
+			++wrong;
+	}
+	if (writesSent)
+		*writesSent = codec.writes * 1000U / (issued ? issued : 1U);
+	return wrong;
+}
+
+static void test_soak(void)
+{
+	CHECK(soak(0U, 200000, 0) == 0ULL);
+	CHECK(soak(50U, 200000, 0) == 0ULL);
+	CHECK(soak(3U, 200000, 0) == 0ULL);
+}
+
+/*
+ * Note: SRC RAM.  The accumulators and the low byte of INT_REGS move
+ *   while the converter runs, only config registers are shadowed.
+ */
+struct FakeSRC
+{
+	UInt16 ram[SRC_RAM_SIZE];
+	UInt busyOneIn;				// 0 - never
+	UInt64 writes;
+
+	void run()
+	{
+		UInt i;
+
+		for (i = 0U; i != SRC_RAM_SIZE; ++i)
+			if (!srcIsConfig(static_cast<UInt16>(i)))
+				ram[i] = static_cast<UInt16>(i >= ES_SMPREG_DAC1 && (i & 3U) == ES_SMPREG_INT_REGS ?
+											 (ram[i] & 0xFF00U) | (rand() & 0xFFU) : rand());
+	}
+};
+
+/*
+ * Note: es1371_src_write_batch and es1371_src_update against FakeSRC.
+ */
+static bool srcWriteBatch(SRCShadow* shadow, FakeSRC* src, SRCWrite const* writes, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		UInt16 reg = writes[i].reg & (SRC_RAM_SIZE - 1U);
+		if (srcShadowMatches(shadow, reg, writes[i].data, 0xFFFFU))
+			continue;
+		if (src->busyOneIn && !(rand() % src->busyOneIn)) {
+			shadow->valid = false;
+			return false;
+		}
+		src->ram[reg] = writes[i].data;
+		++src->writes;
+		shadow->regs[reg] = writes[i].data;
+	}
+	return true;
+}
+
+static void srcUpdate(SRCShadow* shadow, FakeSRC* src, UInt16 reg, UInt16 data, UInt16 mask)
+{
+	SRCWrite w;
+
+	if (srcShadowMatches(shadow, reg, data, mask))
+		return;
+	w.reg = reg;
+	w.data = static_cast<UInt16>((src->ram[reg] & ~mask) | (data & mask));
+	srcWriteBatch(shadow, src, &w, 1);
+}
+
+/*
+ * Note: The register set es1371_dac_rate and es1371_adc_rate program
+ *   for a rate, folded to a few values.
+ */
+static int rateWrites(SRCWrite* w, UInt rate)
+{
+	static UInt16 const bases[] = { ES_SMPREG_DAC1, ES_SMPREG_DAC2, ES_SMPREG_ADC };
+	int n, i;
+
+	n = 0;
+	for (i = 0; i != 3; ++i) {
+		w[n].reg = static_cast<UInt16>(bases[i] + ES_SMPREG_TRUNC_N);
+		w[n++].data = static_cast<UInt16>(rate >> 9);
+		w[n].reg = static_cast<UInt16>(bases[i] + ES_SMPREG_VFREQ_FRAC);
+		w[n++].data = static_cast<UInt16>(rate * 3U);
+	}
+	w[n].reg = ES_SMPREG_VOL_ADC;
+	w[n++].data = 0x1000U;
+	w[n].reg = ES_SMPREG_VOL_DAC1;
+	w[n++].data = 0x1000U;
+	return n;
+}
+
+static UInt64 srcSoak(UInt busyOneIn, int ops, bool* consistent)
+{
+	static UInt const rates[] = { 22050U, 44100U, 48000U };
+	FakeSRC src;
+	SRCShadow shadow;
+	SRCWrite w[16];
+	UInt16 before;
+	int i, n;
+	UInt r;
+
+	srand(11);
+	memset(&src, 0, sizeof src);
+	memset(&shadow, 0, sizeof shadow);
+	for (r = 0U; r != SRC_RAM_SIZE; ++r) {
+		w[0].reg = static_cast<UInt16>(r);
+		w[0].data = 0U;
+		srcWriteBatch(&shadow, &src, &w[0], 1);
+	}
+	shadow.valid = true;
+	src.busyOneIn = busyOneIn;
+	*consistent = true;
+	for (i = 0; i != ops; ++i) {
+		src.run();
+		if (!shadow.valid && !(rand() % 16)) {
+			/* es1371_init reprograms the whole RAM */
+			for (r = 0U; r != SRC_RAM_SIZE; ++r) {
+				src.ram[r] = 0U;
+				shadow.regs[r] = 0U;
+			}
+			shadow.valid = true;
+		}
+		n = rateWrites(&w[0], rates[static_cast<size_t>(rand()) % (sizeof rates / sizeof rates[0])]);
+		srcWriteBatch(&shadow, &src, &w[0], n);
+		before = src.ram[ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS];
+		srcUpdate(&shadow, &src, ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS, 0x1200U, 0xFF00U);
+		if ((src.ram[ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS] & 0x00FFU) != (before & 0x00FFU))
+			*consistent = false;
+		if (shadow.valid)
+			for (r = 0U; r != SRC_RAM_SIZE; ++r)
+				if (srcIsConfig(static_cast<UInt16>(r)) && shadow.regs[r] != src.ram[r])
+					*consistent = false;
+	}
+	return src.writes;
+}
+
+static void test_src_shadow(void)
+{
+	bool consistent;
+	UInt64 unchanged;
+
+	CHECK(!srcIsConfig(ES_SMPREG_DAC1 + ES_SMPREG_INT_REGS));
+	CHECK(srcIsConfig(ES_SMPREG_DAC2 + ES_SMPREG_VFREQ_FRAC));
+	CHECK(srcIsConfig(ES_SMPREG_VOL_DAC2 + 1));
+	unchanged = srcSoak(0U, 20000, &consistent);
+	CHECK(consistent);
+	CHECK(srcSoak(7U, 20000, &consistent) > unchanged);
+	CHECK(consistent);
+}
+
+static void bench(void)
+{
+	static UInt const timeouts[] = { 0U, 1000U, 50U, 3U };
+	UInt64 sent;
+	size_t i;
+	bool consistent;
+
+	printf("%12s %18s\n", "timeout 1 in", "codec writes/1000");
+	for (i = 0U; i != sizeof timeouts / sizeof timeouts[0]; ++i) {
+		soak(timeouts[i], 200000, &sent);
+		printf("%12u %18llu\n", timeouts[i], static_cast<unsigned long long>(sent));
+	}
+	printf("%12s %18s\n", "SRC busy 1 in", "SRC writes/update");
+	for (i = 0U; i != sizeof timeouts / sizeof timeouts[0]; ++i)
+		printf("%12u %18.2f\n", timeouts[i], srcSoak(timeouts[i], 20000, &consistent) / 20000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	test_read_timeout();
+	test_write_skip_and_reset();
+	test_soak();
+	test_src_shadow();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_register_shadow: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_register_shadow: ok\n");
+	return 0;
+}
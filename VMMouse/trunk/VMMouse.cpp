@@ -70,6 +70,7 @@ bool VMMouse::init(OSDictionary * properties)
   _vmmouseAvailable			 = false;
   _useAbsoluteMode			 = true;
   _absoluteModeRequested	 = false;
+  bzero(&_vmmouseState, sizeof _vmmouseState);
 
   OSBoolean* noAbsolute = OSDynamicCast(OSBoolean, getProperty("NoAbsolute"));
   if (noAbsolute && noAbsolute->isTrue())
@@ -437,62 +438,30 @@ void VMMouse::dispatchRelativePointerEventWithPacket(UInt8 * packet,
 	AbsoluteTime now;
 
 	if (_vmmouseAvailable) {
-		VMMOUSE_INPUT_DATA vmmouseInput;
-		IOGPoint pt;
-		int numPackets;
-		bool _isCurrRelative;
+		VMMOUSE_INPUT_DATA vmmouseInput[kVMMouseBatchMax];
+		VMMouseEvent events[kVMMouseBatchMax * kVMMouseEventsPerPacket];
+		unsigned numPackets, numEvents, i;
 
 		if (_useAbsoluteMode && !_absoluteModeRequested) {
 			VMMouseClient_RequestAbsolute();
 			_absoluteModeRequested = true;
 		}
-		while ((numPackets = VMMouseClient_GetInput(&vmmouseInput)))
-		{
-			if (numPackets == static_cast<int>(VMMOUSE_ERROR)) {
+		do {
+			numPackets = VMMouseClient_GetInputBatch(&vmmouseInput[0], kVMMouseBatchMax);
+			if (numPackets == static_cast<unsigned>(VMMOUSE_ERROR)) {
 				VMMouseClient_Disable();
 				VMMouseClient_Enable();
 				if (_absoluteModeRequested)
 					VMMouseClient_RequestAbsolute();
 				break;
 			}
-			buttons = 0;
-			if(vmmouseInput.Buttons & VMMOUSE_MIDDLE_BUTTON)
-				buttons |= 0x04;
-			if(vmmouseInput.Buttons & VMMOUSE_RIGHT_BUTTON)
-				buttons |= 0x02; 			/* Right*/
-			if(vmmouseInput.Buttons & VMMOUSE_LEFT_BUTTON)
-				buttons |= 0x01; 			/* Left*/
-			dx = vmmouseInput.X;
-			dy = vmmouseInput.Y;
-			dz = static_cast<SInt8>(vmmouseInput.Z);
-#if 0 && defined VMX86_DEVEL
-			IOLog("%s: x == %d, y == %d, z == %d, buttons == %u\n", getName(), dx, dy, static_cast<int>(dz), buttons);
-#endif
-			_isCurrRelative = ((vmmouseInput.Flags & VMMOUSE_MOVE_RELATIVE) != 0);
 			clock_get_uptime(reinterpret_cast<uint64_t*>(&now));
-			if (_isCurrRelative)
-				dispatchRelativePointerEvent(dx, -dy, buttons, now);
-			else {
-				pt.x = static_cast<SInt16>(dx/2);
-				pt.y = static_cast<SInt16>(dy/2);
-				dispatchAbsolutePointerEvent(
-					&pt,
-					&_bounds,
-					buttons,
-					buttons != 0,
-					EV_MINPRESSURE,
-					EV_MINPRESSURE,
-					EV_MAXPRESSURE,
-					90,
-					now);
-			}
-											 
-			if ( dz )
-			{
-				dispatchScrollWheelEvent(-dz, 0, 0, now);
-			}
-			
-		}
+			numEvents = vmmouseCoalesce(&_vmmouseState, &vmmouseInput[0], numPackets, &events[0]);
+			for (i = 0; i < numEvents; ++i)
+				dispatchVMMouseEvent(&events[i], now);
+		} while (numPackets == kVMMouseBatchMax);
+		if (vmmouseFlush(&_vmmouseState, &events[0]))
+			dispatchVMMouseEvent(&events[0], now);
 		return;
 	}
   //
@@ -564,6 +533,45 @@ void VMMouse::dispatchRelativePointerEventWithPacket(UInt8 * packet,
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void VMMouse::dispatchAbsolutePointerEventWithButtons(IOGPoint * pt,
+                                                      UInt32     buttons,
+                                                      AbsoluteTime now)
+{
+	dispatchAbsolutePointerEvent(
+		pt,
+		&_bounds,
+		buttons,
+		buttons != 0,
+		EV_MINPRESSURE,
+		EV_MINPRESSURE,
+		EV_MAXPRESSURE,
+		90,
+		now);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void VMMouse::dispatchVMMouseEvent(VMMouseEvent const * event, AbsoluteTime now)
+{
+	IOGPoint pt;
+
+	switch (event->kind) {
+		case kVMMouseEventAbsolute:
+			pt.x = static_cast<SInt16>(event->x);
+			pt.y = static_cast<SInt16>(event->y);
+			dispatchAbsolutePointerEventWithButtons(&pt, event->buttons, now);
+			break;
+		case kVMMouseEventRelative:
+			dispatchRelativePointerEvent(event->x, event->y, event->buttons, now);
+			break;
+		case kVMMouseEventScroll:
+			dispatchScrollWheelEvent(event->dz, 0, 0, now);
+			break;
+	}
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void VMMouse::setMouseEnable(bool enable)
 {
   //
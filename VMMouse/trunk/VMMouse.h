@@ -25,6 +25,7 @@
 
 #include <IOKit/ps2/ApplePS2MouseDevice.h>
 #include <IOKit/hidsystem/IOHIPointing.h>
+#include "VMMouseCoalesce.h"
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Local Declarations
@@ -34,6 +35,7 @@
 #define kPacketLengthStandard     3
 #define kPacketLengthIntellimouse 4
 
+
 typedef enum
 {
   kMouseTypeStandard             = 0x00,
@@ -56,6 +58,7 @@ private:
   unsigned				_vmmouseAvailable:1;
   unsigned				_useAbsoluteMode:1;
   unsigned				_absoluteModeRequested:1;
+  VMMouseCoalesceState	_vmmouseState;
   UInt8                 _packetBuffer[kPacketLengthMax];
   UInt32                _packetByteCount;
   UInt32                _packetLength;
@@ -68,6 +71,10 @@ private:
 
   virtual void   dispatchRelativePointerEventWithPacket(UInt8 * packet,
                                                         UInt32  packetSize);
+  virtual void   dispatchAbsolutePointerEventWithButtons(IOGPoint *   pt,
+                                                         UInt32       buttons,
+                                                         AbsoluteTime now);
+  virtual void   dispatchVMMouseEvent(VMMouseEvent const * event, AbsoluteTime now);
   virtual UInt8  getMouseID();
   virtual UInt32 getMouseInformation();
   virtual void   setCommandByte(UInt8 setBits, UInt8 clearBits);
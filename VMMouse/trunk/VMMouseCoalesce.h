@@ -0,0 +1,123 @@
+/*
+ * VMMouseCoalesce.h
+ *
+ * Turns a batch of VMMouse input packets into the pointer events to
+ * dispatch.  Absolute motion with unchanged buttons is merged into the
+ * newest position, button changes, relative motion and the wheel keep
+ * their order and their own position.
+ */
+
+#ifndef _VMMOUSECOALESCE_H
+#define _VMMOUSECOALESCE_H
+
+#include <IOKit/IOTypes.h>
+extern "C"
+{
+#include "shared/vmmouse_client.h"
+}
+
+#define kVMMouseBatchMax          16        // packets drained per backdoor status read
+#define kVMMouseEventsPerPacket   3         // flush, own event, wheel
+
+enum
+{
+	kVMMouseEventAbsolute = 0,
+	kVMMouseEventRelative,
+	kVMMouseEventScroll
+};
+
+struct VMMouseEvent
+{
+	UInt32 kind;
+	SInt32 x;                               // absolute position or relative motion
+	SInt32 y;
+	UInt32 buttons;
+	SInt16 dz;
+};
+
+struct VMMouseCoalesceState
+{
+	UInt32 buttons;                         // buttons in the last event dispatched
+	bool   pending;                         // merged absolute motion not dispatched yet
+	SInt16 x;
+	SInt16 y;
+};
+
+static inline void vmmouseEmitAbsolute(VMMouseEvent * event, SInt16 x, SInt16 y, UInt32 buttons)
+{
+	event->kind = kVMMouseEventAbsolute;
+	event->x = x;
+	event->y = y;
+	event->buttons = buttons;
+	event->dz = 0;
+}
+
+//
+// Dispatches the merged motion, if any.  Returns the number of events
+// written to out, 0 or 1.
+//
+
+static inline unsigned vmmouseFlush(VMMouseCoalesceState * state, VMMouseEvent * out)
+{
+	if (!state->pending)
+		return 0;
+	state->pending = false;
+	vmmouseEmitAbsolute(out, state->x, state->y, state->buttons);
+	return 1;
+}
+
+//
+// out must hold kVMMouseEventsPerPacket events per packet.  Motion still
+// pending at the end stays in state for a later batch or vmmouseFlush.
+//
+
+static inline unsigned vmmouseCoalesce(VMMouseCoalesceState * state,
+                                       VMMOUSE_INPUT_DATA const * in,
+                                       unsigned numPackets,
+                                       VMMouseEvent * out)
+{
+	unsigned i, n;
+	UInt32 buttons;
+	SInt16 dz;
+
+	for (i = 0, n = 0; i < numPackets; ++i) {
+		buttons = 0;
+		if (in[i].Buttons & VMMOUSE_MIDDLE_BUTTON)
+			buttons |= 0x04;
+		if (in[i].Buttons & VMMOUSE_RIGHT_BUTTON)
+			buttons |= 0x02;            /* Right*/
+		if (in[i].Buttons & VMMOUSE_LEFT_BUTTON)
+			buttons |= 0x01;            /* Left*/
+		dz = static_cast<SInt8>(in[i].Z);
+		if (in[i].Flags & VMMOUSE_MOVE_RELATIVE) {
+			n += vmmouseFlush(state, &out[n]);
+			out[n].kind = kVMMouseEventRelative;
+			out[n].x = in[i].X;
+			out[n].y = -in[i].Y;
+			out[n].buttons = buttons;
+			out[n].dz = 0;
+			++n;
+			state->buttons = buttons;
+		} else if (buttons != state->buttons) {
+			n += vmmouseFlush(state, &out[n]);
+			vmmouseEmitAbsolute(&out[n++], static_cast<SInt16>(in[i].X / 2), static_cast<SInt16>(in[i].Y / 2), buttons);
+			state->buttons = buttons;
+		} else {
+			state->x = static_cast<SInt16>(in[i].X / 2);
+			state->y = static_cast<SInt16>(in[i].Y / 2);
+			state->pending = true;
+		}
+		if (dz) {
+			n += vmmouseFlush(state, &out[n]);
+			out[n].kind = kVMMouseEventScroll;
+			out[n].x = 0;
+			out[n].y = 0;
+			out[n].buttons = state->buttons;
+			out[n].dz = static_cast<SInt16>(-dz);
+			++n;
+		}
+	}
+	return n;
+}
+
+#endif /* _VMMOUSECOALESCE_H */
@@ -279,6 +279,74 @@ VMMouseClient_GetInput (PVMMOUSE_INPUT_DATA pvmmouseInput) {
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * VMMouseClient_GetInputBatch --
+ *
+ *	Drains up to maxPackets 4-word input packets from the VMMouse
+ *	data port.  The queue status is read once for the whole batch,
+ *	so each packet costs one backdoor call instead of two.
+ *
+ * Results:
+ *	The number of packets retrieved, or VMMOUSE_ERROR.
+ *
+ * Side effects:
+ *	Could cause host state change.
+ *
+ *----------------------------------------------------------------------
+ */
+
+unsigned int
+VMMouseClient_GetInputBatch (PVMMOUSE_INPUT_DATA pvmmouseInput, // OUT
+                             unsigned int maxPackets)           // IN
+{
+   uint32_t status;
+   uint32_t numWords;
+   uint32_t packetInfo;
+   unsigned int i;
+   unsigned int numPackets;
+   VMMouseProtoCmd vmpc;
+
+   vmpc.in.vEbx = 0;
+   vmpc.in.command = VMMOUSE_PROTO_CMD_ABSPOINTER_STATUS;
+   VMMouseProto_SendCmd(&vmpc);
+   status = vmpc.out.vEax;
+   if ((status & VMMOUSE_ERROR) == VMMOUSE_ERROR) {
+      VMwareLog(("VMMouseClient_GetInputBatch: VMMOUSE_ERROR status, abort!\n"));
+      return VMMOUSE_ERROR;
+   }
+
+   numWords = status & 0x0000ffff;
+   if ((numWords % 4) != 0) {
+      VMwareLog(("VMMouseClient_GetInputBatch: invalid status numWords, abort!\n"));
+      return (0);
+   }
+
+   numPackets = numWords >> 2;
+   if (numPackets > maxPackets) {
+      numPackets = maxPackets;
+   }
+
+   /*
+    * The data port hands out at most 4 dwords per call, one packet.
+    */
+   for (i = 0; i < numPackets; ++i) {
+      vmpc.in.vEbx = 4;
+      vmpc.in.command = VMMOUSE_PROTO_CMD_ABSPOINTER_DATA;
+      VMMouseProto_SendCmd(&vmpc);
+      packetInfo = vmpc.out.vEax;
+      pvmmouseInput[i].Flags = (packetInfo & 0xffff0000) >> 16;
+      pvmmouseInput[i].Buttons = (packetInfo & 0x0000ffff);
+      pvmmouseInput[i].X = (int)vmpc.out.vEbx;
+      pvmmouseInput[i].Y = (int)vmpc.out.vEcx;
+      pvmmouseInput[i].Z = (int)vmpc.out.vEdx;
+   }
+
+   return numPackets;
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -68,6 +68,8 @@ typedef struct _VMMOUSE_INPUT_DATA {
 Bool VMMouseClient_Enable(void);
 void VMMouseClient_Disable(void);
 unsigned int VMMouseClient_GetInput(PVMMOUSE_INPUT_DATA pvmmouseInput);
+unsigned int VMMouseClient_GetInputBatch(PVMMOUSE_INPUT_DATA pvmmouseInput,
+                                         unsigned int maxPackets);
 void VMMouseClient_RequestRelative(void);
 void VMMouseClient_RequestAbsolute(void);
 
@@ -0,0 +1,20 @@
+/*
+ * IOTypes.h (host shim)
+ * VMMouse host checks
+ *
+ * The few kernel types VMMouseCoalesce.h uses.
+ */
+
+#ifndef _IOTYPES_H
+#define _IOTYPES_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef int8_t SInt8;
+typedef int16_t SInt16;
+typedef int32_t SInt32;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+
+#endif /* _IOTYPES_H */
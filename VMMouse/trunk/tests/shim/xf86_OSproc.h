@@ -0,0 +1,19 @@
+/*
+ * xf86_OSproc.h (host shim)
+ * VMMouse host checks
+ *
+ * The shared VMMouse client sources only take Bool from it.
+ */
+
+#ifndef _XF86_OSPROC_H
+#define _XF86_OSPROC_H
+
+typedef int Bool;
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif /* _XF86_OSPROC_H */
@@ -0,0 +1,14 @@
+/*
+ * xf86_libc.h (host shim)
+ * VMMouse host checks
+ *
+ * Stands in for the unistd.h the Apple build takes instead.
+ */
+
+#ifndef _XF86_LIBC_H
+#define _XF86_LIBC_H
+
+#include <stddef.h>
+#include <unistd.h>
+
+#endif /* _XF86_LIBC_H */
@@ -0,0 +1,354 @@
+/*
+ * test_coalesce.cpp
+ * VMMouse host checks
+ *
+ * Runs shared/vmmouse_client.c and VMMouseCoalesce.h, unchanged,
+ * against a simulated backdoor that queues input packets in bursts.
+ * The driver side repeats the loop in dispatchRelativePointerEventWithPacket.
+ * The events dispatched are compared with one event per packet: button
+ * changes, wheel and relative motion must keep their order and their
+ * position, and each interrupt must end on the newest position.
+ * Run with -b for the backdoor call and event counts.
+ */
+
+#include "VMMouseCoalesce.h"
+extern "C"
+{
+#include "shared/vmmouse_proto.h"
+}
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+#define QUEUE_MAX 4096U						// packets
+#define SIM_PACKETS 40000U
+#define LOG_MAX (1U << 17)					// events, 2 per packet at most
+
+/*
+ * Note: The host side of the backdoor.  ABSPOINTER_STATUS reports the
+ *   words queued, ABSPOINTER_DATA hands out one packet.
+ */
+static struct
+{
+	VMMOUSE_INPUT_DATA queue[QUEUE_MAX];
+	unsigned head;
+	unsigned tail;
+	bool error;
+	unsigned long long calls;
+} host;
+
+extern "C" void VMMouseProto_SendCmd(VMMouseProtoCmd* cmd)
+{
+	VMMOUSE_INPUT_DATA const* p;
+
+	++host.calls;
+	switch (cmd->in.command) {
+		case VMMOUSE_PROTO_CMD_GETVERSION:
+			cmd->out.vEax = 1U;
+			cmd->out.vEbx = VMMOUSE_PROTO_MAGIC;
+			break;
+		case VMMOUSE_PROTO_CMD_ABSPOINTER_STATUS:
+			cmd->out.vEax = host.error ? VMMOUSE_ERROR : 4U * (host.tail - host.head);
+			break;
+		case VMMOUSE_PROTO_CMD_ABSPOINTER_DATA:
+			if (host.head == host.tail || cmd->in.vEbx != 4U) {
+				cmd->out.vEax = 0U;
+				break;
+			}
+			p = &host.queue[host.head++ % QUEUE_MAX];
+			cmd->out.vEax = (static_cast<uint32_t>(p->Flags) << 16) | p->Buttons;
+			cmd->out.vEbx = static_cast<uint32_t>(p->X);
+			cmd->out.vEcx = static_cast<uint32_t>(p->Y);
+			cmd->out.vEdx = static_cast<uint32_t>(p->Z);
+			break;
+		case VMMOUSE_PROTO_CMD_ABSPOINTER_COMMAND:
+			cmd->out.vEax = 0U;
+			break;
+	}
+}
+
+struct Log
+{
+	VMMouseEvent events[LOG_MAX];
+	unsigned count;
+};
+
+static void logEvents(Log* log, VMMouseEvent const* events, unsigned n)
+{
+	unsigned i;
+
+	CHECK(log->count + n <= LOG_MAX);
+	for (i = 0U; i != n && log->count != LOG_MAX; ++i)
+		log->events[log->count++] = events[i];
+}
+
+/*
+ * Note: One interrupt, as in dispatchRelativePointerEventWithPacket.
+ */
+static void interrupt(VMMouseCoalesceState* state, Log* log)
+{
+	VMMOUSE_INPUT_DATA input[kVMMouseBatchMax];
+	VMMouseEvent events[kVMMouseBatchMax * kVMMouseEventsPerPacket];
+	unsigned numPackets;
+
+	do {
+		numPackets = VMMouseClient_GetInputBatch(&input[0], kVMMouseBatchMax);
+		if (numPackets == static_cast<unsigned>(VMMOUSE_ERROR))
+			break;
+		logEvents(log, &events[0], vmmouseCoalesce(state, &input[0], numPackets, &events[0]));
+	} while (numPackets == kVMMouseBatchMax);
+	logEvents(log, &events[0], vmmouseFlush(state, &events[0]));
+}
+
+/*
+ * Note: A user dragging, clicking and scrolling, now and then in
+ *   relative mode.  Coordinates are in the host's doubled units.
+ */
+static VMMOUSE_INPUT_DATA nextPacket(VMMOUSE_INPUT_DATA const* prev)
+{
+	VMMOUSE_INPUT_DATA p = *prev;
+	int r = rand() % 100;
+
+	p.Flags = VMMOUSE_MOVE_ABSOLUTE;
+	p.Z = 0;
+	p.X = (p.X + (rand() % 41) - 20 + 4096) % 4096;
+	p.Y = (p.Y + (rand() % 41) - 20 + 4096) % 4096;
+	if (r < 3)
+		p.Buttons ^= VMMOUSE_LEFT_BUTTON;
+	else if (r < 4)
+		p.Buttons ^= VMMOUSE_RIGHT_BUTTON;
+	else if (r < 8)
+		p.Z = (rand() & 1) ? 1 : 0xFF;
+	else if (r < 10) {
+		p.Flags = VMMOUSE_MOVE_RELATIVE;
+		p.X = (rand() % 9) - 4;
+		p.Y = (rand() % 9) - 4;
+		return p;
+	}
+	if (prev->Flags & VMMOUSE_MOVE_RELATIVE) {
+		p.X = rand() % 4096;
+		p.Y = rand() % 4096;
+	}
+	return p;
+}
+
+/*
+ * Note: The events that must survive coalescing, each with the
+ *   absolute position and buttons in force when it happened.
+ */
+struct Significant
+{
+	UInt32 kind;
+	SInt32 x, y;
+	UInt32 buttons;
+	SInt32 payloadX, payloadY;
+	SInt16 dz;
+};
+
+static unsigned significant(VMMouseEvent const* events, unsigned n, Significant* out)
+{
+	SInt32 x = 0, y = 0;
+	UInt32 buttons = 0;
+	unsigned i, m;
+
+	for (i = 0U, m = 0U; i != n; ++i) {
+		if (events[i].kind == kVMMouseEventAbsolute) {
+			x = events[i].x;
+			y = events[i].y;
+			if (events[i].buttons == buttons)
+				continue;
+			buttons = events[i].buttons;
+		} else if (events[i].kind == kVMMouseEventRelative)
+			buttons = events[i].buttons;
+		out[m].kind = events[i].kind;
+		out[m].x = x;
+		out[m].y = y;
+		out[m].buttons = buttons;
+		out[m].payloadX = events[i].kind == kVMMouseEventRelative ? events[i].x : 0;
+		out[m].payloadY = events[i].kind == kVMMouseEventRelative ? events[i].y : 0;
+		out[m].dz = events[i].dz;
+		++m;
+	}
+	return m;
+}
+
+struct SimResult
+{
+	unsigned long long packets;
+	unsigned long long interrupts;
+	unsigned long long calls;
+	unsigned long long events;
+	unsigned mismatches;
+	unsigned stale;						// interrupts not ending on the newest position
+};
+
+static SimResult simulate(unsigned maxBurst)
+{
+	static Log coalesced, reference;
+	static Significant a[LOG_MAX], b[LOG_MAX];
+	VMMouseCoalesceState state, one;
+	VMMOUSE_INPUT_DATA p;
+	VMMouseEvent events[kVMMouseEventsPerPacket + 1];
+	SimResult r;
+	SInt32 lastX, lastY;
+	unsigned burst, i, na, nb, before;
+
+	srand(3);
+	memset(&host, 0, sizeof host);
+	memset(&r, 0, sizeof r);
+	memset(&state, 0, sizeof state);
+	memset(&one, 0, sizeof one);
+	memset(&p, 0, sizeof p);
+	coalesced.count = 0U;
+	reference.count = 0U;
+	lastX = lastY = 0;
+	while (r.packets < SIM_PACKETS) {
+		burst = 1U + static_cast<unsigned>(rand()) % maxBurst;
+		for (i = 0U; i != burst; ++i) {
+			p = nextPacket(&p);
+			host.queue[host.tail++ % QUEUE_MAX] = p;
+			/* one event per packet: every packet dispatched on its own */
+			logEvents(&reference, &events[0], vmmouseCoalesce(&one, &p, 1U, &events[0]));
+			logEvents(&reference, &events[0], vmmouseFlush(&one, &events[0]));
+			if (!(p.Flags & VMMOUSE_MOVE_RELATIVE)) {
+				lastX = p.X / 2;
+				lastY = p.Y / 2;
+			}
+		}
+		r.packets += burst;
+		++r.interrupts;
+		before = coalesced.count;
+		interrupt(&state, &coalesced);
+		for (i = coalesced.count; i != before; --i)
+			if (coalesced.events[i - 1U].kind == kVMMouseEventAbsolute)
+				break;
+		if (!(p.Flags & VMMOUSE_MOVE_RELATIVE) &&
+			(i == before || coalesced.events[i - 1U].x != lastX || coalesced.events[i - 1U].y != lastY))
+			++r.stale;
+	}
+	r.calls = host.calls;
+	r.events = coalesced.count;
+	na = significant(coalesced.events, coalesced.count, a);
+	nb = significant(reference.events, reference.count, b);
+	if (na != nb)
+		++r.mismatches;
+	for (i = 0U; i != na && i != nb; ++i)
+		if (memcmp(&a[i], &b[i], sizeof a[i]))
+			++r.mismatches;
+	return r;
+}
+
+/*
+ * Note: A button change in the middle of a burst of motion must go out
+ *   at its own position, the motion around it merged.
+ */
+static void test_press_position(void)
+{
+	static VMMOUSE_INPUT_DATA const burst[] = {
+		{ VMMOUSE_MOVE_ABSOLUTE, 0, 100, 100, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, 0, 110, 110, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, VMMOUSE_LEFT_BUTTON, 120, 120, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, VMMOUSE_LEFT_BUTTON, 130, 130, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, VMMOUSE_LEFT_BUTTON, 140, 140, 1 },
+		{ VMMOUSE_MOVE_ABSOLUTE, VMMOUSE_LEFT_BUTTON, 150, 150, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, 0, 160, 160, 0 },
+		{ VMMOUSE_MOVE_ABSOLUTE, 0, 170, 170, 0 }
+	};
+	static Log log;
+	VMMouseCoalesceState state;
+	unsigned i;
+
+	memset(&host, 0, sizeof host);
+	memset(&state, 0, sizeof state);
+	log.count = 0U;
+	for (i = 0U; i != sizeof burst / sizeof burst[0]; ++i)
+		host.queue[host.tail++] = burst[i];
+	interrupt(&state, &log);
+	CHECK(log.count == 7U);
+	CHECK(log.events[0].kind == kVMMouseEventAbsolute && log.events[0].x == 55 && log.events[0].buttons == 0U);
+	CHECK(log.events[1].kind == kVMMouseEventAbsolute && log.events[1].x == 60 && log.events[1].buttons == 1U);
+	CHECK(log.events[2].kind == kVMMouseEventAbsolute && log.events[2].x == 70 && log.events[2].buttons == 1U);
+	CHECK(log.events[3].kind == kVMMouseEventScroll && log.events[3].dz == -1);
+	CHECK(log.events[4].kind == kVMMouseEventAbsolute && log.events[4].x == 75 && log.events[4].buttons == 1U);
+	CHECK(log.events[5].kind == kVMMouseEventAbsolute && log.events[5].x == 80 && log.events[5].buttons == 0U);
+	CHECK(log.events[6].kind == kVMMouseEventAbsolute && log.events[6].x == 85 && log.events[6].buttons == 0U);
+	CHECK(host.calls == 1U + sizeof burst / sizeof burst[0]);
+}
+
+/*
+ * Note: A status error ends the interrupt, motion already merged still
+ *   goes out.
+ */
+static void test_status_error(void)
+{
+	static Log log;
+	VMMOUSE_INPUT_DATA input[kVMMouseBatchMax];
+	VMMouseEvent events[kVMMouseBatchMax * kVMMouseEventsPerPacket];
+	VMMouseCoalesceState state;
+	unsigned i;
+
+	memset(&host, 0, sizeof host);
+	memset(&state, 0, sizeof state);
+	log.count = 0U;
+	for (i = 0U; i != 2U * kVMMouseBatchMax; ++i) {
+		host.queue[host.tail].Flags = VMMOUSE_MOVE_ABSOLUTE;
+		host.queue[host.tail++].X = static_cast<int>(2U * i);
+	}
+	CHECK(VMMouseClient_GetInputBatch(&input[0], kVMMouseBatchMax) == kVMMouseBatchMax);
+	CHECK(host.calls == 1U + kVMMouseBatchMax);
+	logEvents(&log, &events[0], vmmouseCoalesce(&state, &input[0], kVMMouseBatchMax, &events[0]));
+	CHECK(log.count == 0U);
+	host.error = true;
+	CHECK(VMMouseClient_GetInputBatch(&input[0], kVMMouseBatchMax) == VMMOUSE_ERROR);
+	logEvents(&log, &events[0], vmmouseFlush(&state, &events[0]));
+	CHECK(log.count == 1U && log.events[0].x == static_cast<SInt32>(kVMMouseBatchMax - 1U));
+}
+
+static void test_simulation(void)
+{
+	static unsigned const bursts[] = { 1U, 4U, 40U, 200U };
+	SimResult r;
+	size_t i;
+
+	for (i = 0U; i != sizeof bursts / sizeof bursts[0]; ++i) {
+		r = simulate(bursts[i]);
+		CHECK(r.mismatches == 0U);
+		CHECK(r.stale == 0U);
+		CHECK(r.events <= r.packets * 2U);
+		/* one status read per batch of up to kVMMouseBatchMax */
+		CHECK(r.calls <= r.packets + r.packets / kVMMouseBatchMax + r.interrupts);
+	}
+}
+
+static void bench(void)
+{
+	static unsigned const bursts[] = { 1U, 4U, 16U, 40U, 200U };
+	SimResult r;
+	size_t i;
+
+	printf("%10s %10s %16s %16s %16s\n", "max burst", "packets", "backdoor/packet", "events/packet", "unbatched/packet");
+	for (i = 0U; i != sizeof bursts / sizeof bursts[0]; ++i) {
+		r = simulate(bursts[i]);
+		printf("%10u %10llu %16.3f %16.3f %16.3f\n", bursts[i], r.packets,
+			   static_cast<double>(r.calls) / r.packets,
+			   static_cast<double>(r.events) / r.packets, 2.0 + static_cast<double>(r.interrupts) / r.packets);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	test_press_position();
+	test_status_error();
+	test_simulation();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_coalesce: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_coalesce: ok\n");
+	return 0;
+}
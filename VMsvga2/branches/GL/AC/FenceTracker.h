@@ -29,19 +29,46 @@
 #ifndef __FENCETRACKER_H__
 #define __FENCETRACKER_H__
 
+/*
+ * Note: N is the capacity, depth may be lowered at runtime
+ */
 template<size_t N>
 struct FenceTracker
 {
 	size_t counter;
+	size_t depth;
 	unsigned fences[N];
 
-	void init()
+	void init(size_t d = N)
 	{
 		counter = 0;
+		depth = (d && d <= N) ? d : N;
 		bzero(&fences, sizeof fences);
 	}
 
-	unsigned before()
+	/*
+	 * Note: Keeps the newest fences still in flight, oldest first,
+	 *   so the next before() is the fence d presents back, or 0 if
+	 *   that present predates the ones tracked.
+	 */
+	void resize(size_t d)
+	{
+		unsigned kept[N];
+		size_t i, n;
+
+		if (!d || d > N)
+			d = N;
+		n = depth < d ? depth : d;
+		for (i = 0; i != n; ++i)
+			kept[i] = fences[(counter + depth - n + i) % depth];
+		bzero(&fences, sizeof fences);
+		for (i = 0; i != n; ++i)
+			fences[d - n + i] = kept[i];
+		counter = 0;
+		depth = d;
+	}
+
+	unsigned before() const
 	{
 		return fences[counter];
 	}
@@ -50,9 +77,12 @@ struct FenceTracker
 	{
 		fences[counter] = fence;
 		++counter;
-		if (counter == N)
+		if (counter >= depth)
 			counter = 0;
 	}
 };
 
+#define MAX_PRESENT_FENCE_COUNT	4U
+typedef FenceTracker<MAX_PRESENT_FENCE_COUNT> PresentTracker;
+
 #endif /* __FENCETRACKER_H__ */
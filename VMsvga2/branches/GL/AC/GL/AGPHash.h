@@ -0,0 +1,97 @@
+/*
+ *  AGPHash.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on January 24th 2011.
+ *  Copyright 2011 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __AGPHASH_H__
+#define __AGPHASH_H__
+
+/*
+ * Chained hash of TEX_TYPE_AGP textures by (address, size).  T needs
+ *   agp_addr, agp_size and agp_hash_next.  The bucket count is a power
+ *   of two, mask is one less.
+ */
+
+/*
+ * Note: Every hashed texture holds a handle, so one bucket per handle
+ *   keeps the load factor at or below 1.
+ */
+static inline
+uint32_t agp_hash_buckets(uint32_t num_handles)
+{
+	uint32_t n = 1U;
+
+	while (n < num_handles)
+		n <<= 1;
+	return n;
+}
+
+static inline
+uint32_t agp_hash(mach_vm_address_t addr, vm_size_t size, uint32_t mask)
+{
+	uint64_t h = (addr >> PAGE_SHIFT) ^ (static_cast<uint64_t>(size >> PAGE_SHIFT) << 24);
+	h *= 0x9E3779B97F4A7C15ULL;
+	return static_cast<uint32_t>(h >> 32) & mask;
+}
+
+template<typename T>
+static inline
+void agp_hash_insert(T** table, uint32_t mask, T* texture)
+{
+	uint32_t b = agp_hash(texture->agp_addr, texture->agp_size, mask);
+	texture->agp_hash_next = table[b];
+	table[b] = texture;
+}
+
+template<typename T>
+static inline
+void agp_hash_remove(T** table, uint32_t mask, T* texture)
+{
+	T** pp;
+
+	for (pp = &table[agp_hash(texture->agp_addr, texture->agp_size, mask)];
+		 *pp;
+		 pp = &(*pp)->agp_hash_next)
+		if (*pp == texture) {
+			*pp = texture->agp_hash_next;
+			texture->agp_hash_next = 0;
+			return;
+		}
+}
+
+template<typename T>
+static inline
+T* agp_hash_find(T* const* table, uint32_t mask, mach_vm_address_t addr, vm_size_t size)
+{
+	T* p;
+
+	for (p = table[agp_hash(addr, size, mask)]; p; p = p->agp_hash_next)
+		if (p->agp_addr == addr && p->agp_size == size)
+			return p;
+	return 0;
+}
+
+#endif /* __AGPHASH_H__ */
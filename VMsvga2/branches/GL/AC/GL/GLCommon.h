@@ -92,6 +92,7 @@ struct VMsvga2TextureBuffer
 	uint32_t vram_page_bytes;		// offset 0xA0
 									// offset 0xA4 - 0xAC are dwords
 									// ends   0xAC
+	VMsvga2TextureBuffer* agp_hash_next;	// Added, for TEX_TYPE_AGP
 };
 #endif /* GL_INCL_SHARED */
 
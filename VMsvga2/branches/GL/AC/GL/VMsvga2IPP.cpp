@@ -36,6 +36,7 @@
 #include "VLog.h"
 #include "VMsvga2Accel.h"
 #include "VMsvga2IPP.h"
+#include "VertexConvert.h"
 
 #define CLASS VMsvga2IPP
 #define super OSObject
@@ -49,8 +50,6 @@ OSDefineMetaClassAndStructors(VMsvga2IPP, OSObject);
 
 #define HIDDEN __attribute__((visibility("hidden")))
 
-#define MAX_NUM_DECLS 12U
-
 #define TC2S_MAP_ID 0x76543210U
 #define TC2S_MAP_ID_VALIDS 255U
 
@@ -432,22 +431,57 @@ void make_polygon_index_array(uint16_t* arr, uint16_t base_index, uint16_t num_v
 		*arr = base_index + v1;
 }
 
+/*
+ * Note: Direct primitives reach here for everything but PRIM3D_POLY,
+ *   indirect ones draw a polygon as a fan from the vertex buffer.
+ */
 static
-void flatshade_polygon(uint8_t* vertex_array,
-					   size_t num_vertices,
-					   SVGA3dVertexDecl const* decls,
-					   size_t num_decls)
+bool set_primitive_range(uint32_t prim_kind,
+						 size_t num_vertices,
+						 SVGA3dPrimitiveRange* range)
 {
-	size_t i, j;
-
-	for (i = 0U; i != num_decls; ++i)
-		if (decls[i].identity.type == SVGA3D_DECLTYPE_D3DCOLOR) {
-			uint8_t* p = vertex_array + decls[i].array.offset;
-			uint32_t color = *reinterpret_cast<uint32_t const*>(p);
-			p += decls[i].array.stride;
-			for (j = 1U; j != num_vertices; ++j, p += decls[i].array.stride)
-				*reinterpret_cast<uint32_t*>(p) = color;
-		}
+	switch (prim_kind) {
+		case 0: /* PRIM3D_TRILIST */
+			if (num_vertices < 3U)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_TRIANGLELIST;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices / 3U);
+			break;
+		case 1: /* PRIM3D_TRISTRIP */
+			if (num_vertices < 3U)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_TRIANGLESTRIP;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices - 2U);
+			break;
+		case 3: /* PRIM3D_TRIFAN */
+		case 4: /* PRIM3D_POLY */
+			if (num_vertices < 3U)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_TRIANGLEFAN;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices - 2U);
+			break;
+		case 5: /* PRIM3D_LINELIST */
+			if (num_vertices < 2U)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_LINELIST;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices >> 1);
+			break;
+		case 6: /* PRIM3D_LINESTRIP */
+			if (num_vertices < 2U)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_LINESTRIP;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices - 1U);
+			break;
+		case 8: /* PRIM3D_POINTLIST */
+			if (!num_vertices)
+				return false;
+			range->primType = SVGA3D_PRIMITIVE_POINTLIST;
+			range->primitiveCount = static_cast<uint32_t>(num_vertices);
+			break;
+		default:
+			return false;	// error, shouldn't get here
+	}
+	return true;
 }
 
 #pragma mark -
@@ -462,6 +496,7 @@ void CLASS::Init()
 	m_active_shid = SVGA_ID_INVALID - 1;
 	m_arrays.init();
 	memset32(&surface_ids[0], SVGA_ID_INVALID, 16U);
+	imm_s[0] = SVGA_ID_INVALID;	// no vertex buffer bound
 }
 
 HIDDEN
@@ -479,6 +514,10 @@ void CLASS::Cleanup()
 		m_provider->FreeContextID(m_context_id);
 		m_context_id = SVGA_ID_INVALID;
 	}
+	PPLog(2, "%s: vertex arrays - %u segments, %llu stalls, %llu max bytes in flight\n", __FUNCTION__,
+		  m_arrays.getStats(m_provider)->num_segments,
+		  m_arrays.getStats(m_provider)->num_stalls,
+		  m_arrays.getStats(m_provider)->max_bytes_in_flight);
 	m_arrays.purge(m_provider);
 no_provider:
 	if (m_float_cache) {
@@ -637,75 +676,38 @@ void CLASS::calc_adjustment_map(uint8_t* map) const
 }
 
 HIDDEN
-void CLASS::adjust_texture_coords(uint8_t const* map,
-								  uint8_t* vertex_array,
-								  size_t num_vertices,
-								  void const* decls,
-								  size_t num_decls) const
+size_t CLASS::build_vertex_conversion(VertexConvertOp* ops,
+									  uint8_t const* map,
+									  void const* decls,
+									  size_t num_decls,
+									  bool flatshade) const
 {
-#ifdef VECTORIZE
-	static __attribute__((aligned(8)))
-	float const const_halves[2] = { 0.5F, 0.5F };
-	__v4sf xmm0, xmm1, xmm2;
-#endif
 	SVGA3dVertexDecl const* _decls = static_cast<SVGA3dVertexDecl const*>(decls);
-	size_t i, j;
-	float const* f;
-	float* q;
+	size_t i, num_ops;
 	uint8_t map_mask;
 
 #if LOGGING_LEVEL >= 4
 	PPLog(4, "%s:   s2 == %#x, s4 == %#x\n", __FUNCTION__,
 		  imm_s[2], imm_s[4] & 0x1FC4U);
 #endif
-#ifdef VECTORIZE
-	__asm__ volatile ("xorps %0, %0" "\n\t"
-					  "movlps %1, %0" : "=x"(xmm0) : "m"(const_halves[0]) );
-#endif
-	for (i = 0U, map_mask = map[8]; i != num_decls; ++i) {
-		if (_decls[i].identity.usage != SVGA3D_DECLUSAGE_TEXCOORD ||
-			!bit_select(map_mask, _decls[i].identity.usageIndex, 1))
-			continue;
-		f = m_float_cache + 4U * map[_decls[i].identity.usageIndex];
+	for (i = 0U, num_ops = 0U, map_mask = map[8]; i != num_decls; ++i) {
 		/*
 		 * Barbarically assume at least FLOAT2 and adjust
 		 *   Note: The GLD always uses FLOAT4 projective tex-coords.
 		 */
-#ifdef VECTORIZE
-		__asm__ volatile ("movaps %1, %0" : "=x"(xmm1) : "m"(*f) );
-#endif
-		for (j = 0U; j != num_vertices; ++j) {
-			q = reinterpret_cast<typeof q>(vertex_array + j * _decls[i].array.stride + _decls[i].array.offset);
-#if LOGGING_LEVEL >= DETAIL_COORD
-			PPLog(3, "%s:   adjusting X == %d, Y == %d, Z == %d, W == %d\n", __FUNCTION__,
-				  static_cast<int>(q[0]),
-				  static_cast<int>(q[1]),
-				  static_cast<int>(q[2] * 32767.0F),
-				  static_cast<int>(q[3] * 32767.0F));
-#endif
-#ifdef VECTORIZE
-			__asm__ volatile ("movlps %0, %1" "\n\t"
-							  "addps %3, %1" "\n\t"
-							  "mulps %2, %1" "\n\t"
-							  "movlps %1, %0" : "+m"(*q), "=x"(xmm2) : "x"(xmm1), "x"(xmm0) );
-#else
-			q[0] = (q[0] + 0.5F) * f[0];
-			q[1] = (q[1] + 0.5F) * f[1];
-#endif
+		if (_decls[i].identity.usage == SVGA3D_DECLUSAGE_TEXCOORD &&
+			bit_select(map_mask, _decls[i].identity.usageIndex, 1)) {
+			ops[num_ops].kind = VCONV_TEXCOORD;
+			ops[num_ops].offset = _decls[i].array.offset;
+			ops[num_ops].scale = m_float_cache + 4U * map[_decls[i].identity.usageIndex];
+			++num_ops;
+		} else if (flatshade && _decls[i].identity.type == SVGA3D_DECLTYPE_D3DCOLOR) {
+			ops[num_ops].kind = VCONV_FLATSHADE;
+			ops[num_ops].offset = _decls[i].array.offset;
+			++num_ops;
 		}
 	}
-#if LOGGING_LEVEL >= DETAIL_COORD
-	for (j = 0U; j != num_vertices; ++j) {
-		unsigned const* r = reinterpret_cast<unsigned const*>(vertex_array + j * _decls[1].array.stride + _decls[1].array.offset);
-		f = reinterpret_cast<float const*>(vertex_array + j * _decls[0].array.stride + _decls[0].array.offset);
-		PPLog(3, "%s:   vertex coord X == %d, Y == %d, Z == %d, W == %d, color == %#x\n", __FUNCTION__,
-			  static_cast<int>(f[0]),
-			  static_cast<int>(f[1]),
-			  static_cast<int>(f[2] * 32767.0F),
-			  static_cast<int>(f[3] * 32767.0F),
-			  r[0]);
-	}
-#endif
+	return num_ops;
 }
 
 #pragma mark -
@@ -748,12 +750,13 @@ bool CLASS::cache_misc_reg(uint8_t regnum, uint32_t value)
 HIDDEN
 void CLASS::ip_prim3d_poly(uint32_t const* vertex_data, size_t num_vertex_dwords)
 {
-	size_t i, num_decls, num_vertices, vsize, isize;
+	size_t i, num_decls, num_vertices, vsize, isize, num_ops;
 	uint8_t* vertex_ptr;
 	IOReturn rc;
 	uint32_t vertex_sid;
 	uint8_t adjustment_map[9];
 	SVGA3dVertexDecl decls[MAX_NUM_DECLS];
+	VertexConvertOp ops[MAX_NUM_DECLS];
 	SVGA3dPrimitiveRange range;
 
 	if (!num_vertex_dwords || !vertex_data)
@@ -794,17 +797,17 @@ void CLASS::ip_prim3d_poly(uint32_t const* vertex_data, size_t num_vertex_dwords
 							 0U,
 							 static_cast<uint16_t>(num_vertices));
 	calc_adjustment_map(&adjustment_map[0]);
-	if (adjustment_map[8])
-		adjust_texture_coords(&adjustment_map[0],
-							  vertex_ptr,
-							  num_vertices,
-							  &decls[0],
-							  num_decls);
-	if (imm_s[4] & (1U << 15))
-		flatshade_polygon(vertex_ptr,
-						  num_vertices,
-						  &decls[0],
-						  num_decls);
+	num_ops = build_vertex_conversion(&ops[0],
+									  &adjustment_map[0],
+									  &decls[0],
+									  num_decls,
+									  (imm_s[4] & (1U << 15)) != 0U);
+	if (num_ops)
+		convert_vertices(vertex_ptr,
+						 num_vertices,
+						 decls[0].array.stride,
+						 &ops[0],
+						 num_ops);
 	rc = m_arrays.upload(m_provider, vertex_ptr, vsize + isize, &vertex_sid);
 	if (rc != kIOReturnSuccess) {
 		PPLog(1, "%s: upload_arrays return %#x\n", __FUNCTION__, rc);
@@ -833,12 +836,13 @@ void CLASS::ip_prim3d_poly(uint32_t const* vertex_data, size_t num_vertex_dwords
 HIDDEN
 void CLASS::ip_prim3d_direct(uint32_t prim_kind, uint32_t const* vertex_data, size_t num_vertex_dwords)
 {
-	size_t i, num_decls, num_vertices, vsize;
+	size_t i, num_decls, num_vertices, vsize, num_ops;
 	uint8_t* vertex_ptr;
 	IOReturn rc;
 	uint32_t vertex_sid;
 	uint8_t adjustment_map[9];
 	SVGA3dVertexDecl decls[MAX_NUM_DECLS];
+	VertexConvertOp ops[MAX_NUM_DECLS];
 	SVGA3dPrimitiveRange range;
 
 	if (!num_vertex_dwords || !vertex_data)
@@ -859,46 +863,8 @@ void CLASS::ip_prim3d_direct(uint32_t prim_kind, uint32_t const* vertex_data, si
 #endif
 	vsize = num_vertex_dwords * sizeof(uint32_t);
 	num_vertices = vsize / decls[0].array.stride;
-	switch (prim_kind) {
-		case 0: /* PRIM3D_TRILIST */
-			if (num_vertices < 3U)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_TRIANGLELIST;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices / 3U);
-			break;
-		case 1: /* PRIM3D_TRISTRIP */
-			if (num_vertices < 3U)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_TRIANGLESTRIP;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices - 2U);
-			break;
-		case 3: /* PRIM3D_TRIFAN */
-			if (num_vertices < 3U)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_TRIANGLEFAN;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices - 2U);
-			break;
-		case 5: /* PRIM3D_LINELIST */
-			if (num_vertices < 2U)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_LINELIST;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices >> 1);
-			break;
-		case 6: /* PRIM3D_LINESTRIP */
-			if (num_vertices < 2U)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_LINESTRIP;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices - 1U);
-			break;
-		case 8: /* PRIM3D_POINTLIST */
-			if (!num_vertices)
-				return; // nothing to do
-			range.primType = SVGA3D_PRIMITIVE_POINTLIST;
-			range.primitiveCount = static_cast<uint32_t>(num_vertices);
-			break;
-		default:
-			return;	// error, shouldn't get here
-	}
+	if (!set_primitive_range(prim_kind, num_vertices, &range))
+		return; // nothing to do
 	rc = m_arrays.alloc(m_provider, vsize, &vertex_ptr);
 	if (rc != kIOReturnSuccess) {
 		PPLog(1, "%s: alloc_arrays return %#x\n", __FUNCTION__, rc);
@@ -910,12 +876,17 @@ void CLASS::ip_prim3d_direct(uint32_t prim_kind, uint32_t const* vertex_data, si
 		  decls[0].array.stride, num_vertices, vsize);
 #endif
 	calc_adjustment_map(&adjustment_map[0]);
-	if (adjustment_map[8])
-		adjust_texture_coords(&adjustment_map[0],
-							  vertex_ptr,
-							  num_vertices,
-							  &decls[0],
-							  num_decls);
+	num_ops = build_vertex_conversion(&ops[0],
+									  &adjustment_map[0],
+									  &decls[0],
+									  num_decls,
+									  false);
+	if (num_ops)
+		convert_vertices(vertex_ptr,
+						 num_vertices,
+						 decls[0].array.stride,
+						 &ops[0],
+						 num_ops);
 	rc = m_arrays.upload(m_provider, vertex_ptr, vsize, &vertex_sid);
 	if (rc != kIOReturnSuccess) {
 		PPLog(1, "%s: upload_arrays return %#x\n", __FUNCTION__, rc);
@@ -939,6 +910,123 @@ void CLASS::ip_prim3d_direct(uint32_t prim_kind, uint32_t const* vertex_data, si
 		PPLog(1, "%s: drawPrimitives return %#x\n", __FUNCTION__, rc);
 }
 
+HIDDEN
+void CLASS::ip_prim3d_indirect(uint32_t prim_kind, uint32_t const* p, uint32_t cmd)
+{
+	size_t i, num_decls, num_vertices, num_indices, isize;
+	uint16_t const* indices;
+	uint8_t* index_ptr;
+	IOReturn rc;
+	uint32_t vertex_sid, index_sid, start, last;
+	uint8_t adjustment_map[9];
+	SVGA3dVertexDecl decls[MAX_NUM_DECLS];
+	VertexConvertOp ops[MAX_NUM_DECLS];
+	SVGA3dPrimitiveRange range;
+
+	/*
+	 * Note: S0 carries the sid of the host vertex buffer
+	 *   in place of the GART address (see process_token_VertexBuffer)
+	 */
+	vertex_sid = imm_s[0];
+	if (!isIdValid(vertex_sid)) {
+		PPLog(1, "%s: indirect primitive with no vertex buffer\n", __FUNCTION__);
+		return;
+	}
+	switch (prim_kind) {
+		case 0: /* PRIM3D_TRILIST */
+		case 1: /* PRIM3D_TRISTRIP */
+		case 3: /* PRIM3D_TRIFAN */
+		case 4: /* PRIM3D_POLY */
+		case 5: /* PRIM3D_LINELIST */
+		case 6: /* PRIM3D_LINESTRIP */
+		case 8: /* PRIM3D_POINTLIST */
+			break;
+		default:
+			PPLog(1, "%s:   primkind == %u Unsupported\n", __FUNCTION__, prim_kind);
+			return;
+	}
+	num_decls = sizeof decls / sizeof decls[0];
+	rc = analyze_vertex_format(imm_s[2],
+							   imm_s[4],
+							   &decls[0],
+							   &num_decls);
+	if (rc != kIOReturnSuccess) {
+		PPLog(1, "%s: analyze_vertex_format return %#x\n", __FUNCTION__, rc);
+		return;
+	}
+	if (!num_decls || !decls[0].array.stride)
+		return;	// nothing to do
+	/*
+	 * Note: The vertices stay in the host buffer, so there's
+	 *   no way to convert them on the way.  Drawing them raw
+	 *   would render garbage, so skip the primitive.
+	 */
+	calc_adjustment_map(&adjustment_map[0]);
+	if (build_vertex_conversion(&ops[0],
+								&adjustment_map[0],
+								&decls[0],
+								num_decls,
+								false)) {
+		PPLog(1, "%s: vertex conversion Unsupported for vertex buffers\n", __FUNCTION__);
+		return;
+	}
+	if (cmd & (1U << 17)) {	/* PRIM_INDIRECT_ELTS */
+		indices = reinterpret_cast<uint16_t const*>(&p[1]);
+		num_indices = cmd & 0xFFFFU;
+		if (!num_indices)
+			while (indices[num_indices] != 0xFFFFU)
+				++num_indices;
+		last = 0U;
+		for (i = 0U; i != num_indices; ++i)
+			if (indices[i] > last)
+				last = indices[i];
+		if (!set_primitive_range(prim_kind, num_indices, &range))
+			return; // nothing to do
+		isize = num_indices * sizeof(uint16_t);
+		rc = m_arrays.alloc(m_provider, isize, &index_ptr);
+		if (rc != kIOReturnSuccess) {
+			PPLog(1, "%s: alloc_arrays return %#x\n", __FUNCTION__, rc);
+			return;
+		}
+		memcpy(index_ptr, indices, isize);
+		rc = m_arrays.upload(m_provider, index_ptr, isize, &index_sid);
+		if (rc != kIOReturnSuccess) {
+			PPLog(1, "%s: upload_arrays return %#x\n", __FUNCTION__, rc);
+			return;
+		}
+		range.indexArray.surfaceId = index_sid;
+		++last;
+	} else {
+		num_vertices = cmd & 0xFFFFU;
+		start = p[1] & 0xFFFFU;
+		if (!set_primitive_range(prim_kind, num_vertices, &range))
+			return; // nothing to do
+		for (i = 0U; i != num_decls; ++i)
+			decls[i].array.offset += start * decls[0].array.stride;
+		range.indexArray.surfaceId = SVGA_ID_INVALID;
+		last = static_cast<uint32_t>(num_vertices);
+	}
+#if LOGGING_LEVEL >= 4
+	PPLog(4, "%s:   primkind == %u, vertex_sid == %u, last == %u\n", __FUNCTION__,
+		  prim_kind, vertex_sid, last);
+#endif
+	range.indexArray.offset = 0U;
+	range.indexArray.stride = sizeof(uint16_t);
+	range.indexWidth = sizeof(uint16_t);
+	range.indexBias = 0U;
+	for (i = 0U; i != num_decls; ++i) {
+		decls[i].array.surfaceId = vertex_sid;
+		decls[i].rangeHint.last = last;
+	}
+	rc = m_provider->drawPrimitives(m_context_id,
+									static_cast<uint32_t>(num_decls),
+									1U,
+									&decls[0],
+									&range);
+	if (rc != kIOReturnSuccess)
+		PPLog(1, "%s: drawPrimitives return %#x\n", __FUNCTION__, rc);
+}
+
 HIDDEN
 uint32_t CLASS::ip_prim3d(uint32_t* p, uint32_t cmd)
 {
@@ -947,7 +1035,6 @@ uint32_t CLASS::ip_prim3d(uint32_t* p, uint32_t cmd)
 	float const* pf;
 
 	if (cmd & (1U << 23)) {
-		PPLog(1, "%s: indirect primitive\n", __FUNCTION__);
 		if (cmd & (1U << 17)) {
 			skip = cmd & 0xFFFFU;
 			if (!skip) {	// variable length, look for 0xFFFFU terminator
@@ -958,7 +1045,8 @@ uint32_t CLASS::ip_prim3d(uint32_t* p, uint32_t cmd)
 			skip = (skip + 1U) / 2U + 1U;
 		} else
 			skip = 2U;
-		return skip;	// Indirect Primitive, not handled
+		ip_prim3d_indirect(primkind, p, cmd);
+		return skip;
 	}
 	/*
 	 * Direct Primitive
@@ -2060,7 +2148,8 @@ void CLASS::detach_render_targets(void)
 HIDDEN
 uint32_t CLASS::submit_buffer(uint32_t* kernel_buffer_ptr, uint32_t size_dwords)
 {
-	uint32_t *p, *limit, cmd, skip;
+	uint32_t *p, *limit, cmd, skip, fence;
+	SVGA3D* svga3d;
 #if LOGGING_LEVEL >= 4
 	PPLog(4, "%s:   offset %d, size %u [in dwords]\n", __FUNCTION__,
 		  static_cast<int>(kernel_buffer_ptr - &m_command_buffer.kernel_ptr->downstream[0]),
@@ -2088,8 +2177,15 @@ uint32_t CLASS::submit_buffer(uint32_t* kernel_buffer_ptr, uint32_t size_dwords)
 		}
 	}
 	/*
-	 * Note: original inserts a fence and returns the fence
-	 *   should probably do the same for finish()
+	 * Note: like the original, fence the buffer and return the fence
+	 *   as the submit stamp.
 	 */
-	return 0U;
+	if (!size_dwords)
+		return 0U;
+	svga3d = m_provider->lock3D();
+	if (!svga3d)
+		return 0U;
+	fence = svga3d->InsertFence();
+	m_provider->unlock3D();
+	return fence;
 }
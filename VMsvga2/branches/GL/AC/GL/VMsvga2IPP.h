@@ -83,15 +83,16 @@ private:
 	void purge_shader_cache();
 	void unbind_samplers(uint16_t mask);
 	void calc_adjustment_map(uint8_t* map) const;
-	void adjust_texture_coords(uint8_t const* map,
-							   uint8_t* vertex_array,
-							   size_t num_vertices,
-							   void const* decls,
-							   size_t num_decls) const;
+	size_t build_vertex_conversion(struct VertexConvertOp* ops,
+								   uint8_t const* map,
+								   void const* decls,
+								   size_t num_decls,
+								   bool flatshade) const;
 	uint8_t calc_color_write_enable(void) const;
 	bool cache_misc_reg(uint8_t regnum, uint32_t value);
 	void ip_prim3d_poly(uint32_t const* vertex_data, size_t num_vertex_dwords);
 	void ip_prim3d_direct(uint32_t prim_kind, uint32_t const* vertex_data, size_t num_vertex_dwords);
+	void ip_prim3d_indirect(uint32_t prim_kind, uint32_t const* p, uint32_t cmd);
 	uint32_t ip_prim3d(uint32_t* p, uint32_t cmd);
 	uint32_t ip_load_immediate(uint32_t* p, uint32_t cmd);
 	uint32_t ip_clear_params(uint32_t* p, uint32_t cmd);
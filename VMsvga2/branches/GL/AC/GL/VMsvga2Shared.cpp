@@ -32,6 +32,7 @@
 #include "VMsvga2Accel.h"
 #include "VMsvga2Shared.h"
 #include "VMsvga2Surface.h"
+#include "AGPHash.h"
 #include "UCGLDCommonTypes.h"
 #include "VLog.h"
 
@@ -184,6 +185,16 @@ void CLASS::deref_client_shared(uint32_t object_id, int addend)
 HIDDEN
 void CLASS::free_handles()
 {
+	if (m_agp_hash) {
+		IOFree(m_agp_hash, (m_agp_hash_mask + 1U) * sizeof *m_agp_hash);
+		m_agp_hash = 0;
+		m_agp_hash_mask = 0;
+	}
+	if (m_free_handles) {
+		IOFree(m_free_handles, m_num_handles * sizeof(uint32_t));
+		m_free_handles = 0;
+		m_num_free_handles = 0;
+	}
 	if (m_handle_table) {
 		IOFree(m_handle_table, m_num_handles * sizeof(void*));
 		m_handle_table = 0;
@@ -194,11 +205,33 @@ void CLASS::free_handles()
 HIDDEN
 bool CLASS::alloc_handles()
 {
-	uint32_t num_handles = NUM_TEXTURE_HANDLES;
+	uint32_t i, num_handles = NUM_TEXTURE_HANDLES, num_buckets = agp_hash_buckets(NUM_TEXTURE_HANDLES);
 	m_handle_table = static_cast<void**>(IOMalloc(num_handles * sizeof(void*)));
 	if (!m_handle_table)
 		return false;
+	m_free_handles = static_cast<uint32_t*>(IOMalloc(num_handles * sizeof(uint32_t)));
+	if (!m_free_handles) {
+		IOFree(m_handle_table, num_handles * sizeof(void*));
+		m_handle_table = 0;
+		return false;
+	}
+	m_agp_hash = static_cast<VMsvga2TextureBuffer**>(IOMalloc(num_buckets * sizeof *m_agp_hash));
+	if (!m_agp_hash) {
+		IOFree(m_free_handles, num_handles * sizeof(uint32_t));
+		m_free_handles = 0;
+		IOFree(m_handle_table, num_handles * sizeof(void*));
+		m_handle_table = 0;
+		return false;
+	}
+	m_agp_hash_mask = num_buckets - 1U;
+	bzero(m_agp_hash, num_buckets * sizeof *m_agp_hash);
 	bzero(m_handle_table, num_handles * sizeof(void*));
+	/*
+	 * Stacked in reverse so lowest handles are handed out first
+	 */
+	for (i = 0U; i != num_handles; ++i)
+		m_free_handles[i] = num_handles - 1U - i;
+	m_num_free_handles = num_handles;
 	m_num_handles = num_handles;
 	return true;
 }
@@ -207,16 +240,13 @@ HIDDEN
 bool CLASS::alloc_buf_handle(void* entry, uint32_t* object_id)
 {
 	uint32_t i;
-	if (!entry)
+	if (!entry || !m_num_free_handles)
 		return false;
-	for (i = 0U; i != m_num_handles; ++i)
-		if (!m_handle_table[i]) {
-			m_handle_table[i] = entry;
-			if (object_id)
-				*object_id = i;
-			return true;
-		}
-	return false;
+	i = m_free_handles[--m_num_free_handles];
+	m_handle_table[i] = entry;
+	if (object_id)
+		*object_id = i;
+	return true;
 }
 
 HIDDEN
@@ -227,6 +257,7 @@ void CLASS::free_buf_handle(void* entry, uint32_t object_id)
 		m_handle_table[object_id] != entry)
 		return;
 	m_handle_table[object_id] = 0;
+	m_free_handles[m_num_free_handles++] = object_id;
 }
 
 HIDDEN
@@ -389,30 +420,23 @@ VMsvga2TextureBuffer* CLASS::new_agp_texture(mach_vm_address_t pixels,
 		down_pixels = reinterpret_cast<mach_vm_address_t>(bmd->getBytesNoCopy()); // TBD: won't work with 32-bit kernel, 64-bit user
 		goto common;
 	}
-	for (p1 = m_texture_list; p1; p1 = p1->next) {	// p1 in ebx
-		if (p1->sys_obj_type != TEX_TYPE_AGP ||
-			p1->mem_changed ||
-#if 0
-			p1->agp_offset_in_page != offset_in_page ||
-#endif
-			p1->agp_addr != down_pixels ||
-			p1->agp_size != up_size)
-			continue;
+	p1 = find_agp_texture(down_pixels, up_size);
+	if (p1) {
 		md = IOMemoryDescriptor::withPersistentMemoryDescriptor(p1->xfer.md);	// md in esi
 		if (md != p1->xfer.md) {
 			p1->mem_changed = 1U;
+			unhash_agp_texture(p1);
 			if (md)
 				goto common;
-			else
-				break;
-		}
-		md->release();
-		*sys_obj_client_addr = p1->sys_obj_client_addr;
-		if (p1 != m_texture_list) {
-			unlink_nonhead_texture(p1);
-			link_texture_at_head(p1);
+		} else {
+			md->release();
+			*sys_obj_client_addr = p1->sys_obj_client_addr;
+			if (p1 != m_texture_list) {
+				unlink_nonhead_texture(p1);
+				link_texture_at_head(p1);
+			}
+			return p1;
 		}
-		return p1;
 	}
 	ro = isUserMemoryReadOnly(m_owning_task, down_pixels, up_size);
 	if (ro < 0)
@@ -439,6 +463,7 @@ common:
 	p2->agp_size = md->getLength();
 	p2->mem_changed = 0U;
 	link_texture_at_head(p2);
+	hash_agp_texture(p2);
 	*sys_obj_client_addr = p2->sys_obj_client_addr;
 #if 0
 	if (!m_provider->addTransferToGART(p2))
@@ -487,6 +512,8 @@ void CLASS::unlink_nonhead_texture(VMsvga2TextureBuffer* texture)
 HIDDEN
 void CLASS::unlink_texture(VMsvga2TextureBuffer* texture)
 {
+	if (texture->sys_obj_type == TEX_TYPE_AGP && !texture->mem_changed)
+		unhash_agp_texture(texture);
 	if (texture == m_texture_list) {
 		m_texture_list = texture->next;
 		if (m_texture_list)
@@ -495,6 +522,28 @@ void CLASS::unlink_texture(VMsvga2TextureBuffer* texture)
 		unlink_nonhead_texture(texture);
 }
 
+/*
+ * Note: only TEX_TYPE_AGP textures with mem_changed == 0 are hashed,
+ *   so there is at most one entry for any (address, size).
+ */
+HIDDEN
+void CLASS::hash_agp_texture(VMsvga2TextureBuffer* texture)
+{
+	agp_hash_insert(m_agp_hash, m_agp_hash_mask, texture);
+}
+
+HIDDEN
+void CLASS::unhash_agp_texture(VMsvga2TextureBuffer* texture)
+{
+	agp_hash_remove(m_agp_hash, m_agp_hash_mask, texture);
+}
+
+HIDDEN
+VMsvga2TextureBuffer* CLASS::find_agp_texture(mach_vm_address_t addr, vm_size_t size) const
+{
+	return agp_hash_find(m_agp_hash, m_agp_hash_mask, addr, size);
+}
+
 HIDDEN
 VMsvga2TextureBuffer* CLASS::common_texture_init(uint8_t object_type)
 {
@@ -713,6 +762,8 @@ VMsvga2TextureBuffer* CLASS::new_texture(uint32_t size0,
 		goto clean3;
 	}
 	p2->vram_bytes = size1;
+	if (obj_type == TEX_TYPE_VB)
+		p2->width = size0;	// Note: bytes of vertex data past the header
 	if (obj_type == TEX_TYPE_OOB) {
 		p2->linked_agp = p1;
 		__sync_fetch_and_add(&p1->sys_obj->refcount, 1);
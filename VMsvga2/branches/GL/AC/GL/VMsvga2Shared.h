@@ -54,6 +54,10 @@ private:
 	void* m_client_sys_objs_kernel_ptr;
 	IOLock* m_shared_lock;
 	int m_log_level;
+	uint32_t* m_free_handles;			// stack of free indices into m_handle_table
+	uint32_t m_num_free_handles;
+	VMsvga2TextureBuffer** m_agp_hash;	// TEX_TYPE_AGP textures by (address, size), see AGPHash.h
+	uint32_t m_agp_hash_mask;			// bucket count - 1, sized from m_num_handles
 
 	void Cleanup();
 	bool alloc_handles();
@@ -65,6 +69,9 @@ private:
 	void link_texture_at_head(VMsvga2TextureBuffer*);
 	void unlink_nonhead_texture(VMsvga2TextureBuffer*);
 	void unlink_texture(VMsvga2TextureBuffer*);
+	void hash_agp_texture(VMsvga2TextureBuffer*);
+	void unhash_agp_texture(VMsvga2TextureBuffer*);
+	VMsvga2TextureBuffer* find_agp_texture(mach_vm_address_t addr, vm_size_t size) const;
 	IOReturn alloc_client_shared(GLDSysObject**, mach_vm_address_t*);
 	void free_client_shared(GLDSysObject*);
 #if 0
@@ -49,6 +49,117 @@ bool isIdValid(uint32_t id)
 	return static_cast<int>(id) >= 0;
 }
 
+#pragma mark -
+#pragma mark Private Methods
+#pragma mark -
+
+HIDDEN
+IOReturn CLASS::create_segment(VMsvga2Accel* provider, VertexArraySegment* seg, size_t num_bytes)
+{
+	size_t alloc_bytes;
+	IOReturn rc;
+
+	bzero(seg, sizeof *seg);
+	seg->gmr_id = SVGA_ID_INVALID;
+	alloc_bytes = (num_bytes + PAGE_MASK) & -PAGE_SIZE;
+	if (alloc_bytes < VERTEX_ARRAY_SEGMENT_SIZE)
+		alloc_bytes = VERTEX_ARRAY_SEGMENT_SIZE;
+	seg->sid = provider->AllocSurfaceID();
+	rc = provider->createSurface(seg->sid,
+								 SVGA3dSurfaceFlags(SVGA3D_SURFACE_HINT_VERTEXBUFFER |
+													SVGA3D_SURFACE_HINT_DYNAMIC |
+													SVGA3D_SURFACE_HINT_WRITEONLY),
+								 SVGA3D_BUFFER,
+								 static_cast<uint32_t>(alloc_bytes),
+								 1U);
+	if (rc != kIOReturnSuccess) {
+		provider->FreeSurfaceID(seg->sid);
+		seg->sid = SVGA_ID_INVALID;
+		return rc;
+	}
+	seg->kernel_ptr = static_cast<uint8_t*>(provider->VRAMMalloc(alloc_bytes));
+	if (!seg->kernel_ptr) {
+		destroy_segment(provider, seg);
+		return kIOReturnNoMemory;
+	}
+	seg->size_bytes = alloc_bytes;
+	seg->offset_in_gmr = provider->offsetInVRAM(seg->kernel_ptr);
+	seg->gmr_id = GMR_VRAM();
+	return kIOReturnSuccess;
+}
+
+HIDDEN
+void CLASS::destroy_segment(VMsvga2Accel* provider, VertexArraySegment* seg)
+{
+	if (seg->fence) {
+		provider->SyncToFence(seg->fence);
+		seg->fence = 0U;
+	}
+	seg->gmr_id = SVGA_ID_INVALID;
+	if (seg->kernel_ptr) {
+		provider->VRAMFree(seg->kernel_ptr);
+		seg->kernel_ptr = 0;
+	}
+	seg->size_bytes = 0U;
+	seg->offset_in_gmr = 0U;
+	seg->next_avail = 0U;
+	if (isIdValid(seg->sid)) {
+		provider->destroySurface(seg->sid);
+		provider->FreeSurfaceID(seg->sid);
+		seg->sid = SVGA_ID_INVALID;
+	}
+}
+
+/*
+ * Note: returns false if the segment is still in use by the host
+ *   and wait is false.  Otherwise, rewinds the segment.
+ */
+HIDDEN
+bool CLASS::reclaim_segment(VMsvga2Accel* provider, VertexArraySegment* seg, bool wait)
+{
+	if (seg->fence) {
+		if (!provider->HasFencePassed(seg->fence)) {
+			if (!wait)
+				return false;
+			provider->SyncToFence(seg->fence);
+			++stats.num_stalls;
+		}
+		seg->fence = 0U;
+	}
+	seg->next_avail = 0U;
+	return true;
+}
+
+/*
+ * Note: Counts what the host hasn't consumed yet, recomputed rather
+ *   than tracked so the figure can't drift while the ring sits idle.
+ */
+HIDDEN
+void CLASS::update_in_flight(VMsvga2Accel* provider)
+{
+	size_t i;
+	uint64_t bytes = 0U;
+
+	for (i = 0U; i != num_segs; ++i)
+		if (segs[i].fence && !provider->HasFencePassed(segs[i].fence))
+			bytes += segs[i].next_avail;
+	stats.bytes_in_flight = bytes;
+	if (bytes > stats.max_bytes_in_flight)
+		stats.max_bytes_in_flight = bytes;
+}
+
+HIDDEN
+VertexArraySegment* CLASS::find_segment(uint8_t const* ptr)
+{
+	size_t i;
+
+	for (i = 0U; i != num_segs; ++i)
+		if (ptr >= segs[i].kernel_ptr &&
+			ptr < segs[i].kernel_ptr + segs[i].next_avail)
+			return &segs[i];
+	return 0;
+}
+
 #pragma mark -
 #pragma mark Public Methods
 #pragma mark -
@@ -56,81 +167,113 @@ bool isIdValid(uint32_t id)
 HIDDEN
 void CLASS::init(void)
 {
-	sid = SVGA_ID_INVALID;
-	gmr_id = SVGA_ID_INVALID;
+	size_t i;
+
+	for (i = 0U; i != VERTEX_ARRAY_MAX_SEGMENTS; ++i) {
+		segs[i].sid = SVGA_ID_INVALID;
+		segs[i].gmr_id = SVGA_ID_INVALID;
+	}
+	num_segs = 0U;
+	cur_seg = 0U;
+	bzero(&stats, sizeof stats);
 }
 
 HIDDEN
 void CLASS::purge(VMsvga2Accel* provider)
 {
+	size_t i;
+
 	if (!provider)
 		return;
-	if (fence) {
-		provider->SyncToFence(fence);
-		fence = 0U;
-	}
-	gmr_id = SVGA_ID_INVALID;
-	if (kernel_ptr) {
-		provider->VRAMFree(kernel_ptr);
-		kernel_ptr = 0;
-		size_bytes = 0U;
-		offset_in_gmr = 0U;
-		next_avail = 0U;
-	}
-	if (isIdValid(sid)) {
-		provider->destroySurface(sid);
-		provider->FreeSurfaceID(sid);
-		sid = SVGA_ID_INVALID;
-	}
+	for (i = 0U; i != num_segs; ++i)
+		destroy_segment(provider, &segs[i]);
+	num_segs = 0U;
+	cur_seg = 0U;
+	stats.num_segments = 0U;
 }
 
 HIDDEN
 IOReturn CLASS::alloc(VMsvga2Accel* provider, size_t num_bytes, uint8_t** ptr)
 {
-	size_t alloc_bytes;
+	VertexArraySegment* seg;
+	size_t next;
 	IOReturn rc;
 
 	if (!provider)
 		return kIOReturnNotReady;
 	num_bytes = (num_bytes + sizeof(uint32_t) - 1U) & -sizeof(uint32_t);
-	if (kernel_ptr) {
-		if (next_avail + num_bytes <= size_bytes)
-			goto done;
-		if (num_bytes <= size_bytes) {
-			if (fence) {
-				provider->SyncToFence(fence);
-				fence = 0U;
-			}
-			next_avail = 0U;
+	if (!num_segs) {
+		rc = create_segment(provider, &segs[0], num_bytes);
+		if (rc != kIOReturnSuccess)
+			return rc;
+		num_segs = 1U;
+		cur_seg = 0U;
+		goto done;
+	}
+	seg = &segs[cur_seg];
+	if (seg->next_avail + num_bytes <= seg->size_bytes)
+		goto done;
+	next = cur_seg + 1U;
+	if (next == num_segs)
+		next = 0U;
+	/*
+	 * Note: never rewind the current segment, it may hold
+	 *   allocations that haven't been uploaded yet.
+	 */
+	if (next != cur_seg &&
+		num_bytes <= segs[next].size_bytes &&
+		reclaim_segment(provider, &segs[next], false)) {
+		cur_seg = next;
+		goto done;
+	}
+	if (num_segs < VERTEX_ARRAY_MAX_SEGMENTS) {
+		/*
+		 * Grow the ring by inserting a new segment right after
+		 *   the current one, so the segments following it
+		 *   remain in order of submission.
+		 */
+		next = cur_seg + 1U;
+		memmove(&segs[next + 1U], &segs[next], (num_segs - next) * sizeof segs[0]);
+		rc = create_segment(provider, &segs[next], num_bytes);
+		if (rc == kIOReturnSuccess) {
+			++num_segs;
+			cur_seg = next;
 			goto done;
 		}
-		purge(provider);
+		memmove(&segs[next], &segs[next + 1U], (num_segs - next) * sizeof segs[0]);
+		if (next == num_segs)
+			next = 0U;
 	}
-	alloc_bytes = (num_bytes + PAGE_MASK) & -PAGE_SIZE;
-	sid = provider->AllocSurfaceID();
-	rc = provider->createSurface(sid,
-								 SVGA3dSurfaceFlags(SVGA3D_SURFACE_HINT_VERTEXBUFFER |
-													SVGA3D_SURFACE_HINT_DYNAMIC |
-													SVGA3D_SURFACE_HINT_WRITEONLY),
-								 SVGA3D_BUFFER,
-								 static_cast<uint32_t>(alloc_bytes),
-								 1U);
+	if (next == cur_seg)
+		return kIOReturnNoMemory;
+	/*
+	 * Ring is at its limit, must wait for the oldest segment
+	 */
+	if (num_bytes <= segs[next].size_bytes) {
+		reclaim_segment(provider, &segs[next], true);
+		cur_seg = next;
+		goto done;
+	}
+	if (segs[next].fence && !provider->HasFencePassed(segs[next].fence))
+		++stats.num_stalls;
+	destroy_segment(provider, &segs[next]);
+	rc = create_segment(provider, &segs[next], num_bytes);
 	if (rc != kIOReturnSuccess) {
-		provider->FreeSurfaceID(sid);
-		sid = SVGA_ID_INVALID;
+		--num_segs;
+		memmove(&segs[next], &segs[next + 1U], (num_segs - next) * sizeof segs[0]);
+		if (cur_seg > next)
+			--cur_seg;
+		else if (cur_seg == num_segs)
+			cur_seg = 0U;
+		stats.num_segments = static_cast<uint32_t>(num_segs);
 		return rc;
 	}
-	kernel_ptr = static_cast<uint8_t*>(provider->VRAMMalloc(alloc_bytes));
-	if (!kernel_ptr) {
-		purge(provider);
-		return kIOReturnNoMemory;
-	}
-	size_bytes = alloc_bytes;
-	offset_in_gmr = provider->offsetInVRAM(kernel_ptr);
-	gmr_id = GMR_VRAM();
+	cur_seg = next;
 done:
-	*ptr = kernel_ptr + next_avail;
-	next_avail += num_bytes;
+	seg = &segs[cur_seg];
+	*ptr = seg->kernel_ptr + seg->next_avail;
+	seg->next_avail += num_bytes;
+	stats.num_segments = static_cast<uint32_t>(num_segs);
 	return kIOReturnSuccess;
 }
 
@@ -140,17 +283,22 @@ IOReturn CLASS::upload(VMsvga2Accel* provider, uint8_t const* ptr, size_t num_by
 	SVGA3dSurfaceImageId hostImage;
 	SVGA3dCopyBox copyBox;
 	VMsvga2Accel::ExtraInfoEx extra;
+	VertexArraySegment* seg;
 	size_t additional_offset;
+	IOReturn rc;
 
 	if (!provider)
 		return kIOReturnNotReady;
-	if (ptr < kernel_ptr)
-		return kIOReturnUnderrun;
-	additional_offset = ptr - kernel_ptr;
-	if (additional_offset + num_bytes > size_bytes)
+	if (!num_segs)
+		return kIOReturnNotReady;
+	seg = find_segment(ptr);
+	if (!seg)
+		return kIOReturnBadArgument;
+	additional_offset = ptr - seg->kernel_ptr;
+	if (additional_offset + num_bytes > seg->next_avail)
 		return kIOReturnOverrun;
-	extra.mem_gmr_id = gmr_id;
-	extra.mem_offset_in_gmr = offset_in_gmr + additional_offset;
+	extra.mem_gmr_id = seg->gmr_id;
+	extra.mem_offset_in_gmr = seg->offset_in_gmr + additional_offset;
 	extra.mem_pitch = 0U;
 	extra.mem_limit = num_bytes;
 	extra.suffix_flags = 3U;
@@ -158,14 +306,24 @@ IOReturn CLASS::upload(VMsvga2Accel* provider, uint8_t const* ptr, size_t num_by
 	copyBox.w = static_cast<uint32_t>(num_bytes);
 	copyBox.h = 1U;
 	copyBox.d = 1U;
-	hostImage.sid = sid;
+	hostImage.sid = seg->sid;
 	if (_sid)
-		*_sid = sid;
+		*_sid = seg->sid;
 	hostImage.face = 0U;
 	hostImage.mipmap = 0U;
-	return provider->surfaceDMA3DEx(&hostImage,
-									SVGA3D_WRITE_HOST_VRAM,
-									&copyBox,
-									&extra,
-									&fence);
+	rc = provider->surfaceDMA3DEx(&hostImage,
+								  SVGA3D_WRITE_HOST_VRAM,
+								  &copyBox,
+								  &extra,
+								  &seg->fence);
+	update_in_flight(provider);
+	return rc;
+}
+
+HIDDEN
+VertexArrayStats const* CLASS::getStats(VMsvga2Accel* provider)
+{
+	if (provider)
+		update_in_flight(provider);
+	return &stats;
 }
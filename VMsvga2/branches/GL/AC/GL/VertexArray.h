@@ -29,7 +29,10 @@
 #ifndef __VERTEXARRAY_H__
 #define __VERTEXARRAY_H__
 
-class VertexArray
+#define VERTEX_ARRAY_SEGMENT_SIZE 0x10000U
+#define VERTEX_ARRAY_MAX_SEGMENTS 8U
+
+struct VertexArraySegment
 {
 	uint8_t* kernel_ptr;
 	size_t size_bytes;
@@ -38,12 +41,41 @@ class VertexArray
 	uint32_t sid;
 	uint32_t gmr_id;
 	uint32_t fence;
+};
+
+struct VertexArrayStats
+{
+	uint64_t num_stalls;
+	uint64_t bytes_in_flight;
+	uint64_t max_bytes_in_flight;
+	uint32_t num_segments;
+};
+
+/*
+ * A ring of VRAM segments, each with its own fence.
+ *   Allocation moves on to the next segment once the
+ *   current one fills up, and only waits on that
+ *   segment's fence if the ring can't grow any more.
+ */
+class VertexArray
+{
+	VertexArraySegment segs[VERTEX_ARRAY_MAX_SEGMENTS];
+	size_t num_segs;
+	size_t cur_seg;
+	VertexArrayStats stats;
+
+	IOReturn create_segment(class VMsvga2Accel* provider, VertexArraySegment* seg, size_t num_bytes);
+	void destroy_segment(class VMsvga2Accel* provider, VertexArraySegment* seg);
+	bool reclaim_segment(class VMsvga2Accel* provider, VertexArraySegment* seg, bool wait);
+	void update_in_flight(class VMsvga2Accel* provider);
+	VertexArraySegment* find_segment(uint8_t const* ptr);
 
 public:
 	void init(void);
 	void purge(class VMsvga2Accel* provider);
 	IOReturn alloc(class VMsvga2Accel* provider, size_t num_bytes, uint8_t** ptr);
 	IOReturn upload(class VMsvga2Accel* provider, uint8_t const* ptr, size_t num_bytes, uint32_t* sid);
+	VertexArrayStats const* getStats(class VMsvga2Accel* provider);
 };
 
 #endif /* __VERTEXARRAY_H__ */
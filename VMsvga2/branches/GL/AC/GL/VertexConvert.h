@@ -0,0 +1,98 @@
+/*
+ *  VertexConvert.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on January 24th 2011.
+ *  Copyright 2011 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __VERTEXCONVERT_H__
+#define __VERTEXCONVERT_H__
+
+#define MAX_NUM_DECLS 12U
+
+#define VCONV_TEXCOORD 0U
+#define VCONV_FLATSHADE 1U
+
+/*
+ * One step of the per-vertex conversion pass, built from the vertex decls
+ */
+struct VertexConvertOp
+{
+	uint8_t kind;		// VCONV_*
+	uint32_t offset;	// in bytes, from start of vertex
+	union {
+		float const* scale;	// VCONV_TEXCOORD: 1/width, 1/height
+		uint32_t color;		// VCONV_FLATSHADE: provoking vertex color
+	};
+};
+
+/*
+ * Note: Applies all conversion ops to each vertex in a single pass.
+ *   Texcoords get (t + 0.5) * scale on X & Y (unnormalized -> normalized),
+ *   flatshaded colors get the color of the first (provoking) vertex.
+ *   The ops are split by kind first, so the per-vertex loops have no
+ *   switch.  An SSE version of the texcoord step measured slower than
+ *   this, the 8 byte load/store pairs don't pay for themselves.
+ */
+static inline
+void convert_vertices(uint8_t* vertex_array,
+					  size_t num_vertices,
+					  size_t stride,
+					  VertexConvertOp* ops,
+					  size_t num_ops)
+{
+	uint32_t tc_offsets[MAX_NUM_DECLS], fs_offsets[MAX_NUM_DECLS], fs_colors[MAX_NUM_DECLS];
+	float tc_scales[MAX_NUM_DECLS][2];
+	size_t i, j, num_tc, num_fs;
+	float* q;
+
+	num_tc = 0U;
+	num_fs = 0U;
+	for (i = 0U; i != num_ops; ++i)
+		switch (ops[i].kind) {
+			case VCONV_TEXCOORD:
+				tc_offsets[num_tc] = ops[i].offset;
+				tc_scales[num_tc][0] = ops[i].scale[0];
+				tc_scales[num_tc][1] = ops[i].scale[1];
+				++num_tc;
+				break;
+			case VCONV_FLATSHADE:
+				ops[i].color = *reinterpret_cast<uint32_t const*>(vertex_array + ops[i].offset);
+				fs_offsets[num_fs] = ops[i].offset;
+				fs_colors[num_fs] = ops[i].color;
+				++num_fs;
+				break;
+		}
+	for (j = 0U; j != num_vertices; ++j, vertex_array += stride) {
+		for (i = 0U; i != num_tc; ++i) {
+			q = reinterpret_cast<float*>(vertex_array + tc_offsets[i]);
+			q[0] = (q[0] + 0.5F) * tc_scales[i][0];
+			q[1] = (q[1] + 0.5F) * tc_scales[i][1];
+		}
+		for (i = 0U; i != num_fs; ++i)
+			*reinterpret_cast<uint32_t*>(vertex_array + fs_offsets[i]) = fs_colors[i];
+	}
+}
+
+#endif /* __VERTEXCONVERT_H__ */
@@ -0,0 +1,123 @@
+/*
+ *  DMABatch.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on July 29th 2009.
+ *  Copyright 2009-2012 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __DMABATCH_H__
+#define __DMABATCH_H__
+
+#define DMA_BATCH_ENTRIES 16U
+
+/*
+ * SurfaceDMA entries for all the paged-off levels of a texture,
+ *   submitted together through surfaceDMA3DExBatch with one fence.
+ */
+struct DMABatch {
+	SVGA3dSurfaceImageId images[DMA_BATCH_ENTRIES];
+	SVGA3dCopyBox boxes[DMA_BATCH_ENTRIES];
+	VMsvga2Accel::ExtraInfoEx extras[DMA_BATCH_ENTRIES];
+	size_t count;
+};
+
+static inline
+IOReturn dma_batch_flush(VMsvga2Accel* provider, DMABatch* batch, uint32_t* fence)
+{
+	IOReturn rc;
+
+	if (!batch->count)
+		return kIOReturnSuccess;
+	rc = provider->surfaceDMA3DExBatch(&batch->images[0],
+									   SVGA3D_WRITE_HOST_VRAM,
+									   &batch->boxes[0],
+									   &batch->extras[0],
+									   batch->count,
+									   fence);
+	batch->count = 0U;
+	return rc;
+}
+
+static inline
+void dma_batch_push(DMABatch* batch,
+					SVGA3dSurfaceImageId const* hostImage,
+					SVGA3dCopyBox const* copyBox,
+					VMsvga2Accel::ExtraInfoEx const* extra)
+{
+	batch->images[batch->count] = *hostImage;
+	batch->boxes[batch->count] = *copyBox;
+	batch->extras[batch->count] = *extra;
+	++batch->count;
+}
+
+/*
+ * Note: Queues one level, flushing first if it might not fit.
+ *   gmr_limit is the size of a TEX_TYPE_OOB client range, 0 otherwise.
+ *
+ * This is a workaround for a bug in VMware backend.
+ *   It checks if offset_in_gmr + height * pitch <= gmr_end
+ *   and clips the entire transfer if so.  This is wrong.
+ *   The correct test is
+ *     offset_in_gmr + (height - 1) * pitch + width_bytes <= gmr_end
+ * The workaround only handles depth 1, it sends the last row
+ *   as a separate entry with pitch == width_bytes.
+ */
+static inline
+IOReturn dma_batch_add_level(VMsvga2Accel* provider,
+							 DMABatch* batch,
+							 SVGA3dSurfaceImageId const* hostImage,
+							 SVGA3dCopyBox const* copyBox,
+							 VMsvga2Accel::ExtraInfoEx const* extra,
+							 vm_size_t gmr_limit,
+							 vm_size_t width_bytes,
+							 uint32_t* fence)
+{
+	IOReturn rc;
+	SVGA3dCopyBox box;
+	VMsvga2Accel::ExtraInfoEx ext;
+
+	if (batch->count + 2U > DMA_BATCH_ENTRIES) {
+		rc = dma_batch_flush(provider, batch, fence);
+		if (rc != kIOReturnSuccess)
+			return rc;
+	}
+	if (!gmr_limit || copyBox->d != 1U ||
+		extra->mem_offset_in_gmr + copyBox->h * extra->mem_pitch <= gmr_limit) {
+		dma_batch_push(batch, hostImage, copyBox, extra);
+		return kIOReturnSuccess;
+	}
+	box = *copyBox;
+	ext = *extra;
+	--box.h;
+	dma_batch_push(batch, hostImage, &box, &ext);
+	ext.mem_offset_in_gmr += box.h * ext.mem_pitch;
+	ext.mem_pitch = width_bytes;
+	ext.suffix_flags = 2U;
+	box.y = box.h;
+	box.h = 1U;
+	dma_batch_push(batch, hostImage, &box, &ext);
+	return kIOReturnSuccess;
+}
+
+#endif /* __DMABATCH_H__ */
@@ -0,0 +1,87 @@
+/*
+ *  Fill32.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on July 29th 2009.
+ *  Copyright 2009-2012 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __FILL32_H__
+#define __FILL32_H__
+
+#ifdef VECTORIZE
+#include <emmintrin.h>
+#endif
+
+#define FILL_NT_THRESHOLD 0x40000U	// 256KB
+
+static inline
+void memset32(void* dest, uint32_t value, size_t size)
+{
+	__asm__ volatile ("cld; rep stosl" : "+c" (size), "+D" (dest) : "a" (value) : "memory");
+}
+
+#ifdef VECTORIZE
+static inline
+void memset128(void* dest, __v2di value, size_t size)
+{
+	__v2di* d = static_cast<__v2di*>(dest);
+	for (; size; --size, ++d)
+		__builtin_ia32_movntdq(d, value);
+}
+#endif /* VECTORIZE */
+
+/*
+ * Note: Fills size bytes at dest (4-byte aligned) with a 32-bit pattern.
+ *   The 16-byte aligned middle is done with SSE2 stores, non-temporal
+ *   above FILL_NT_THRESHOLD where the data would only pollute the cache.
+ */
+static inline
+void fill32(void* dest, uint32_t value, size_t size)
+{
+	uint8_t* d = static_cast<uint8_t*>(dest);
+#ifdef VECTORIZE
+	size_t head, body;
+	__v2di v = _mm_set1_epi32(static_cast<int>(value));
+	__v2di* q;
+
+	head = static_cast<size_t>(-reinterpret_cast<uintptr_t>(d) & 0xFU);
+	if (size >= head + sizeof v) {
+		memset32(d, value, head / sizeof(uint32_t));
+		d += head;
+		size -= head;
+		body = size / sizeof v;
+		if (size >= FILL_NT_THRESHOLD) {
+			memset128(d, v, body);
+			__builtin_ia32_sfence();
+		} else
+			for (q = reinterpret_cast<__v2di*>(d), head = body; head; --head, ++q)
+				*q = v;
+		d += body * sizeof v;
+		size -= body * sizeof v;
+	}
+#endif /* VECTORIZE */
+	memset32(d, value, size / sizeof(uint32_t));
+}
+
+#endif /* __FILL32_H__ */
@@ -0,0 +1,63 @@
+/*
+ *  SwapPacing.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on July 29th 2009.
+ *  Copyright 2009-2012 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __SWAPPACING_H__
+#define __SWAPPACING_H__
+
+/*
+ * Note: stamp is the fence of the command buffer holding the swap.
+ *   Waits on the swap N back, so at most N swaps are queued ahead of
+ *   the host, then for the vblank swap_interval past the previous
+ *   swap, or the next one if that has passed.  A late frame doesn't
+ *   let the following ones catch up in a burst.
+ */
+template<size_t N>
+static inline
+void pace_swap(VMsvga2Accel* provider,
+			   FenceTracker<N>* tracker,
+			   uint64_t* last_vbl,
+			   uint32_t swap_interval,
+			   uint32_t stamp)
+{
+	uint64_t now_vbl, target_vbl;
+
+	provider->SyncToFence(tracker->before());
+	tracker->after(stamp);
+	now_vbl = provider->currentVBlank();
+	if (!swap_interval) {
+		*last_vbl = now_vbl;
+		return;
+	}
+	target_vbl = *last_vbl + swap_interval;
+	if (target_vbl <= now_vbl)
+		target_vbl = now_vbl + 1U;
+	*last_vbl = target_vbl;
+	provider->sleepUntilVBlank(target_vbl);
+}
+
+#endif /* __SWAPPACING_H__ */
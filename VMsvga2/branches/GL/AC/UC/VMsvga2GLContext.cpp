@@ -158,6 +158,7 @@ void CLASS::Cleanup()
 		m_ipp->release();
 		m_ipp = 0;
 	}
+	CleanupStaging();
 	CleanupApp();
 	if (m_shared) {
 		m_shared->release();
@@ -173,6 +174,7 @@ void CLASS::Cleanup()
 		m_gc->release();
 		m_gc = 0;
 	}
+	VendorTransferBuffer::reap(m_provider, &m_retired_xfers, true);
 	m_command_buffer.xfer.complete(m_provider);
 	m_command_buffer.xfer.discard();
 	m_context_buffer0.xfer.discard();
@@ -318,7 +320,7 @@ IOReturn CLASS::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemory
 	void* fptr;
 	size_t d;
 	VendorCommandDescriptor result;
-	uint32_t pcbRet;
+	uint32_t pcbRet, stamp;
 
 #if LOGGING_LEVEL >= 3
 	GLLog(3, "%s(%u, options_out, memory_out)\n", __FUNCTION__, static_cast<unsigned>(type));
@@ -353,6 +355,7 @@ IOReturn CLASS::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemory
 			pcbRet = processCommandBuffer(&result);
 			if (m_stream_error) {
 				m_shared->unlockShared();
+				resolve_pending_fences();
 				*options = m_stream_error;
 				*memory = 0;
 				return kIOReturnBadArgument;
@@ -363,8 +366,12 @@ IOReturn CLASS::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemory
 					removeTextureFromStream(m_txs[d]);
 #endif
 			m_shared->unlockShared();
-			if (result.ds_count_dwords)
-				m_ipp->submit_buffer(result.next, result.ds_count_dwords);
+			if (result.ds_count_dwords) {
+				stamp = m_ipp->submit_buffer(result.next, result.ds_count_dwords);
+				if (stamp)
+					m_command_buffer.submit_stamp = stamp;
+			}
+			resolve_pending_fences();
 			if (pcbRet & 2U) {
 				if (m_fbo[0])
 					touchDrawFBO();
@@ -387,11 +394,9 @@ IOReturn CLASS::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemory
 			p->flags = pcbRet /* var_88 */;
 			p->downstream[-1] = 1;
 			p->downstream[0] = 1U << 24;	// terminating token
-			p->stamp = 0 /* this->0x7C */;
+			p->stamp = m_command_buffer.submit_stamp;
 			unlockAccel(m_provider);
-#if 0
-			sleepForSwapCompleteNoLock(var_84);
-#endif
+			sleepForSwapCompleteNoLock(pcbRet);
 			return kIOReturnSuccess;
 		case 1:
 			lockAccel(m_provider);
@@ -471,7 +476,7 @@ IOReturn CLASS::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemory
 			p->flags = 0;
 			p->downstream[-1] = 1;
 			p->downstream[0] = 1U << 24;// terminating token
-			p->stamp = 0;				// TBD: from this+0x7C
+			p->stamp = m_command_buffer.submit_stamp;
 			unlockAccel(m_provider);
 			return kIOReturnSuccess;
 	}
@@ -660,6 +665,15 @@ IOReturn CLASS::set_swap_interval(intptr_t c1, intptr_t c2)
 	this->0x9C.w = c1;
 	this->0x9C.h = c2;
 #endif
+	/*
+	 * Note: only 0 - 2 are honored, larger intervals are clamped
+	 */
+	if (c1 <= 0)
+		m_swap_interval = 0U;
+	else if (c1 > 2)
+		m_swap_interval = 2U;
+	else
+		m_swap_interval = static_cast<uint32_t>(c1);
 	return kIOReturnSuccess;
 }
 
@@ -869,9 +883,15 @@ IOReturn CLASS::read_buffer(struct sIOGLContextReadBufferData const* struct_in,
 HIDDEN
 IOReturn CLASS::finish()
 {
+	uint32_t stamp = m_command_buffer.submit_stamp;
+
 	GLLog(2, "%s()\n", __FUNCTION__);
-	if (m_provider)
-		return m_provider->SyncFIFO();
+	/*
+	 * Note: waits only for this context's last submission, rather
+	 *   than draining the FIFO for everyone.
+	 */
+	if (m_provider && stamp && !m_provider->HasFencePassed(stamp))
+		return m_provider->SyncToFence(stamp);
 	return kIOReturnSuccess;
 }
 
@@ -879,7 +899,8 @@ HIDDEN
 IOReturn CLASS::wait_for_stamp(uintptr_t stamp)
 {
 	GLLog(2, "%s(%lu)\n", __FUNCTION__, stamp);
-	if (stamp && m_provider)
+	if (stamp && m_provider &&
+		!m_provider->HasFencePassed(static_cast<uint32_t>(stamp)))
 		m_provider->SyncToFence(static_cast<uint32_t>(stamp));
 	return kIOReturnSuccess;
 }
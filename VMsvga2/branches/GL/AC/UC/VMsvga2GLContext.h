@@ -32,6 +32,10 @@
 
 #include <IOKit/IOUserClient.h>
 
+#define NUM_STAGING_BUCKETS 8U
+#define NUM_PENDING_FENCES 16U
+#define NUM_PRELOADED_TEXTURES 32U
+
 struct VendorCommandBufferHeader;
 struct VendorGLStreamInfo;
 struct VMsvga2TextureBuffer;
@@ -87,6 +91,30 @@ private:
 	 * Intel Pipeline processor
 	 */
 	class VMsvga2IPP* m_ipp;
+	/*
+	 * Texture upload GMRs awaiting their fence
+	 */
+	struct VendorTransferRetired* m_retired_xfers;
+	/*
+	 * Staging GMRs for TexSubImage2D, by power-of-two size
+	 */
+	struct VMsvga2StagingBuffer* m_staging_free[NUM_STAGING_BUCKETS];
+	struct VMsvga2StagingBuffer* m_staging_busy;
+	struct VMsvga2SubImageBatch* m_subimage_batch;
+	/*
+	 * SetFence slots awaiting their submit stamp
+	 */
+	uint32_t m_pending_fences[NUM_PENDING_FENCES];
+	uint32_t m_num_pending_fences;
+	/*
+	 * Vblanks per swap, from set_swap_interval
+	 */
+	uint32_t m_swap_interval;
+	/*
+	 * Textures uploaded and pinned ahead of processing the stream
+	 */
+	VMsvga2TextureBuffer* m_preloaded[NUM_PRELOADED_TEXTURES];
+	uint32_t m_num_preloaded;
 
 	/*
 	 * Private Methods
@@ -102,20 +130,31 @@ private:
 	 * Apple Pipeline processor
 	 */
 	void CleanupApp();
+	void preload_stream_textures();
+	bool is_preloaded(VMsvga2TextureBuffer*) const;
+	void release_preloaded();
 	uint32_t processCommandBuffer(struct VendorCommandDescriptor*);
 	void discardCommandBuffer();
 	static void removeTextureFromStream(VMsvga2TextureBuffer*);
 	static void addTextureToStream(VMsvga2TextureBuffer*);
 	void submit_midbuffer(VendorGLStreamInfo*);
+	void resolve_pending_fences();
+	void sleepForSwapCompleteNoLock(uint32_t flags);
 	void get_texture(VendorGLStreamInfo*, VMsvga2TextureBuffer*, bool);
 	static void dirtyTexture(VMsvga2TextureBuffer* tx, uint8_t face, uint8_t mipmap);
 	static void get_tex_data(VMsvga2TextureBuffer* tx, uint32_t* tex_gart_address, uint32_t* tex_pitch, int kind);
 	static void write_tex_data(uint32_t, uint32_t*, VMsvga2TextureBuffer*);
 	void touchDrawFBO(void);
 	IOReturn create_host_surface_for_texture(VMsvga2TextureBuffer*);
+	IOReturn upload_vertex_buffer(VMsvga2TextureBuffer*);
 	IOReturn alloc_and_load_texture(VMsvga2TextureBuffer*);
 	IOReturn tex_subimage_2d(VMsvga2TextureBuffer* tx,
 							 struct GLDTexSubImage2DStruc const* desc);
+	struct VMsvga2StagingBuffer* get_staging_buffer(size_t bytes);
+	void free_staging_buffer(struct VMsvga2StagingBuffer* sb);
+	void recycle_staging_buffers(bool wait);
+	IOReturn flush_subimage_batch();
+	void CleanupStaging();
 	void setup_drawbuffer_registers(uint32_t*);
 
 public:
@@ -27,6 +27,7 @@
  *  SOFTWARE.
  */
 
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOLib.h>
 #include <libkern/version.h>
 #define GL_INCL_SHARED
@@ -40,6 +41,7 @@
 #include "VMsvga2IPP.h"
 #include "VMsvga2Shared.h"
 #include "VMsvga2Surface.h"
+#include "DMABatch.h"
 
 #define CLASS VMsvga2GLContext
 
@@ -51,6 +53,10 @@
 
 #define HIDDEN __attribute__((visibility("hidden")))
 
+#define STAGING_MIN_SHIFT 16U	// 64KB
+#define STAGING_MAX_FREE 4U
+#define SUBIMAGE_BATCH_BOXES 16U
+
 #pragma mark -
 #pragma mark Struct Definitions
 #pragma mark -
@@ -94,6 +100,30 @@ struct SRC_COPY_BLIT_STRUC {
 	uint32_t src_addr;		// gart address
 };
 
+struct VMsvga2StagingBuffer
+{
+	VMsvga2StagingBuffer* next;
+	uint8_t* kernel_ptr;
+	size_t size;
+	uint32_t bucket;
+	VendorTransferBuffer xfer;	// GMR stays defined while pooled
+};
+
+/*
+ * TexSubImage2D rects for one host image, stacked at a common pitch
+ *   in a single staging buffer
+ */
+struct VMsvga2SubImageBatch
+{
+	VMsvga2TextureBuffer* tx;
+	VMsvga2StagingBuffer* sb;
+	SVGA3dSurfaceImageId hostImage;
+	uint32_t pitch;
+	uint32_t num_boxes;
+	size_t used;
+	SVGA3dCopyBox boxes[SUBIMAGE_BATCH_BOXES];
+};
+
 struct FBODescriptor
 {
 	uint16_t width;
@@ -456,6 +486,96 @@ void CLASS::CleanupApp()
 	m_shared->unlockShared();
 }
 
+/*
+ * Note: First pass over the stream, resolves and pins the textures
+ *   it binds and uploads them (and any vertex buffers) back to back,
+ *   so the second pass needn't break up the downstream for each one.
+ *   Stops at the first token that changes texture contents in-stream,
+ *   anything past it is loaded in stream order as before.
+ */
+HIDDEN
+void CLASS::preload_stream_textures()
+{
+	uint32_t *p, *q, *limit, cmd, upper, bit_mask, i;
+	dispatch_function_t f;
+	VMsvga2TextureBuffer* tx;
+
+	m_num_preloaded = 0U;
+	p = &m_command_buffer.kernel_ptr->downstream[-1];
+	limit = &m_command_buffer.kernel_ptr->data[0] +  m_command_buffer.size / sizeof(uint32_t);
+	do {
+		cmd = *p;
+		upper = cmd >> 24;
+		if (version_major >= 11 &&	// OS 10.7
+			upper >= 2U && upper < 32U)
+			++upper;
+		f = 0;
+		if (upper >= 32U && upper < 32U + dispatch_process_2_count)
+			f = dispatch_process_2[upper - 32U];
+		if (f == &CLASS::process_token_Texture) {
+			bit_mask = p[1];
+			q = &p[2];
+			for (i = 0U; i != 16U; ++i) {
+				if (!((bit_mask >> i) & 1U))
+					continue;
+				tx = m_shared->findTextureBuffer(*q);
+				if (tx && tx->sys_obj->in_use && !is_preloaded(tx) &&
+					m_num_preloaded != NUM_PRELOADED_TEXTURES) {
+					if (tx->surface_format == SVGA3D_FORMAT_INVALID)
+						tx->surface_format = decipher_format(bit_select(q[1], 7, 3), bit_select(q[1], 3, 4));
+					__sync_fetch_and_add(&tx->sys_obj->refcount, 1);
+					/*
+					 * Note: a failed upload is left for the second pass to retry
+					 */
+					if (alloc_and_load_texture(tx) == kIOReturnSuccess)
+						m_preloaded[m_num_preloaded++] = tx;
+					else if (__sync_fetch_and_add(&tx->sys_obj->refcount, -1) == 1)
+						m_shared->delete_texture(tx);
+				}
+				q += 3;
+			}
+		} else if (f == &CLASS::process_token_VertexBuffer) {
+			tx = m_shared->findTextureBuffer(p[1]);
+			if (tx)
+				upload_vertex_buffer(tx);
+		} else if (f == &CLASS::process_token_TexSubImage2D ||
+				   f == &CLASS::process_token_CopyPixelsDst ||
+				   f == &CLASS::process_token_CopyPixelsSrc ||
+				   f == &CLASS::process_token_CopyPixelsSrcFBO ||
+				   f == &CLASS::process_token_AsyncReadDrawBuffer)
+			break;
+		cmd &= 0xFFFFFFU;
+		p += cmd;
+		if (limit <= p)
+			break;
+	} while (cmd);
+}
+
+HIDDEN
+bool CLASS::is_preloaded(VMsvga2TextureBuffer* tx) const
+{
+	uint32_t i;
+
+	for (i = 0U; i != m_num_preloaded; ++i)
+		if (m_preloaded[i] == tx)
+			return true;
+	return false;
+}
+
+HIDDEN
+void CLASS::release_preloaded()
+{
+	uint32_t i;
+	VMsvga2TextureBuffer* tx;
+
+	for (i = 0U; i != m_num_preloaded; ++i) {
+		tx = m_preloaded[i];
+		if (__sync_fetch_and_add(&tx->sys_obj->refcount, -1) == 1)
+			m_shared->delete_texture(tx);
+	}
+	m_num_preloaded = 0U;
+}
+
 HIDDEN
 uint32_t CLASS::processCommandBuffer(VendorCommandDescriptor* result)
 {
@@ -471,6 +591,7 @@ uint32_t CLASS::processCommandBuffer(VendorCommandDescriptor* result)
 	cb_iter.f3 = 1U;
 	commands_processed = 0;
 	m_stream_error = 0;
+	preload_stream_textures();
 	do {
 		cb_iter.cmd = *cb_iter.p;
 		upper = cb_iter.cmd >> 24;
@@ -493,6 +614,8 @@ uint32_t CLASS::processCommandBuffer(VendorCommandDescriptor* result)
 		if (cb_iter.limit <= cb_iter.p)
 			break;
 	} while (cb_iter.cmd);
+	flush_subimage_batch();
+	release_preloaded();
 #if LOGGING_LEVEL >= 3
 	GLLog(3, "%s:   processed %d stream commands, error == %#x\n", __FUNCTION__, commands_processed, m_stream_error);
 #endif
@@ -594,10 +717,16 @@ void CLASS::addTextureToStream(VMsvga2TextureBuffer* tx)
 HIDDEN
 void CLASS::submit_midbuffer(VendorGLStreamInfo* info)
 {
+	uint32_t stamp;
 	uint32_t wc = static_cast<uint32_t>(info->ds_count_dwords);
 	if (!wc)
 		return;
 	if (wc > 2U) {
+		/*
+		 * Note: staged TexSubImage2D DMAs must reach the FIFO
+		 *   ahead of the draws that follow them in the stream.
+		 */
+		flush_subimage_batch();
 #if 0
 		m_provider->0x78C += (wc - 2U) * static_cast<uint32_t>(sizeof(uint32_t));
 		m_command_buffer.submit_stamp =
@@ -607,9 +736,10 @@ void CLASS::submit_midbuffer(VendorGLStreamInfo* info)
 								  __FILE__,
 								  __LINE__);
 #else
-		m_command_buffer.submit_stamp =
-		m_ipp->submit_buffer(&m_command_buffer.kernel_ptr->downstream[0] + info->dso_bytes / sizeof(uint32_t),
-							 wc - 2U);
+		stamp = m_ipp->submit_buffer(&m_command_buffer.kernel_ptr->downstream[0] + info->dso_bytes / sizeof(uint32_t),
+									 wc - 2U);
+		if (stamp)
+			m_command_buffer.submit_stamp = stamp;
 #endif
 	} 
 	info->dso_bytes += wc * static_cast<uint32_t>(sizeof(uint32_t));
@@ -617,13 +747,44 @@ void CLASS::submit_midbuffer(VendorGLStreamInfo* info)
 	info->f2 = 0U;
 }
 
+/*
+ * Note: SetFence slots are given the stamp of the submission
+ *   that covers them, once it's been handed to the FIFO.
+ */
+HIDDEN
+void CLASS::resolve_pending_fences()
+{
+	uint32_t i, fence_num;
+
+	for (i = 0U; i != m_num_pending_fences; ++i) {
+		fence_num = m_pending_fences[i];
+		if (fence_num * sizeof(GLDFence) >= m_fences_len)
+			continue;
+		m_fences_ptr[fence_num].u = m_command_buffer.submit_stamp;
+		m_fences_ptr[fence_num].v = 0U;
+	}
+	m_num_pending_fences = 0U;
+}
+
+/*
+ * Note: flags bit 0 is set by process_token_Swap.
+ *   Called without locks, as the pacing may block.
+ */
+HIDDEN
+void CLASS::sleepForSwapCompleteNoLock(uint32_t flags)
+{
+	if (!(flags & 1U) || !m_surface_client)
+		return;
+	m_surface_client->paceSwap(m_swap_interval, m_command_buffer.submit_stamp);
+}
+
 HIDDEN
 void CLASS::get_texture(VendorGLStreamInfo* info, VMsvga2TextureBuffer* tx, bool flag)
 {
 #if 0
 	VMsvga2TextureBuffer* ltx;
 #endif
-	if (tx->sys_obj->in_use) {
+	if (tx->sys_obj->in_use && !is_preloaded(tx)) {
 		submit_midbuffer(info);
 		alloc_and_load_texture(tx);
 #if 0
@@ -855,6 +1016,16 @@ IOReturn CLASS::create_host_surface_for_texture(VMsvga2TextureBuffer* tx)
 			m_provider->unlock3D();
 			mmap->release();
 			break;
+		case TEX_TYPE_VB:
+			rc = m_provider->createSurface(tx->surface_id,
+										   SVGA3dSurfaceFlags(SVGA3D_SURFACE_HINT_VERTEXBUFFER |
+															  SVGA3D_SURFACE_HINT_INDEXBUFFER),
+										   SVGA3D_BUFFER,
+										   tx->width,
+										   1U);
+			if (rc != kIOReturnSuccess)
+				goto clean1;
+			break;
 		default:
 			rc = kIOReturnUnsupported;
 			goto clean1;
@@ -867,6 +1038,63 @@ clean1:
 	return rc;
 }
 
+/*
+ * Note: Vertex data follows a 0x80 byte header in the kernel buffer.
+ *   The whole buffer goes up when the GLD has flagged it dirty, stamps[0]
+ *   tracks the DMA out of client memory so the GLD can wait before rewriting it.
+ */
+HIDDEN
+IOReturn CLASS::upload_vertex_buffer(VMsvga2TextureBuffer* tx)
+{
+	IOReturn rc;
+	bool created;
+	SVGA3dSurfaceImageId hostImage;
+	SVGA3dCopyBox copyBox;
+	VMsvga2Accel::ExtraInfoEx extra;
+
+	if (!tx->xfer.md || !tx->width)
+		return kIOReturnBadArgument;
+	created = !isIdValid(tx->surface_id);
+	rc = create_host_surface_for_texture(tx);
+	if (rc != kIOReturnSuccess)
+		return rc;
+	if (!created && !isPagedOff(tx->sys_obj, 0U, 0U))
+		return kIOReturnSuccess;
+	VendorTransferBuffer::reap(m_provider, &m_retired_xfers, false);
+	rc = tx->xfer.prepare(m_provider);
+	if (rc == kIOReturnNoResources && m_retired_xfers) {
+		VendorTransferBuffer::reap(m_provider, &m_retired_xfers, true);
+		rc = tx->xfer.prepare(m_provider);
+	}
+	if (rc != kIOReturnSuccess)
+		return rc;
+	bzero(&hostImage, sizeof hostImage);
+	bzero(&copyBox, sizeof copyBox);
+	bzero(&extra, sizeof extra);
+	hostImage.sid = tx->surface_id;
+	copyBox.w = tx->width;
+	copyBox.h = 1U;
+	copyBox.d = 1U;
+	extra.mem_gmr_id = tx->xfer.gmr_id;
+	extra.mem_offset_in_gmr = 0x80U;
+	extra.mem_limit = tx->width;
+	extra.suffix_flags = 3U;
+	rc = m_provider->surfaceDMA3DEx(&hostImage,
+									SVGA3D_WRITE_HOST_VRAM,
+									&copyBox,
+									&extra,
+									&tx->xfer.fence);
+	if (rc != kIOReturnSuccess) {
+		tx->xfer.complete(m_provider);
+		return rc;
+	}
+	tx->sys_obj->pageon[0] |= tx->sys_obj->pageoff[0];
+	tx->sys_obj->stamps[0] = static_cast<int32_t>(tx->xfer.fence);
+	tx->sys_obj->stamps[1] = static_cast<int32_t>(tx->xfer.fence);
+	tx->xfer.retire(m_provider, &m_retired_xfers);
+	return kIOReturnSuccess;
+}
+
 HIDDEN
 IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 {
@@ -876,6 +1104,7 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 	SVGA3dSurfaceImageId hostImage;
 	SVGA3dCopyBox copyBox;
 	VMsvga2Accel::ExtraInfoEx extra;
+	DMABatch batch;
 	IOAccelBounds rect;
 	VMsvga2TextureBuffer* ltx;
 	GLDTextureHeader *headers, *gld_th;
@@ -888,6 +1117,7 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 		GLLog(1, "%s: invalid surface format\n", __FUNCTION__);
 		return kIOReturnNotReady;
 	}
+	VendorTransferBuffer::reap(m_provider, &m_retired_xfers, false);
 	sys_obj_type = tx->sys_obj_type;
 	if (sys_obj_type == TEX_TYPE_SURFACE)
 		return kIOReturnSuccess;
@@ -941,6 +1171,8 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 			GLLog(1, "%s: tex type %u - Unsupported\n", __FUNCTION__, sys_obj_type);
 			return kIOReturnUnsupported;
 	}
+	if (m_subimage_batch && m_subimage_batch->tx == tx)
+		flush_subimage_batch();
 	rc = create_host_surface_for_texture(tx);
 	if (rc != kIOReturnSuccess) {
 		GLLog(1, "%s: create_host_surface_for_texture return %#x\n", __FUNCTION__, rc);
@@ -948,6 +1180,13 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 	}
 	hostImage.sid = tx->surface_id;
 	rc = ltx->xfer.prepare(m_provider);
+	if (rc == kIOReturnNoResources && m_retired_xfers) {
+		/*
+		 * Out of GMR IDs - wait for retired transfers and try again
+		 */
+		VendorTransferBuffer::reap(m_provider, &m_retired_xfers, true);
+		rc = ltx->xfer.prepare(m_provider);
+	}
 	if (rc != kIOReturnSuccess) {
 		GLLog(1, "%s: prepare_transfer_for_io return %#x\n", __FUNCTION__, rc);
 		goto clean1;
@@ -981,6 +1220,11 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 			break;
 		case TEX_TYPE_STD:
 		case TEX_TYPE_OOB:
+			/*
+			 * Note: All paged-off levels of all faces are queued and
+			 *   submitted together, with a single fence for the lot.
+			 */
+			batch.count = 0U;
 			for (hostImage.face = 0U;
 				 hostImage.face != tx->num_faces;
 				 ++hostImage.face, headers += 12) {
@@ -995,49 +1239,40 @@ IOReturn CLASS::alloc_and_load_texture(VMsvga2TextureBuffer* tx)
 					copyBox.d = gld_th->depth;
 					extra.mem_offset_in_gmr = gld_th->offset_in_client;
 					extra.mem_pitch = gld_th->pitch;
-					/*
-					 * Note: This is a workaround for a bug in VMware backend.
-					 *   It checks if offset_in_gmr + height * pitch <= gmr_end
-					 *   and clips the entire transfer if so.  This is wrong.
-					 *   The correct test is
-					 *     offset_in_gmr + (height - 1) * pitch + width_bytes <= gmr_end
-					 * The workaround only handles depth 1
-					 */
-					if (sys_obj_type == TEX_TYPE_OOB && copyBox.d == 1U &&
-						extra.mem_offset_in_gmr + copyBox.h * extra.mem_pitch > ltx->agp_size) {
-						--copyBox.h;
-						m_provider->surfaceDMA3DEx(&hostImage,
-												   SVGA3D_WRITE_HOST_VRAM,
-												   &copyBox,
-												   &extra);
-						extra.mem_offset_in_gmr += copyBox.h * extra.mem_pitch;
-						extra.mem_pitch = gld_th->width_bytes;
-						copyBox.y = copyBox.h;
-						copyBox.h = 1U;
-						extra.suffix_flags = 2U;
-						rc = m_provider->surfaceDMA3DEx(&hostImage,
-														SVGA3D_WRITE_HOST_VRAM,
-														&copyBox,
-														&extra,
-														&ltx->xfer.fence);
-						copyBox.y = 0U;
-						extra.suffix_flags = 3U;
-					} else
-						rc = m_provider->surfaceDMA3DEx(&hostImage,
-														SVGA3D_WRITE_HOST_VRAM,
-														&copyBox,
-														&extra,
-														&ltx->xfer.fence);
+					rc = dma_batch_add_level(m_provider,
+											 &batch,
+											 &hostImage,
+											 &copyBox,
+											 &extra,
+											 sys_obj_type == TEX_TYPE_OOB ? ltx->agp_size : 0U,
+											 gld_th->width_bytes,
+											 &ltx->xfer.fence);
 					if (rc != kIOReturnSuccess)
 						goto clean2;
 				}
 			}
+			rc = dma_batch_flush(m_provider, &batch, &ltx->xfer.fence);
+			if (rc != kIOReturnSuccess)
+				goto clean2;
 			mmap->release();
 			for (hostImage.face = 0U; hostImage.face != tx->num_faces; ++hostImage.face)
 				tx->sys_obj->pageon[hostImage.face] |= tx->sys_obj->pageoff[hostImage.face];
 			break;
 	}
-	ltx->xfer.complete(m_provider); // ugh... to get rid of this need set up a garbage-collection mechanism
+	/*
+	 * GMR is torn down once the fence passes, see reap.
+	 *   Note: the stamps keep the GLD from rewriting the client
+	 *   pages until the host has read them.
+	 */
+	if (ltx->xfer.fence) {
+		tx->sys_obj->stamps[0] = static_cast<int32_t>(ltx->xfer.fence);
+		tx->sys_obj->stamps[1] = static_cast<int32_t>(ltx->xfer.fence);
+		if (ltx != tx) {
+			ltx->sys_obj->stamps[0] = static_cast<int32_t>(ltx->xfer.fence);
+			ltx->sys_obj->stamps[1] = static_cast<int32_t>(ltx->xfer.fence);
+		}
+	}
+	ltx->xfer.retire(m_provider, &m_retired_xfers);
 	return kIOReturnSuccess;
 
 clean2:
@@ -1056,6 +1291,10 @@ IOReturn CLASS::tex_subimage_2d(VMsvga2TextureBuffer* tx,
 	SVGA3dCopyBox copyBox;
 	SVGA3dSurfaceImageId hostImage;
 	VMsvga2Accel::ExtraInfoEx extra;
+	VMsvga2SubImageBatch* b;
+	uint8_t const* src;
+	uint8_t* dst;
+	uint32_t row_bytes, pitch, i;
 
 	if (!tx || !desc || !tx->bytespp)
 		return kIOReturnBadArgument;
@@ -1069,11 +1308,6 @@ IOReturn CLASS::tex_subimage_2d(VMsvga2TextureBuffer* tx,
 	if (tx->sys_obj_type == TEX_TYPE_SURFACE)
 		GLLog(1, "%s: called for surface texture\n", __FUNCTION__);
 #endif
-	bzero(&extra, sizeof extra);
-	extra.mem_offset_in_gmr = desc->source_addr;
-	extra.mem_pitch = desc->source_pitch;
-	extra.mem_limit = 0xFFFFFFFFU;
-	extra.suffix_flags = 2U;
 	bzero(&copyBox, sizeof copyBox);
 	copyBox.w = desc->width / tx->bytespp;
 	copyBox.h = desc->height;
@@ -1089,6 +1323,63 @@ IOReturn CLASS::tex_subimage_2d(VMsvga2TextureBuffer* tx,
 		return rc;
 	}
 	hostImage.sid = tx->surface_id;
+	row_bytes = desc->width;
+	if (!row_bytes || !copyBox.h)
+		return kIOReturnSuccess;
+	if (desc->source_addr + static_cast<size_t>(copyBox.h - 1U) * desc->source_pitch + row_bytes > m_command_buffer.size)
+		return kIOReturnBadArgument;
+	/*
+	 * Stage the rect out of the command buffer, so the command buffer
+	 *   needs no GMR and can be handed back without waiting for the DMA.
+	 *   Rects for the same host image are merged into a single DMA.
+	 */
+	b = m_subimage_batch;
+	if (!b) {
+		b = static_cast<VMsvga2SubImageBatch*>(IOMalloc(sizeof *b));
+		if (b) {
+			bzero(b, sizeof *b);
+			m_subimage_batch = b;
+		}
+	}
+	if (b && b->sb &&
+		(b->tx != tx ||
+		 b->hostImage.sid != hostImage.sid ||
+		 b->hostImage.face != hostImage.face ||
+		 b->hostImage.mipmap != hostImage.mipmap ||
+		 row_bytes > b->pitch ||
+		 b->used + static_cast<size_t>(copyBox.h) * b->pitch > b->sb->size ||
+		 b->num_boxes == SUBIMAGE_BATCH_BOXES))
+		flush_subimage_batch();
+	if (b && !b->sb) {
+		pitch = (row_bytes + 3U) & ~3U;
+		b->sb = get_staging_buffer(static_cast<size_t>(copyBox.h) * pitch);
+		if (b->sb) {
+			b->tx = tx;
+			__sync_fetch_and_add(&tx->sys_obj->refcount, 1);
+			b->hostImage = hostImage;
+			b->pitch = pitch;
+			b->num_boxes = 0U;
+			b->used = 0U;
+		}
+	}
+	if (b && b->sb) {
+		src = reinterpret_cast<uint8_t const*>(m_command_buffer.kernel_ptr) + desc->source_addr;
+		dst = b->sb->kernel_ptr + b->used;
+		for (i = 0U; i != copyBox.h; ++i, src += desc->source_pitch, dst += b->pitch)
+			memcpy(dst, src, row_bytes);
+		copyBox.srcy = static_cast<uint32_t>(b->used / b->pitch);
+		b->boxes[b->num_boxes++] = copyBox;
+		b->used += static_cast<size_t>(copyBox.h) * b->pitch;
+		return kIOReturnSuccess;
+	}
+	/*
+	 * No staging buffer - DMA straight from the command buffer
+	 */
+	bzero(&extra, sizeof extra);
+	extra.mem_offset_in_gmr = desc->source_addr;
+	extra.mem_pitch = desc->source_pitch;
+	extra.mem_limit = 0xFFFFFFFFU;
+	extra.suffix_flags = 2U;
 	rc = m_command_buffer.xfer.prepare(m_provider);
 	if (rc != kIOReturnSuccess) {
 		GLLog(1, "%s: prepare_transfer_for_io return %#x\n", __FUNCTION__, rc);
@@ -1102,6 +1393,149 @@ IOReturn CLASS::tex_subimage_2d(VMsvga2TextureBuffer* tx,
 									  &m_command_buffer.xfer.fence);
 }
 
+HIDDEN
+IOReturn CLASS::flush_subimage_batch()
+{
+	IOReturn rc;
+	VMsvga2SubImageBatch* b = m_subimage_batch;
+	VMsvga2StagingBuffer* sb;
+	VMsvga2Accel::ExtraInfoEx extra;
+
+	if (!b || !b->sb)
+		return kIOReturnSuccess;
+	sb = b->sb;
+	bzero(&extra, sizeof extra);
+	extra.mem_gmr_id = sb->xfer.gmr_id;
+	extra.mem_pitch = b->pitch;
+	extra.mem_limit = b->used;
+	extra.suffix_flags = 2U;
+	rc = m_provider->surfaceDMA3DExBoxes(&b->hostImage,
+										 SVGA3D_WRITE_HOST_VRAM,
+										 &b->boxes[0],
+										 b->num_boxes,
+										 &extra,
+										 &sb->xfer.fence);
+	sb->next = m_staging_busy;
+	m_staging_busy = sb;
+	b->sb = 0;
+	b->num_boxes = 0U;
+	b->used = 0U;
+	if (__sync_fetch_and_add(&b->tx->sys_obj->refcount, -1) == 1)
+		m_shared->delete_texture(b->tx);
+	b->tx = 0;
+	return rc;
+}
+
+HIDDEN
+VMsvga2StagingBuffer* CLASS::get_staging_buffer(size_t bytes)
+{
+	VMsvga2StagingBuffer* sb;
+	IOBufferMemoryDescriptor* bmd;
+	uint32_t bucket;
+
+	for (bucket = 0U; bucket != NUM_STAGING_BUCKETS; ++bucket)
+		if (bytes <= (static_cast<size_t>(1U) << (STAGING_MIN_SHIFT + bucket)))
+			break;
+	if (bucket == NUM_STAGING_BUCKETS)
+		return 0;
+	if (!m_staging_free[bucket])
+		recycle_staging_buffers(false);
+	sb = m_staging_free[bucket];
+	if (sb) {
+		m_staging_free[bucket] = sb->next;
+		sb->next = 0;
+		return sb;
+	}
+	sb = static_cast<VMsvga2StagingBuffer*>(IOMalloc(sizeof *sb));
+	if (!sb)
+		return 0;
+	bzero(sb, sizeof *sb);
+	sb->xfer.init();
+	sb->bucket = bucket;
+	sb->size = static_cast<size_t>(1U) << (STAGING_MIN_SHIFT + bucket);
+	bmd = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task,
+													  kIOMemoryPageable |
+													  kIODirectionInOut,
+													  sb->size,
+													  page_size);
+	sb->xfer.md = bmd;
+	if (!bmd)
+		goto clean1;
+	sb->kernel_ptr = static_cast<uint8_t*>(bmd->getBytesNoCopy());
+	if (sb->xfer.prepare(m_provider) != kIOReturnSuccess)
+		goto clean1;
+	return sb;
+
+clean1:
+	sb->xfer.discard();
+	IOFree(sb, sizeof *sb);
+	return 0;
+}
+
+HIDDEN
+void CLASS::free_staging_buffer(VMsvga2StagingBuffer* sb)
+{
+	sb->xfer.complete(m_provider);
+	sb->xfer.discard();
+	IOFree(sb, sizeof *sb);
+}
+
+/*
+ * Note: Moves staging buffers whose DMA is done back to their free list,
+ *   keeping at most STAGING_MAX_FREE per bucket.
+ */
+HIDDEN
+void CLASS::recycle_staging_buffers(bool wait)
+{
+	VMsvga2StagingBuffer *sb, **link, *p;
+	uint32_t n;
+
+	link = &m_staging_busy;
+	while ((sb = *link) != 0) {
+		if (sb->xfer.fence) {
+			if (wait)
+				sb->xfer.sync(m_provider);
+			else if (!m_provider->HasFencePassed(sb->xfer.fence)) {
+				link = &sb->next;
+				continue;
+			}
+			sb->xfer.fence = 0U;
+		}
+		*link = sb->next;
+		for (n = 0U, p = m_staging_free[sb->bucket]; p && n != STAGING_MAX_FREE; p = p->next)
+			++n;
+		if (n == STAGING_MAX_FREE) {
+			free_staging_buffer(sb);
+			continue;
+		}
+		sb->next = m_staging_free[sb->bucket];
+		m_staging_free[sb->bucket] = sb;
+	}
+}
+
+HIDDEN
+void CLASS::CleanupStaging()
+{
+	VMsvga2StagingBuffer* sb;
+	uint32_t bucket;
+
+	if (m_subimage_batch) {
+		if (m_shared)
+			m_shared->lockShared();
+		flush_subimage_batch();
+		if (m_shared)
+			m_shared->unlockShared();
+		IOFree(m_subimage_batch, sizeof *m_subimage_batch);
+		m_subimage_batch = 0;
+	}
+	recycle_staging_buffers(true);
+	for (bucket = 0U; bucket != NUM_STAGING_BUCKETS; ++bucket)
+		while ((sb = m_staging_free[bucket]) != 0) {
+			m_staging_free[bucket] = sb->next;
+			free_staging_buffer(sb);
+		}
+}
+
 HIDDEN
 void CLASS::setup_drawbuffer_registers(uint32_t* p)
 {
@@ -1787,8 +2221,8 @@ HIDDEN
 void CLASS::process_token_VertexBuffer(VendorGLStreamInfo* info)
 {
 	VMsvga2TextureBuffer* tx;
+	IOReturn rc;
 
-	GLLog(1, "%s() Unsupported\n", __FUNCTION__);
 	tx = m_shared->findTextureBuffer(info->p[1]);
 	if (!tx) {
 		info->cmd = 0U;
@@ -1800,28 +2234,20 @@ void CLASS::process_token_VertexBuffer(VendorGLStreamInfo* info)
 		return;
 	}
 	if (tx != m_txs[16]) {
-		if (m_txs[16]) {
-			m_txs[16]->sys_obj->stamps[0] = 0U /* m_provider->0x50 */;
+		if (m_txs[16])
 			--m_txs[16]->xfer.counter14;
-		}
 		++tx->xfer.counter14;
 		m_txs[16] = tx;
 	}
-	if (!m_txs[16]->xfer.gart_ptr) {
-		submit_midbuffer(info);
-#if 0
-		mapTransferToGART(&tx.xfer);
-		if (!m_command_buffer.xfer.gart_ptr)
-			mapTransferToGART(&m_command_buffer.xfer);
-#endif
-	}
-#if 0
-	info->p[0] = 0x4CU; // TBD... strange doesn't look like an opcode, maybe middle of an Intel CMD
-	info->p[1] = tx->xfer.gart_ptr + 128U;	// Looks like this is a gart_ptr for a TEX_TYPE_VB texture with offset 0x80
-#else
-	info->p[0] = 0U;
-	info->p[1] = 0U;
-#endif
+	rc = upload_vertex_buffer(tx);
+	if (rc != kIOReturnSuccess)
+		GLLog(1, "%s: upload_vertex_buffer return %#x\n", __FUNCTION__, rc);
+	/*
+	 * Note: Original emits S0 with the GART address of the vertex data (offset 0x80).
+	 *   The IPP takes the sid of the host vertex buffer in its place.
+	 */
+	info->p[0] = 0x7D040010U;	/* _3DSTATE_LOAD_STATE_IMMEDIATE_1, S0 */
+	info->p[1] = (rc == kIOReturnSuccess ? tx->surface_id : SVGA_ID_INVALID);
 }
 
 /*
@@ -1830,17 +2256,12 @@ void CLASS::process_token_VertexBuffer(VendorGLStreamInfo* info)
 HIDDEN
 void CLASS::process_token_NoVertexBuffer(VendorGLStreamInfo* info)
 {
-	GLLog(1, "%s() Unsupported\n", __FUNCTION__);
 	if (m_txs[16]) {
-		m_txs[16]->sys_obj->stamps[0] = 0U /* m_provider->0x50 */;
 		--m_txs[16]->xfer.counter14;
 		m_txs[16] = 0;
 	}
-#if 0
-	info->p[0] = 0x4CU;	// TBD... and again
-#else
-	info->p[0] = 0U;
-#endif
+	info->p[0] = 0x7D040010U;	/* _3DSTATE_LOAD_STATE_IMMEDIATE_1, S0 */
+	info->p[1] = SVGA_ID_INVALID;
 }
 
 HIDDEN
@@ -1895,10 +2316,17 @@ void CLASS::process_token_SetFence(VendorGLStreamInfo* info)
 		m_stream_error = 2;
 		return;
 	}
-	info->p[0] = 0x02000000U;	// MI_FLUSH
-	info->p[1] = 0x10800001U;	// MI_STORE_DATA_INDEX
-	info->p[2] = 64U;
-	info->p[3] = fence_num /* m_provider->0x50 */;
+	/*
+	 * Note: Apple's code emits MI_FLUSH, MI_STORE_DATA_INDEX here for
+	 *   the fence.  Instead, the slot is resolved to the context's
+	 *   submit stamp once the buffer is in the FIFO.
+	 */
+	if (m_num_pending_fences == NUM_PENDING_FENCES) {
+		submit_midbuffer(info);
+		resolve_pending_fences();
+	}
+	m_pending_fences[m_num_pending_fences++] = fence_num;
+	bzero(&info->p[0], 4U * sizeof(uint32_t));
 #if 0
 	m_fences_ptr[fence_num].u = 0U /* m_provider->0x50++ */;
 	m_fences_ptr[fence_num].v = 0U;
@@ -1980,6 +2408,12 @@ void CLASS::process_token_TexSubImage2D(VendorGLStreamInfo* info)
 		m_shared->delete_texture(tx);
 }
 
+/*
+ * Note: CopyPixels is not done on the host.  It would map onto
+ *   SurfaceCopy/SurfaceStretchBlt, but the source rect layout in
+ *   CopyPixelsSrc(FBO) and its origin are not known from a captured
+ *   stream, so the tokens stay unsupported.
+ */
 HIDDEN
 void CLASS::process_token_CopyPixelsDst(VendorGLStreamInfo* info)
 {
@@ -2058,6 +2492,11 @@ void CLASS::process_token_DrawRect(VendorGLStreamInfo* info)
 	memcpy(&info->p[1], &m_drawrect[0], sizeof m_drawrect);
 }
 
+/*
+ * Note: Not implemented.  The token's fields past the texture id (rect,
+ *   offset, pitch, data type) haven't been confirmed against a captured
+ *   stream, and a wrong guess would DMA into the application's memory.
+ */
 HIDDEN
 void CLASS::process_token_AsyncReadDrawBuffer(VendorGLStreamInfo* info)
 {
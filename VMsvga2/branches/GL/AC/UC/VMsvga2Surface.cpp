@@ -29,12 +29,19 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/graphics/IOGraphicsInterfaceTypes.h>
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#ifdef VECTORIZE
+#include <emmintrin.h>
+#endif
 
 #include "vmw_options_ac.h"
 #include "VLog.h"
 #include "UCGLDCommonTypes.h"
+#include "UCMethods.h"
 #include "VMsvga2Accel.h"
 #include "VMsvga2Surface.h"
+#include "YUVConvert.h"
+#include "Fill32.h"
+#include "SwapPacing.h"
 
 #include "svga_apple_header.h"
 #include "svga_overlay.h"
@@ -117,21 +124,115 @@ size_t page_residue(uint64_t addr)
 	return static_cast<size_t>(addr & PAGE_MASK);
 }
 
-static inline
-void memset32(void* dest, uint32_t value, size_t size)
+/*
+ * Note: Converts a width x height UYVY/YUY2 image to X8R8G8B8 at 1:1 scale.
+ */
+static
+void yuv422_to_xrgb(void* dest, vm_size_t dest_pitch,
+					void const* src, vm_size_t src_pitch,
+					uint32_t width, uint32_t height,
+					bool uyvy)
 {
-	__asm__ volatile ("cld; rep stosl" : "+c" (size), "+D" (dest) : "a" (value) : "memory");
+	uint8_t* d = static_cast<uint8_t*>(dest);
+	uint8_t const* s = static_cast<uint8_t const*>(src);
+
+	for (; height; --height, d += dest_pitch, s += src_pitch)
+		yuv422_row_to_xrgb(reinterpret_cast<uint32_t*>(d), s, width, uyvy);
 }
 
-#ifdef VECTORIZE
+/*
+ * Note: Size in bytes of the line buffer needed by yuv422_to_xrgb_scaled
+ *   for a source of src_width pixels (two converted rows plus a blended one).
+ */
 static inline
-void memset128(void* dest, __v2di value, size_t size)
+vm_size_t yuv_scale_lines_size(uint32_t src_width)
 {
-	__v2di* d = static_cast<__v2di*>(dest);
-	for (; size; --size, ++d)
-		__builtin_ia32_movntdq(d, value);
+	return 3U * round_up_to_power2(src_width, 4U) * sizeof(uint32_t);
+}
+
+/*
+ * Note: Converts and bilinearly scales a src_width x src_height UYVY/YUY2 image
+ *   to dest_width x dest_height X8R8G8B8, sampling at pixel centers.
+ *   Each source row is converted at most once, and the vertical blend is
+ *   skipped on rows that fall exactly on a source row.
+ */
+static
+void yuv422_to_xrgb_scaled(void* dest, vm_size_t dest_pitch,
+						   uint32_t dest_width, uint32_t dest_height,
+						   void const* src, vm_size_t src_pitch,
+						   uint32_t src_width, uint32_t src_height,
+						   bool uyvy,
+						   uint32_t* lines)
+{
+	uint8_t* d = static_cast<uint8_t*>(dest);
+	uint8_t const* s = static_cast<uint8_t const*>(src);
+	uint32_t stride = round_up_to_power2(src_width, 4U);
+	uint32_t* row[2] = { lines, lines + stride };
+	uint32_t* blend = lines + 2U * stride;
+	uint32_t const* line;
+	uint32_t *out, *tmp;
+	uint32_t cached[2] = { ~0U, ~0U };
+	uint32_t step_x, step_y, x, y, x0, x1, y0, y1, fy;
+	int sx, sy;
+
+	if (!dest_width || !dest_height || !src_width || !src_height)
+		return;
+	step_x = (src_width << 16) / dest_width;
+	step_y = (src_height << 16) / dest_height;
+	sy = static_cast<int>(step_y >> 1) - 0x8000;
+	for (y = 0U; y != dest_height; ++y, sy += static_cast<int>(step_y), d += dest_pitch) {
+		y0 = sy > 0 ? static_cast<uint32_t>(sy) >> 16 : 0U;
+		fy = sy > 0 ? (static_cast<uint32_t>(sy) >> 9) & 0x7FU : 0U;
+		if (y0 >= src_height - 1U) {
+			y0 = src_height - 1U;
+			fy = 0U;
+		}
+		y1 = fy ? y0 + 1U : y0;
+		/*
+		 * Note: Going down, the old row y1 becomes the new row y0, so swap
+		 *   instead of converting it again.
+		 */
+		if (cached[0] != y0 && cached[1] == y0) {
+			tmp = row[0];
+			row[0] = row[1];
+			row[1] = tmp;
+			cached[0] = y0;
+			cached[1] = ~0U;
+		}
+		if (cached[0] != y0) {
+			yuv422_row_to_xrgb(row[0], s + y0 * src_pitch, src_width, uyvy);
+			cached[0] = y0;
+		}
+		if (fy) {
+			if (cached[1] != y1) {
+				yuv422_row_to_xrgb(row[1], s + y1 * src_pitch, src_width, uyvy);
+				cached[1] = y1;
+			}
+			lerp_xrgb_row(blend, row[0], row[1], src_width, fy);
+			line = blend;
+		} else
+			line = row[0];
+		out = reinterpret_cast<uint32_t*>(d);
+		if (step_x == 0x10000U) {
+			memcpy(out, line, dest_width * sizeof(uint32_t));
+			continue;
+		}
+		sx = static_cast<int>(step_x >> 1) - 0x8000;
+		for (x = 0U; x != dest_width; ++x, sx += static_cast<int>(step_x)) {
+			if (sx <= 0) {
+				out[x] = line[0];
+				continue;
+			}
+			x0 = static_cast<uint32_t>(sx) >> 16;
+			if (x0 >= src_width - 1U) {
+				out[x] = line[src_width - 1U];
+				continue;
+			}
+			x1 = x0 + 1U;
+			out[x] = lerp_xrgb(line[x0], line[x1], (static_cast<uint32_t>(sx) >> 8) & 0xFFU);
+		}
+	}
 }
-#endif /* VECTORIZE */
 
 static
 bool isRegionEmpty(IOAccelDeviceRegion const* rgn)
@@ -373,7 +474,11 @@ void CLASS::Init()
 {
 	m_log_level = LOGGING_LEVEL;
 	m_backing.vtb.init();
+	m_present_tracker.init(AUTO_SYNC_PRESENT_FENCE_COUNT);
 	m_video.stream_id = SVGA_ID_INVALID;
+	for (uint32_t i = 0U; i != VIDEO_NUM_FRAMES - 1U; ++i)
+		m_video.spare[i].vtb.init();
+	m_video.soft.vtb.init();
 	InitGL();
 }
 
@@ -627,6 +732,7 @@ void CLASS::releaseBacking()
 		m_provider->VRAMFree(m_backing.self);
 	bzero(&m_backing, sizeof m_backing);
 	m_backing.vtb.init();
+	releaseVideoFrames();
 }
 
 HIDDEN
@@ -942,7 +1048,8 @@ IOReturn CLASS::doPresent()
 	bzero(&extra, sizeof extra);
 	if (m_provider->surfacePresentAutoSync(m_provider->getMasterSurfaceID(),
 										   m_last_region,
-										   &extra) != kIOReturnSuccess)
+										   &extra,
+										   &m_present_tracker) != kIOReturnSuccess)
 		return kIOReturnIOError;
 	return kIOReturnSuccess;
 }
@@ -1080,11 +1187,17 @@ IOReturn CLASS::GFBOutDirect()
 #pragma mark Private Support Methods - Video
 #pragma mark -
 
+/*
+ * Note: If visible_only, clears just the source rect (m_scale.buffer)
+ *   within the backing layout, otherwise clears all size bytes.
+ */
 HIDDEN
-void CLASS::clear_yuv_to_black(void* buffer, vm_size_t size)
+void CLASS::clear_yuv_to_black(void* buffer, vm_size_t size, bool visible_only)
 {
-	vm_size_t s = size / sizeof(uint32_t);	// size should already be aligned to PAGE_SIZE
+	uint8_t* p;
+	vm_size_t offset, row_bytes, pitch;
 	uint32_t pixval = 0U;
+	int h;
 
 	switch (m_video.vmware_pixel_format) {
 		case VMWARE_FOURCC_UYVY:
@@ -1096,17 +1209,258 @@ void CLASS::clear_yuv_to_black(void* buffer, vm_size_t size)
 		default:
 			return;				// Unsupported
 	}
+	pitch = m_scale.reserved[1];
+	h = m_scale.buffer.h;
+	if (visible_only && h > 0 && m_scale.buffer.w > 0 && !(pitch & 3U)) {
+		/*
+		 * Note: a 4-byte pixel pair is the smallest unit that can be filled
+		 */
+		offset = m_scale.reserved[2] & ~static_cast<vm_size_t>(3U);
+		row_bytes = (m_scale.reserved[2] + static_cast<vm_size_t>(m_scale.buffer.w) * m_bytes_per_pixel + 3U - offset) & ~static_cast<vm_size_t>(3U);
+		if (row_bytes > pitch)
+			row_bytes = pitch;
+		if (offset + (h - 1) * pitch + row_bytes <= size) {
+			p = static_cast<uint8_t*>(buffer) + offset;
+			if (row_bytes == pitch) {
+				fill32(p, pixval, h * pitch);
+				return;
+			}
+			for (; h; --h, p += pitch)
+				fill32(p, pixval, row_bytes);
+			return;
+		}
+	}
+	fill32(buffer, pixval, size);
+}
+
+/*
+ * Note: Spare video frames mirror the kind (VRAM or GMR) and size of m_backing.
+ */
+HIDDEN
+bool CLASS::allocVideoFrame(uint32_t index)
+{
+	IOReturn rc;
+	IOBufferMemoryDescriptor* bmd;
+
+	if (m_backing.self) {
+		m_video.spare[index].self = static_cast<uint8_t*>(m_provider->VRAMMalloc(m_backing.size));
+		if (!m_video.spare[index].self)
+			return false;
+		m_video.spare[index].offset = reinterpret_cast<vm_offset_t>(m_video.spare[index].self) - CLIENT_ADDR_TO_UINTPTR_T(m_screenInfo.client_addr);
+		m_video.spare[index].size = m_backing.size;
+		m_video.spare[index].vtb.gmr_id = GMR_VRAM();
+		m_video.spare[index].vtb.fence = 0U;
+		return true;
+	}
+	bmd = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task,
+														   kIODirectionInOut,
+														   m_backing.size,
+														   0xFFFFFFFF000ULL);	// ensures 32-bit PPNs
+	if (!bmd)
+		return false;
+	m_video.spare[index].vtb.md = bmd;
+	rc = m_video.spare[index].vtb.prepare(m_provider);
+	if (rc != kIOReturnSuccess) {
+		m_video.spare[index].vtb.md = 0;
+		bmd->release();
+		SFLog(1, "%s[%#x]: VendorTransferBuffer::prepare failed with status code %#x\n", __FUNCTION__, m_wID, rc);
+		return false;
+	}
+	m_video.spare[index].offset = 0U;
+	m_video.spare[index].size = m_backing.size;
+	m_video.spare[index].vtb.gart_ptr = 0U;	// mark as kernel descriptor
+	m_video.spare[index].vtb.fence = 0U;
+	return true;
+}
+
+HIDDEN
+void CLASS::releaseVideoFrame(uint32_t index)
+{
+	m_video.spare[index].vtb.complete(m_provider);
+	m_video.spare[index].vtb.discard();
+	if (m_provider != 0 && m_video.spare[index].self != 0)
+		m_provider->VRAMFree(m_video.spare[index].self);
+	bzero(&m_video.spare[index], sizeof m_video.spare[index]);
+	m_video.spare[index].vtb.init();
+}
+
+HIDDEN
+void CLASS::releaseVideoFrames()
+{
+	for (uint32_t i = 0U; i != VIDEO_NUM_FRAMES - 1U; ++i)
+		releaseVideoFrame(i);
+	m_video.next_spare = 0U;
+	m_video.flipped = false;
+	releaseSoftVideo();
+	releaseTrickBuffer();
+}
+
+/*
+ * Note: See rotate_video_frame.
+ */
+HIDDEN
+void CLASS::rotateVideoFrame()
+{
+	uint32_t i = m_video.next_spare;
+
+	if (m_video.spare[i].size != m_backing.size ||
+		(m_video.spare[i].self != 0) != (m_backing.self != 0)) {
+		releaseVideoFrame(i);
+		if (!allocVideoFrame(i))
+			return;		// Note: carry on single-buffered
+	}
+	releaseBackingMap(1U);
+	m_video.next_spare = rotate_video_frame(m_provider, &m_backing, &m_video.spare[0], i, VIDEO_NUM_FRAMES - 1U);
+	m_video.flipped = false;
+}
+
+/*
+ * Note: The overlay can only show a whole frame, so a clipped destination,
+ *   or a host without the overlay, goes through software conversion.  This
+ *   needs a direct path to the screen (screen object or GFB), so with a
+ *   master surface the overlay is always used.
+ */
+HIDDEN
+bool CLASS::useSoftVideo() const
+{
+	if (!m_provider->HaveScreen() && m_provider->Have3D())
+		return false;
+	return !m_provider->HaveVideoOverlay() || m_last_region->num_rects > 1U;
+}
+
+HIDDEN
+bool CLASS::allocSoftVideo(uint32_t width, uint32_t height, uint32_t src_width, bool scaled)
+{
+	IOReturn rc;
+	IOBufferMemoryDescriptor* bmd;
+	vm_size_t pitch, size;
+
+	pitch = round_up_to_power2(width * static_cast<uint32_t>(sizeof(uint32_t)), 16U);
+	size = (pitch * height + PAGE_MASK) & -PAGE_SIZE;
+	if (size > m_video.soft.size) {
+		releaseSoftVideo();
+		bmd = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task,
+															   kIODirectionInOut,
+															   size,
+															   0xFFFFFFFF000ULL);	// ensures 32-bit PPNs
+		if (!bmd)
+			return false;
+		m_video.soft.vtb.md = bmd;
+		if (m_provider->HaveScreen()) {
+			rc = m_video.soft.vtb.prepare(m_provider);
+			if (rc != kIOReturnSuccess) {
+				m_video.soft.vtb.discard();
+				SFLog(1, "%s[%#x]: VendorTransferBuffer::prepare failed with status code %#x\n", __FUNCTION__, m_wID, rc);
+				return false;
+			}
+		}
+		m_video.soft.self = static_cast<uint8_t*>(bmd->getBytesNoCopy());
+		m_video.soft.size = size;
+		m_video.soft.vtb.gart_ptr = 0U;	// mark as kernel descriptor
+		m_video.soft.vtb.fence = 0U;
+	}
+	m_video.soft.pitch = pitch;
+	if (!scaled)
+		return true;
+	size = yuv_scale_lines_size(src_width);
+	if (size <= m_video.soft.lines_size)
+		return true;
+	if (m_video.soft.lines)
+		IOFree(m_video.soft.lines, m_video.soft.lines_size);
+	m_video.soft.lines = static_cast<uint32_t*>(IOMalloc(size));
+	m_video.soft.lines_size = m_video.soft.lines ? size : 0U;
+	return m_video.soft.lines != 0;
+}
+
+HIDDEN
+void CLASS::releaseSoftVideo()
+{
+	m_video.soft.vtb.complete(m_provider);
+	m_video.soft.vtb.discard();
+	if (m_video.soft.lines)
+		IOFree(m_video.soft.lines, m_video.soft.lines_size);
+	bzero(&m_video.soft, sizeof m_video.soft);
+	m_video.soft.vtb.init();
+}
+
+/*
+ * Note: Converts the source rect to X8R8G8B8 at the size of the destination
+ *   bounds, then blits it through the clipped region like a regular surface.
+ */
+HIDDEN
+IOReturn CLASS::SoftVideoOut()
+{
+	VMsvga2Accel::ExtraInfo extra;
+	IOVirtualAddress base;
+	vm_size_t limit_from_base;
+	IOMemoryMap* holder;
+	IOReturn rc;
+	uint32_t width, height, src_width, src_height, rect[4];
+	bool scaled, uyvy;
+
+	if (isRegionEmpty(m_last_region))
+		return kIOReturnSuccess;
+	width = static_cast<uint32_t>(m_last_region->bounds.w);
+	height = static_cast<uint32_t>(m_last_region->bounds.h);
+	src_width = static_cast<uint32_t>(m_scale.buffer.w);
+	src_height = static_cast<uint32_t>(m_scale.buffer.h);
+	if (!src_width || !src_height)
+		return kIOReturnNotReady;
+	scaled = width != src_width || height != src_height;
+	uyvy = m_video.vmware_pixel_format == VMWARE_FOURCC_UYVY;
+	m_video.soft.vtb.sync(m_provider);	// Note: previous frame may still be in flight
+	if (!allocSoftVideo(width, height, src_width, scaled))
+		return kIOReturnNoMemory;
+	rc = obtainKernelPtrs(&base, &limit_from_base, &holder);
+	if (rc != kIOReturnSuccess)
+		return rc;
+	if (limit_from_base < (src_height - 1U) * m_scale.reserved[1] + src_width * m_bytes_per_pixel) {
+		if (holder)
+			holder->release();
+		return kIOReturnNotReady;
+	}
+	if (scaled)
+		yuv422_to_xrgb_scaled(m_video.soft.self, m_video.soft.pitch, width, height,
+							  reinterpret_cast<void const*>(base), m_scale.reserved[1], src_width, src_height,
+							  uyvy, m_video.soft.lines);
+	else
+		yuv422_to_xrgb(m_video.soft.self, m_video.soft.pitch,
+					   reinterpret_cast<void const*>(base), m_scale.reserved[1],
+					   width, height, uyvy);
+	if (holder)
+		holder->release();
+	bzero(&extra, sizeof extra);
+	extra.mem_pitch = m_video.soft.pitch;
+	if (m_provider->HaveScreen()) {
+		extra.mem_gmr_id = m_video.soft.vtb.gmr_id;
+		extra.srcDeltaX = -static_cast<int>(m_last_region->bounds.x);
+		extra.srcDeltaY = -static_cast<int>(m_last_region->bounds.y);
+		if (m_provider->blitToScreen(m_framebufferIndex,
+									 m_last_region,
+									 &extra,
+									 &m_video.soft.vtb.fence) != kIOReturnSuccess)
+			return kIOReturnDMAError;
+		return kIOReturnSuccess;
+	}
 	/*
-	 * XMM (SSE2) version
+	 * Note: dst applies to the frame, src to GFB
 	 */
-#ifdef VECTORIZE
-	if ((reinterpret_cast<vm_address_t>(buffer) & 0xFU) == 0U) {
-		__v4si p = { pixval, pixval, pixval, pixval };
-		memset128(buffer, p, size / sizeof p);
-		return;
-	}
-#endif /* VECTORIZE */
-	memset32(buffer, pixval, s);
+	extra.dstDeltaX = -static_cast<int>(m_last_region->bounds.x);
+	extra.dstDeltaY = -static_cast<int>(m_last_region->bounds.y);
+	rc = m_provider->blitGFB(m_framebufferIndex,
+							 m_last_region,
+							 &extra,
+							 reinterpret_cast<IOVirtualAddress>(m_video.soft.self),
+							 m_video.soft.size,
+							 1);
+	if (rc != kIOReturnSuccess)
+		return kIOReturnDMAError;
+	rect[0] = m_last_region->bounds.x;
+	rect[1] = m_last_region->bounds.y;
+	rect[2] = m_last_region->bounds.w;
+	rect[3] = m_last_region->bounds.h;
+	m_provider->UpdateFramebufferAutoRing(&rect[0]);
+	return kIOReturnSuccess;
 }
 
 /*
@@ -1133,35 +1487,58 @@ HIDDEN
 IOReturn CLASS::setup_trick_buffer()
 {
 	IOBufferMemoryDescriptor* mem;
-	IOMemoryMap* my_map_of_mem;
 
 	if (!isBackingValid())
 		return kIOReturnNotReady;
-	mem = IOBufferMemoryDescriptor::inTaskWithOptions(0,
-													  kIOMemoryKernelUserShared |
-													  kIOMemoryPageable |
-													  kIODirectionInOut,
-													  m_backing.size,
-													  page_size);
-	if (!mem)
-		return kIOReturnNoMemory;
-	if (mem->prepare() != kIOReturnSuccess) {
-		mem->release();
-		return kIOReturnNoMemory;
-	}
-	my_map_of_mem = mem->createMappingInTask(kernel_task, 0U, kIOMapAnywhere);
-	if (!my_map_of_mem) {
-		mem->complete();
-		mem->release();
-		return kIOReturnNoMemory;
+	if (m_video.trick.mem && m_video.trick.mem->getLength() != m_backing.size)
+		releaseTrickBuffer();
+	/*
+	 * Note: The buffer is kept across locks.  It is cleared whole once
+	 *   when created, after that only the visible rect is cleared.
+	 */
+	if (m_video.trick.mem)
+		clear_yuv_to_black(reinterpret_cast<void*>(m_video.trick.kernel_map->getVirtualAddress()), m_backing.size, true);
+	else {
+		mem = IOBufferMemoryDescriptor::inTaskWithOptions(0,
+														  kIOMemoryKernelUserShared |
+														  kIOMemoryPageable |
+														  kIODirectionInOut,
+														  m_backing.size,
+														  page_size);
+		if (!mem)
+			return kIOReturnNoMemory;
+		if (mem->prepare() != kIOReturnSuccess) {
+			mem->release();
+			return kIOReturnNoMemory;
+		}
+		m_video.trick.kernel_map = mem->createMappingInTask(kernel_task, 0U, kIOMapAnywhere);
+		if (!m_video.trick.kernel_map) {
+			mem->complete();
+			mem->release();
+			return kIOReturnNoMemory;
+		}
+		m_video.trick.mem = mem;
+		clear_yuv_to_black(reinterpret_cast<void*>(m_video.trick.kernel_map->getVirtualAddress()), m_backing.size);
 	}
-	clear_yuv_to_black(reinterpret_cast<void*>(my_map_of_mem->getVirtualAddress()), m_backing.size);
-	my_map_of_mem->release();
-	mem->complete();
+	if (m_backing.map[0] && m_backing.map[0]->getMemoryDescriptor() == m_video.trick.mem)
+		return kIOReturnSuccess;
 	releaseBackingMap(0U);
-	m_backing.map[0] = mem->createMappingInTask(m_owning_task, 0U, kIOMapAnywhere);
-	mem->release();
-	return kIOReturnSuccess;
+	m_backing.map[0] = m_video.trick.mem->createMappingInTask(m_owning_task, 0U, kIOMapAnywhere);
+	return m_backing.map[0] ? kIOReturnSuccess : kIOReturnNoMemory;
+}
+
+HIDDEN
+void CLASS::releaseTrickBuffer()
+{
+	if (m_video.trick.kernel_map) {
+		m_video.trick.kernel_map->release();
+		m_video.trick.kernel_map = 0;
+	}
+	if (m_video.trick.mem) {
+		m_video.trick.mem->complete();
+		m_video.trick.mem->release();
+		m_video.trick.mem = 0;
+	}
 }
 
 /*
@@ -1169,6 +1546,7 @@ IOReturn CLASS::setup_trick_buffer()
  *   overlayed video frame based on the destination region, but
  *   VMware SVGA II doesn't support this.  So we take an all-or-nothing
  *   approach.  Either overlay the entire frame, or show nothing.
+ *   Where possible, clipped regions go through SoftVideoOut instead.
  */
 HIDDEN
 bool CLASS::setVideoDest()
@@ -1230,6 +1608,7 @@ void CLASS::InitGL()
 {
 	m_gl.color_sid = SVGA_ID_INVALID;
 	m_gl.depth_sid = SVGA_ID_INVALID;
+	m_gl.swap_tracker.init();
 }
 
 HIDDEN
@@ -1271,7 +1650,8 @@ IOReturn CLASS::flushGLSurface()
 	extra.srcDeltaX = -m_last_region->bounds.y;
 	return m_provider->surfacePresentAutoSync(m_gl.color_sid,
 											  m_last_region,
-											  &extra);
+											  &extra,
+											  &m_present_tracker);
 }
 
 HIDDEN
@@ -1524,6 +1904,13 @@ IOReturn CLASS::surface_flush(uintptr_t framebufferMask, IOOptionBits options)
 		return kIOReturnNotReady;
 	if (bVideoMode)
 		return kIOReturnSuccess;
+	/*
+	 * Note: the present itself waits out of the device lock,
+	 *   this lets the client retry rather than wait at all.
+	 */
+	if (bPresentNoWait &&
+		m_provider->throttlePresent(&m_present_tracker, true) == kIOReturnBusy)
+		return kIOReturnBusy;
 #if 0
 	if (!(framebufferMask & (1UL << m_framebufferIndex)))
 		return kIOReturnSuccess;	// Note: nothing to do
@@ -1632,6 +2019,8 @@ IOReturn CLASS::surface_write_unlock()
 HIDDEN
 IOReturn CLASS::surface_control(uintptr_t selector, uintptr_t arg, uint32_t* result)
 {
+	IOReturn rc;
+
 	SFLog(2, "%s[%#x](%lu, %lu, out)\n", __FUNCTION__, m_wID, selector, arg);
 
 	/*
@@ -1666,6 +2055,18 @@ IOReturn CLASS::surface_control(uintptr_t selector, uintptr_t arg, uint32_t* res
 			 */
 			*result = 1U;
 			return kIOReturnSuccess;
+		case kIOVMSurfaceControlPresentDepth:
+			if (!m_provider)
+				return kIOReturnNotReady;
+			rc = m_provider->resizePresentTracker(&m_present_tracker, arg);
+			if (rc != kIOReturnSuccess)
+				return rc;
+			*result = 0U;
+			return kIOReturnSuccess;
+		case kIOVMSurfaceControlPresentNoWait:
+			bPresentNoWait = (arg != 0U);
+			*result = 0U;
+			return kIOReturnSuccess;
 	}
 	return kIOReturnBadArgument;
 }
@@ -1891,8 +2292,13 @@ IOReturn CLASS::context_lock_memory(task_t context_owning_task, mach_vm_address_
 		return kIOReturnNotReady;
 	if (OSTestAndSet(vmSurfaceLockContext, &bIsLocked))
 		return kIOReturnCannotLock;
-	if (!allocBacking() ||
-		!mapBacking(context_owning_task, 1U)) {
+	if (!allocBacking()) {
+		OSTestAndClear(vmSurfaceLockContext, &bIsLocked);
+		return kIOReturnNoMemory;
+	}
+	if (bVideoMode && m_video.flipped && classifyBacking() == 1)
+		rotateVideoFrame();
+	if (!mapBacking(context_owning_task, 1U)) {
 		OSTestAndClear(vmSurfaceLockContext, &bIsLocked);
 		return kIOReturnNoMemory;
 	}
@@ -2036,9 +2442,10 @@ IOReturn CLASS::copy_framebuffer_region_to_self(uint32_t framebufferIndex,
 }
 
 /*
- * surface-to-framebuffer is not supported yet.  It's not difficult to do, but the
- *   WindowsServer blits by using surface_flush() and QuickTime blits with SwapSurface,
- *   so it's not really necessary.
+ * This routine blits a region from a CGS surface to the framebuffer.
+ *   The region is in surface coordinates, and lands at (destX, destY).
+ *   All rects go out in a single command - DMA to the master surface
+ *   followed by a present, a screen object blit, or a CPU copy into the GFB.
  */
 HIDDEN
 IOReturn CLASS::copy_self_region_to_framebuffer(uint32_t framebufferIndex,
@@ -2047,11 +2454,101 @@ IOReturn CLASS::copy_self_region_to_framebuffer(uint32_t framebufferIndex,
 												IOAccelDeviceRegion const* region,
 												size_t regionSize)
 {
-	SFLog(1, "%s: Copy from surface(%#x) to framebuffer(%u) - unsupported\n", __FUNCTION__,
-		  m_wID, framebufferIndex);
+	IOReturn rc;
+	VMsvga2Accel::ExtraInfo extra;
+	int deltaX, deltaY;
+
+	SFLog(3, "%s[%#x](%u, %d, %d, %p, %lu)\n", __FUNCTION__, m_wID, framebufferIndex, destX, destY, region, regionSize);
+
 	if (!region || regionSize < IOACCEL_SIZEOF_DEVICE_REGION(region))
 		return kIOReturnBadArgument;
-	return kIOReturnUnsupported;
+
+	if (!bHaveID || !isSourceValid() || !isBackingValid())
+		return kIOReturnNotReady;
+	if (bVideoMode) {
+		SFLog(1, "%s[%#x]: called for YUV surface - unsupported\n", __FUNCTION__, m_wID);
+		return kIOReturnUnsupported;
+	}
+	if (bGLMode) {
+		SFLog(1, "%s: called for GL surface - unsupported\n", __FUNCTION__);
+		return kIOReturnUnsupported;
+	}
+	if (m_surfaceFormat != SVGA3D_X8R8G8B8) {
+		SFLog(1, "%s[%#x]: called for surface format %d - unsupported\n", __FUNCTION__, m_wID, m_surfaceFormat);
+		return kIOReturnUnsupportedMode;
+	}
+	deltaX = destX - region->bounds.x;
+	deltaY = destY - region->bounds.y;
+	clipRegionToBuffer(const_cast<IOAccelDeviceRegion*>(region), 0, 0);
+	bzero(&extra, sizeof extra);
+	extra.mem_gmr_id = m_backing.vtb.gmr_id;
+	extra.mem_offset_in_gmr = m_backing.offset + m_scale.reserved[2];
+	extra.mem_pitch = m_scale.reserved[1];
+	if (m_provider->isPrimaryScreenActive()) {
+		extra.dstDeltaX = deltaX;
+		extra.dstDeltaY = deltaY;
+		rc = m_provider->blitToScreen(framebufferIndex,
+									  region,
+									  &extra,
+									  &m_backing.vtb.fence);
+	} else if (bHaveMasterSurface) {
+		/*
+		 * Note: src applies to the backing, dst to the master surface
+		 */
+		extra.dstDeltaX = deltaX;
+		extra.dstDeltaY = deltaY;
+		rc = m_provider->surfaceDMA2D(m_provider->getMasterSurfaceID(),
+									  SVGA3D_WRITE_HOST_VRAM,
+									  region,
+									  &extra,
+									  &m_backing.vtb.fence);
+		if (rc != kIOReturnSuccess)
+			return kIOReturnNotWritable;
+		bzero(&extra, sizeof extra);
+		extra.srcDeltaX = deltaX;
+		extra.srcDeltaY = deltaY;
+		extra.dstDeltaX = deltaX;
+		extra.dstDeltaY = deltaY;
+		rc = m_provider->surfacePresentAutoSync(m_provider->getMasterSurfaceID(),
+												region,
+												&extra,
+												&m_present_tracker);
+	} else {
+		IOVirtualAddress base;
+		vm_size_t limit_from_base;
+		IOMemoryMap* holder;
+		uint32_t rect[4];
+		rc = obtainKernelPtrs(&base, &limit_from_base, &holder);
+		if (rc != kIOReturnSuccess)
+			return rc;
+		/*
+		 * Note: dst applies to backing, src to GFB
+		 */
+		extra.mem_offset_in_gmr = 0U;
+		extra.srcDeltaX = deltaX;
+		extra.srcDeltaY = deltaY;
+		rc = m_provider->blitGFB(framebufferIndex,
+								 region,
+								 &extra,
+								 base,
+								 limit_from_base,
+								 1);
+		if (holder)
+			holder->release();
+		if (rc != kIOReturnSuccess) {
+			SFLog(1, "%s[%#x]: blitGFB failed, error == %#x\n", __FUNCTION__, m_wID, rc);
+			return rc;
+		}
+		rect[0] = region->bounds.x + deltaX;
+		rect[1] = region->bounds.y + deltaY;
+		rect[2] = region->bounds.w;
+		rect[3] = region->bounds.h;
+		m_provider->UpdateFramebufferAutoRing(&rect[0]);
+		return kIOReturnSuccess;
+	}
+	if (rc != kIOReturnSuccess)
+		return kIOReturnNotWritable;
+	return kIOReturnSuccess;
 }
 
 HIDDEN
@@ -2181,11 +2678,25 @@ IOReturn CLASS::surface_flush_video(uint32_t* swapFlags)
 		return kIOReturnUnsupported;
 	}
 	/*
-	 * Note: we don't SyncFIFO right after a flush, which means the backing may be reused
-	 *   while there are still outgoing video flushes in the FIFO.  This may cause some tearing.
+	 * Note: The frame is not reused until its fence passes, see rotateVideoFrame.
+	 *   A client backing can't be rotated, and may still tear.
 	 */
-	if (m_video.unit.enabled)
-		return m_provider->VideoSetRegsInRange(m_video.stream_id, 0, 0U, 0U, &m_backing.vtb.fence);
+	m_video.flipped = true;
+	if (useSoftVideo()) {
+		surface_video_off();
+		return SoftVideoOut();
+	}
+	if (m_video.unit.enabled) {
+		if (m_video.unit.dataOffset == static_cast<uint32_t>(m_backing.offset) &&
+			m_video.unit.dataGMRId == m_backing.vtb.gmr_id)
+			return m_provider->VideoSetRegsInRange(m_video.stream_id, 0, 0U, 0U, &m_backing.vtb.fence);
+		m_video.unit.dataOffset = static_cast<uint32_t>(m_backing.offset);
+		m_video.unit.dataGMRId = m_backing.vtb.gmr_id;
+		return m_provider->VideoSetRegsWithMask(m_video.stream_id,
+												&m_video.unit,
+												(1U << SVGA_VIDEO_DATA_OFFSET) | (1U << SVGA_VIDEO_DATA_GMRID),
+												&m_backing.vtb.fence);
+	}
 	m_video.stream_id = m_provider->AllocStreamID();
 	if (!isIdValid(m_video.stream_id))
 		return kIOReturnNoResources;
@@ -2343,3 +2854,11 @@ void CLASS::touchRenderTarget()
 	}
 #endif
 }
+
+HIDDEN
+void CLASS::paceSwap(uint32_t swap_interval, uint32_t stamp)
+{
+	if (!m_provider)
+		return;
+	pace_swap(m_provider, &m_gl.swap_tracker, &m_gl.last_swap_vbl, swap_interval, stamp);
+}
@@ -32,6 +32,11 @@
 #include <IOKit/IOUserClient.h>
 #include <IOKit/graphics/IOAccelSurfaceConnect.h>
 #include "VendorTransferBuffer.h"
+#include "VideoFrames.h"
+#include "FenceTracker.h"
+
+#define VIDEO_NUM_FRAMES 3U		// 2 - 4, including m_backing
+#define GL_FRAMES_IN_FLIGHT 2U	// swaps queued ahead of the host
 
 class VMsvga2Surface: public IOUserClient
 {
@@ -55,6 +60,7 @@ private:
 	unsigned bHaveScreenObject:1;
 	unsigned bSkipWriteLockOnce:1;
 	unsigned bGLMode:1;
+	unsigned bPresentNoWait:1;
 
 	/*
 	 * Locking stuff
@@ -77,12 +83,8 @@ private:
 	/*
 	 * Backing stuff
 	 */
-	struct {
-		uint8_t* self;
-		vm_offset_t offset;
-		vm_size_t size;
+	struct : VideoFrame {
 		IOMemoryMap* map[2];
-		VendorTransferBuffer vtb;
 	} m_backing;
 
 	/*
@@ -94,6 +96,11 @@ private:
 		vm_size_t size;
 	} m_client_backing;
 
+	/*
+	 * Present stuff
+	 */
+	PresentTracker m_present_tracker;
+
 	/*
 	 * Shape stuff
 	 */
@@ -118,6 +125,21 @@ private:
 		uint32_t stream_id;
 		uint32_t vmware_pixel_format;
 		SVGAOverlayUnit	unit;
+		VideoFrame spare[VIDEO_NUM_FRAMES - 1U];	// frames rotated with m_backing
+		uint32_t next_spare;
+		bool flipped;					// m_backing has been flushed since last rotation
+		struct {
+			uint8_t* self;				// kernel address
+			vm_size_t size;
+			vm_size_t pitch;
+			uint32_t* lines;			// line buffers for scaling
+			vm_size_t lines_size;
+			VendorTransferBuffer vtb;
+		} soft;							// X8R8G8B8 frame when not using the overlay
+		struct {
+			class IOBufferMemoryDescriptor* mem;
+			class IOMemoryMap* kernel_map;
+		} trick;						// all-black view for the owning task, see setup_trick_buffer
 	} m_video;
 
 	/*
@@ -132,6 +154,8 @@ private:
 		uint32_t depth_sid;
 		int ds_format;
 		uint8_t volatile rt_dirty;
+		uint64_t last_swap_vbl;
+		FenceTracker<GL_FRAMES_IN_FLIGHT> swap_tracker;
 	} m_gl;
 
 	/*
@@ -196,8 +220,17 @@ private:
 	/*
 	 * Private support methods - Video
 	 */
-	void clear_yuv_to_black(void* buffer, vm_size_t size);
+	void clear_yuv_to_black(void* buffer, vm_size_t size, bool visible_only = false);
 	IOReturn setup_trick_buffer();
+	void releaseTrickBuffer();
+	bool allocVideoFrame(uint32_t index);
+	void releaseVideoFrame(uint32_t index);
+	void releaseVideoFrames();
+	void rotateVideoFrame();
+	bool useSoftVideo() const;
+	bool allocSoftVideo(uint32_t width, uint32_t height, uint32_t src_width, bool scaled);
+	void releaseSoftVideo();
+	IOReturn SoftVideoOut();
 	bool setVideoDest();
 	bool setVideoRegs();
 	void videoReshape();
@@ -268,6 +301,7 @@ public:
 	IOReturn resizeGL();
 	IOReturn detachGL();
 	void touchRenderTarget();
+	void paceSwap(uint32_t swap_interval, uint32_t stamp);
 
 	/*
 	 * IOAccelSurfaceConnect
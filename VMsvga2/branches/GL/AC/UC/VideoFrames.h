@@ -0,0 +1,65 @@
+/*
+ *  VideoFrames.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on July 29th 2009.
+ *  Copyright 2009-2012 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __VIDEOFRAMES_H__
+#define __VIDEOFRAMES_H__
+
+#include "VendorTransferBuffer.h"
+
+class VMsvga2Accel;
+
+/*
+ * A YUV frame the overlay can show, m_backing or one of its spares
+ */
+struct VideoFrame {
+	uint8_t* self;
+	vm_offset_t offset;
+	vm_size_t size;
+	VendorTransferBuffer vtb;
+};
+
+/*
+ * Note: Swaps the frame in backing, just flushed to the overlay, for
+ *   spares[next], the least recently flushed spare, so the client never
+ *   writes into a frame the host may still be reading.  Only waits if
+ *   that spare is still in flight, i.e. all frames are.  Returns the
+ *   next spare to use.
+ */
+static inline
+uint32_t rotate_video_frame(VMsvga2Accel* provider, VideoFrame* backing, VideoFrame* spares, uint32_t next, uint32_t num_spares)
+{
+	VideoFrame frame;
+
+	spares[next].vtb.sync(provider);
+	frame = *backing;
+	*backing = spares[next];
+	spares[next] = frame;
+	return (next + 1U) % num_spares;
+}
+
+#endif /* __VIDEOFRAMES_H__ */
@@ -0,0 +1,182 @@
+/*
+ *  YUVConvert.h
+ *  VMsvga2Accel
+ *
+ *  Created by Zenith432 on July 29th 2009.
+ *  Copyright 2009-2012 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __YUVCONVERT_H__
+#define __YUVCONVERT_H__
+
+#ifdef VECTORIZE
+#include <emmintrin.h>
+#endif
+
+/*
+ * Note: Pure row converters for the software video path, no kernel
+ *   dependencies so tests/ can build them on the host.
+ */
+
+/*
+ * Note: BT.601 video range YCbCr -> RGB, coefficients scaled by 2^14.
+ *   Inputs are pre-shifted left by 7, so pmulhw leaves results scaled
+ *   by 2^5.  2.018 doesn't fit int16, so B adds the 1.0 part as a shift.
+ */
+#define YUV_CY  19071	// 1.164
+#define YUV_CRV 26149	// 1.596
+#define YUV_CGU  6406	// 0.391
+#define YUV_CGV 13320	// 0.813
+#define YUV_CBU 16679	// 2.018 - 1.0
+
+static inline
+int mulhi16(int a, int b)
+{
+	return (a * b) >> 16;
+}
+
+static inline
+uint32_t clamp_yuv(int v)
+{
+	v = (v + 16) >> 5;
+	return static_cast<uint32_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static inline
+uint32_t yuv_to_xrgb(int yk, int u, int v)
+{
+	return 0xFF000000U |
+		(clamp_yuv(yk + mulhi16(v, YUV_CRV)) << 16) |
+		(clamp_yuv(yk - mulhi16(u, YUV_CGU) - mulhi16(v, YUV_CGV)) << 8) |
+		clamp_yuv(yk + mulhi16(u, YUV_CBU) + (u >> 2));
+}
+
+/*
+ * Note: Converts one row of width pixels of UYVY or YUY2 to X8R8G8B8,
+ *   8 pixels per iteration with SSE2.  The scalar tail is bit-exact
+ *   with the vector loop.
+ */
+static inline
+void yuv422_row_to_xrgb(uint32_t* dest, uint8_t const* src, uint32_t width, bool uyvy)
+{
+	uint32_t x = 0U;
+	int yk0, yk1, u, v;
+	uint8_t const* p;
+#ifdef VECTORIZE
+	__m128i const lo_mask = _mm_set1_epi16(0xFF);
+	__m128i const k_y  = _mm_set1_epi16(YUV_CY);
+	__m128i const k_rv = _mm_set1_epi16(YUV_CRV);
+	__m128i const k_gu = _mm_set1_epi16(YUV_CGU);
+	__m128i const k_gv = _mm_set1_epi16(YUV_CGV);
+	__m128i const k_bu = _mm_set1_epi16(YUV_CBU);
+	__m128i const y_bias = _mm_set1_epi16(16);
+	__m128i const c_bias = _mm_set1_epi16(128);
+	__m128i const round = _mm_set1_epi16(16);
+	__m128i const alpha = _mm_set1_epi8(-1);
+	__m128i s, y, c, cu, cv, r, g, b, bg, ra;
+
+	for (; x + 8U <= width; x += 8U, src += 16, dest += 8) {
+		s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+		if (uyvy) {
+			y = _mm_srli_epi16(s, 8);
+			c = _mm_and_si128(s, lo_mask);
+		} else {
+			y = _mm_and_si128(s, lo_mask);
+			c = _mm_srli_epi16(s, 8);
+		}
+		c = _mm_slli_epi16(_mm_sub_epi16(c, c_bias), 7);
+		cu = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+		cv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+		y = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, y_bias), 7), k_y);
+		y = _mm_add_epi16(y, round);
+		r = _mm_add_epi16(y, _mm_mulhi_epi16(cv, k_rv));
+		g = _mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhi_epi16(cu, k_gu)), _mm_mulhi_epi16(cv, k_gv));
+		b = _mm_add_epi16(_mm_add_epi16(y, _mm_mulhi_epi16(cu, k_bu)), _mm_srai_epi16(cu, 2));
+		r = _mm_packus_epi16(_mm_srai_epi16(r, 5), _mm_srai_epi16(r, 5));
+		g = _mm_packus_epi16(_mm_srai_epi16(g, 5), _mm_srai_epi16(g, 5));
+		b = _mm_packus_epi16(_mm_srai_epi16(b, 5), _mm_srai_epi16(b, 5));
+		bg = _mm_unpacklo_epi8(b, g);
+		ra = _mm_unpacklo_epi8(r, alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#endif /* VECTORIZE */
+	for (; x < width; x += 2U, src += 4, dest += 2) {
+		p = src;
+		if (uyvy) {
+			u = p[0]; yk0 = p[1]; v = p[2]; yk1 = p[3];
+		} else {
+			yk0 = p[0]; u = p[1]; yk1 = p[2]; v = p[3];
+		}
+		u = (u - 128) * 128;
+		v = (v - 128) * 128;
+		yk0 = mulhi16((yk0 - 16) * 128, YUV_CY);
+		yk1 = mulhi16((yk1 - 16) * 128, YUV_CY);
+		dest[0] = yuv_to_xrgb(yk0, u, v);
+		if (x + 1U < width)
+			dest[1] = yuv_to_xrgb(yk1, u, v);
+	}
+}
+
+/*
+ * Note: Blends two X8R8G8B8 pixels with an 8-bit fraction f (0 - 256) of b,
+ *   two channels at a time.
+ */
+static inline
+uint32_t lerp_xrgb(uint32_t a, uint32_t b, uint32_t f)
+{
+	uint32_t rb, ag;
+
+	rb = ((a & 0x00FF00FFU) * (256U - f) + (b & 0x00FF00FFU) * f) >> 8;
+	ag = ((a >> 8) & 0x00FF00FFU) * (256U - f) + ((b >> 8) & 0x00FF00FFU) * f;
+	return (rb & 0x00FF00FFU) | (ag & 0xFF00FF00U);
+}
+
+/*
+ * Note: Blends row b into row a with a 7-bit fraction f (0 - 128) of b,
+ *   writing the result to dest.
+ */
+static inline
+void lerp_xrgb_row(uint32_t* dest, uint32_t const* a, uint32_t const* b, uint32_t width, uint32_t f)
+{
+	uint32_t x = 0U;
+#ifdef VECTORIZE
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const k = _mm_set1_epi16(static_cast<short>(f));
+	__m128i va, vb, lo, hi;
+
+	for (; x + 4U <= width; x += 4U) {
+		va = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + x));
+		vb = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + x));
+		lo = _mm_unpacklo_epi8(va, zero);
+		hi = _mm_unpackhi_epi8(va, zero);
+		lo = _mm_add_epi16(lo, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(vb, zero), lo), k), 7));
+		hi = _mm_add_epi16(hi, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(vb, zero), hi), k), 7));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(lo, hi));
+	}
+#endif /* VECTORIZE */
+	for (; x < width; ++x)
+		dest[x] = lerp_xrgb(a[x], b[x], f << 1);
+}
+
+#endif /* __YUVCONVERT_H__ */
@@ -85,6 +85,14 @@ enum eIOVMGLMethods {
 	kIOVMGLNumMethods
 };
 
+/*
+ * VM specific selectors for VMsvga2Surface::surface_control
+ */
+enum eIOVMSurfaceControl {
+	kIOVMSurfaceControlPresentDepth = 0x100,	// arg: presents in flight, 1 - MAX_PRESENT_FENCE_COUNT
+	kIOVMSurfaceControlPresentNoWait			// arg: boolean, surface_flush returns kIOReturnBusy instead of waiting
+};
+
 enum eIOVM2DMethods {
 	kIOVM2DSetSurface,
 	kIOVM2DGetConfig,
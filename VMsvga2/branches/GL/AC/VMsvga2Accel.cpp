@@ -272,6 +272,7 @@ void CLASS::Cleanup()
 		bHaveScreenObject = false;
 		screen.Init(0);
 	}
+	bHaveVideo = false;
 #ifdef FB_NOTIFIER
 	if (m_fbNotifier) {
 		m_fbNotifier->remove();
@@ -511,6 +512,44 @@ void CLASS::cleanupPrimaryScreen()
 	m_primary_screen.h = static_cast<uint32_t>(-1);
 }
 
+HIDDEN
+IOReturn CLASS::waitForPresentFence(uint32_t fence, bool dontBlock)
+{
+	uint32_t ms;
+
+	if (!fence)
+		return kIOReturnSuccess;
+	m_framebuffer->lockDevice();
+	if (m_svga->HasFencePassed(fence)) {
+		m_framebuffer->unlockDevice();
+		return kIOReturnSuccess;
+	}
+	if (!m_svga->HasFIFOCap(SVGA_FIFO_CAP_FENCE)) {
+		/*
+		 * Note: fences can't be polled, so sync regardless of dontBlock
+		 */
+		m_svga->SyncToFence(fence);
+		m_framebuffer->unlockDevice();
+		return kIOReturnSuccess;
+	}
+	m_svga->RingDoorBell();
+	m_framebuffer->unlockDevice();
+	if (dontBlock)
+		return kIOReturnBusy;
+	/*
+	 * Note: fence is polled with the lock dropped, so other
+	 *   clients may use the FIFO meanwhile.  If it's still
+	 *   pending after PRESENT_POLL_LIMIT_MS, fall back to
+	 *   SyncToFence, which gives up once the device idles.
+	 */
+	for (ms = 0U; ms != PRESENT_POLL_LIMIT_MS; ++ms) {
+		IOSleep(1U);
+		if (HasFencePassed(fence))
+			return kIOReturnSuccess;
+	}
+	return SyncToFence(fence);
+}
+
 #pragma mark -
 #pragma mark Methods from IOService
 #pragma mark -
@@ -526,7 +565,9 @@ bool CLASS::init(OSDictionary* dictionary)
 	m_log_level_gld = -1;
 	m_master_surface_id = SVGA_ID_INVALID;
 	m_blitbug_result = kIOReturnNotFound;
-	m_present_tracker.init();
+	m_present_tracker.init(AUTO_SYNC_PRESENT_FENCE_COUNT);
+	clock_get_uptime(&m_vblank_epoch);
+	nanoseconds_to_absolutetime(1000000000ULL / SYNTHETIC_VBLANK_RATE, &m_vblank_period);
 	initPrimaryScreen();
 	return true;
 }
@@ -571,6 +612,10 @@ bool CLASS::start(IOService* provider)
 		bHaveScreenObject = true;
 		ACLog(1, "Screen Object On\n");
 	}
+	if (m_svga->HasFIFOCap(SVGA_FIFO_CAP_VIDEO))
+		bHaveVideo = true;
+	else
+		ACLog(1, "No Video Overlay, YUV surfaces converted in software\n");
 	m_devcaps = allocGPUCaps();
 	if (!m_devcaps) {
 		ACLog(1, "Unable to allocate space for devcaps\n");
@@ -652,6 +697,7 @@ bool CLASS::start(IOService* provider)
 	 *   if it can't find this property.
 	 */
 	setProperty("IODVDBundleName", "AppleVADriver");
+	VLogStart();
 	registerService();
 	return true;
 }
@@ -661,6 +707,7 @@ void CLASS::stop(IOService* provider)
 	ACLog(2, "%s\n", __FUNCTION__);
 
 	Cleanup();
+	VLogStop();
 	super::stop(provider);
 }
 
@@ -784,6 +831,42 @@ IOReturn CLASS::SyncToFence(uint32_t fence)
 	return kIOReturnSuccess;
 }
 
+HIDDEN
+bool CLASS::HasFencePassed(uint32_t fence)
+{
+	bool rc;
+
+	if (!m_framebuffer)
+		return true;
+	m_framebuffer->lockDevice();
+	rc = m_svga->HasFencePassed(fence);
+	m_framebuffer->unlockDevice();
+	return rc;
+}
+
+#pragma mark -
+#pragma mark Synthetic VBlank Methods
+#pragma mark -
+
+/*
+ * Note: SVGA II has no vertical retrace, so a fixed-rate
+ *   timeline anchored at init stands in for one.
+ */
+HIDDEN
+uint64_t CLASS::currentVBlank() const
+{
+	uint64_t now;
+
+	clock_get_uptime(&now);
+	return (now - m_vblank_epoch) / m_vblank_period;
+}
+
+HIDDEN
+void CLASS::sleepUntilVBlank(uint64_t vbl) const
+{
+	clock_delay_until(m_vblank_epoch + vbl * m_vblank_period);
+}
+
 #pragma mark -
 #pragma mark SVGA FIFO Acceleration Methods for 2D Context
 #pragma mark -
@@ -1216,10 +1299,11 @@ IOReturn CLASS::surfaceStretch(uint32_t src_sid,
 HIDDEN
 IOReturn CLASS::surfacePresentAutoSync(uint32_t sid,
 									   void /* IOAccelDeviceRegion */ const* region,
-									   ExtraInfo const* extra)
+									   ExtraInfo const* extra,
+									   PresentTracker* tracker)
 {
 	bool rc;
-	uint32_t i, numCopyRects;
+	uint32_t i, numCopyRects, fence;
 	SVGA3dCopyRect* copyRects;
 	IOAccelDeviceRegion const* rgn;
 
@@ -1227,10 +1311,12 @@ IOReturn CLASS::surfacePresentAutoSync(uint32_t sid,
 		return kIOReturnBadArgument;
 	if (!bHaveSVGA3D)
 		return kIOReturnNoDevice;
+	if (!tracker)
+		tracker = &m_present_tracker;
 	rgn = static_cast<IOAccelDeviceRegion const*>(region);
 	numCopyRects = rgn ? rgn->num_rects : 0;
+	throttlePresent(tracker, false);
 	m_framebuffer->lockDevice();
-	m_svga->SyncToFence(m_present_tracker.before());
 	rc = svga3d.BeginPresent(sid, &copyRects, numCopyRects);
 	if (!rc)
 		goto exit;
@@ -1245,9 +1331,46 @@ IOReturn CLASS::surfacePresentAutoSync(uint32_t sid,
 		dst->h = src->h;
 	}
 	m_svga->FIFOCommitAll();
-	m_present_tracker.after(m_svga->InsertFence());
+	fence = m_svga->InsertFence();
 exit:
 	m_framebuffer->unlockDevice();
+	if (rc) {
+		lockAccel();
+		tracker->after(fence);
+		unlockAccel();
+	}
+	return kIOReturnSuccess;
+}
+
+/*
+ * Note: waits for the present tracker->depth back, without
+ *   holding the device lock.  Returns kIOReturnBusy instead
+ *   of waiting if dontBlock.  The tracker is only read
+ *   under m_iolock, as resizePresentTracker may be changing it.
+ */
+HIDDEN
+IOReturn CLASS::throttlePresent(PresentTracker const* tracker, bool dontBlock)
+{
+	uint32_t fence;
+
+	if (!tracker)
+		return kIOReturnBadArgument;
+	if (!m_framebuffer)
+		return kIOReturnNoDevice;
+	lockAccel();
+	fence = tracker->before();
+	unlockAccel();
+	return waitForPresentFence(fence, dontBlock);
+}
+
+HIDDEN
+IOReturn CLASS::resizePresentTracker(PresentTracker* tracker, size_t depth)
+{
+	if (!tracker || !depth || depth > MAX_PRESENT_FENCE_COUNT)
+		return kIOReturnBadArgument;
+	lockAccel();
+	tracker->resize(depth);
+	unlockAccel();
 	return kIOReturnSuccess;
 }
 
@@ -1425,15 +1548,28 @@ IOReturn CLASS::surfaceDMA3DEx(SVGA3dSurfaceImageId const* hostImage,
 							   SVGA3dCopyBox const* copyBox,
 							   ExtraInfoEx const* extra,
 							   uint32_t* fence)
+{
+	return surfaceDMA3DExBoxes(hostImage, transfer, copyBox, 1U, extra, fence);
+}
+
+HIDDEN
+IOReturn CLASS::surfaceDMA3DExBoxes(SVGA3dSurfaceImageId const* hostImage,
+									SVGA3dTransferType transfer,
+									SVGA3dCopyBox const* copyBoxes,
+									size_t numCopyBoxes,
+									ExtraInfoEx const* extra,
+									uint32_t* fence)
 {
 	bool rc;
-	SVGA3dCopyBox* copyBoxes;
+	SVGA3dCopyBox* dstBoxes;
 	SVGA3dGuestImage guestImage;
 
-	if (!extra || !copyBox)
+	if (!extra || !copyBoxes)
 		return kIOReturnBadArgument;
 	if (!bHaveSVGA3D)
 		return kIOReturnNoDevice;
+	if (!numCopyBoxes)
+		return kIOReturnSuccess;
 	guestImage.ptr.gmrId = extra->mem_gmr_id;
 	guestImage.ptr.offset = static_cast<uint32_t>(extra->mem_offset_in_gmr);
 	guestImage.pitch = static_cast<uint32_t>(extra->mem_pitch);
@@ -1441,13 +1577,13 @@ IOReturn CLASS::surfaceDMA3DEx(SVGA3dSurfaceImageId const* hostImage,
 	rc = svga3d.BeginSurfaceDMAwithSuffix(&guestImage,
 										  hostImage,
 										  transfer,
-										  &copyBoxes,
-										  1U,
+										  &dstBoxes,
+										  numCopyBoxes,
 										  static_cast<uint32_t>(extra->mem_limit),
 										  *reinterpret_cast<SVGA3dSurfaceDMAFlags const*>(&extra->suffix_flags));
 	if (!rc)
 		goto exit;
-	memcpy(&copyBoxes[0], copyBox, sizeof *copyBox);
+	memcpy(dstBoxes, copyBoxes, numCopyBoxes * sizeof *copyBoxes);
 	m_svga->FIFOCommitAll();
 	if (fence)
 		*fence = m_svga->InsertFence();
@@ -1456,6 +1592,50 @@ exit:
 	return kIOReturnSuccess;
 }
 
+/*
+ * Note: Queues count SurfaceDMA commands under a single device lock and
+ *   fences them once.  Each entry i uses hostImages[i], copyBoxes[i] and extras[i].
+ */
+HIDDEN
+IOReturn CLASS::surfaceDMA3DExBatch(SVGA3dSurfaceImageId const* hostImages,
+									SVGA3dTransferType transfer,
+									SVGA3dCopyBox const* copyBoxes,
+									ExtraInfoEx const* extras,
+									size_t count,
+									uint32_t* fence)
+{
+	size_t i;
+	SVGA3dCopyBox* dstBoxes;
+	SVGA3dGuestImage guestImage;
+
+	if (!hostImages || !copyBoxes || !extras)
+		return kIOReturnBadArgument;
+	if (!bHaveSVGA3D)
+		return kIOReturnNoDevice;
+	if (!count)
+		return kIOReturnSuccess;
+	m_framebuffer->lockDevice();
+	for (i = 0U; i != count; ++i) {
+		guestImage.ptr.gmrId = extras[i].mem_gmr_id;
+		guestImage.ptr.offset = static_cast<uint32_t>(extras[i].mem_offset_in_gmr);
+		guestImage.pitch = static_cast<uint32_t>(extras[i].mem_pitch);
+		if (!svga3d.BeginSurfaceDMAwithSuffix(&guestImage,
+											  &hostImages[i],
+											  transfer,
+											  &dstBoxes,
+											  1U,
+											  static_cast<uint32_t>(extras[i].mem_limit),
+											  *reinterpret_cast<SVGA3dSurfaceDMAFlags const*>(&extras[i].suffix_flags)))
+			break;
+		memcpy(&dstBoxes[0], &copyBoxes[i], sizeof copyBoxes[i]);
+		m_svga->FIFOCommitAll();
+	}
+	if (i && fence)
+		*fence = m_svga->InsertFence();
+	m_framebuffer->unlockDevice();
+	return kIOReturnSuccess;
+}
+
 #pragma mark -
 #pragma mark Screen Support Methods
 #pragma mark -
@@ -1924,18 +2104,88 @@ bool CLASS::isPrimaryScreenActive() const
 #pragma mark Video Methods
 #pragma mark -
 
+/*
+ * Note: Returns the registers in regMask that differ from the last values
+ *   sent on streamId, and records the new values.  Call with device locked.
+ */
+HIDDEN
+uint32_t CLASS::diffVideoRegs(uint32_t streamId, struct SVGAOverlayUnit const* regs, uint32_t regMask)
+{
+	uint32_t const* regArray = reinterpret_cast<uint32_t const*>(regs);
+	uint32_t* shadow;
+	uint32_t i, changed, m;
+
+	if (streamId >= sizeof m_video_shadow / sizeof m_video_shadow[0])
+		return regMask;
+	/*
+	 * Note: a mode change or FIFO reset may have dropped the overlay registers
+	 */
+	if (m_video_shadow_generation != m_svga->getModeGeneration()) {
+		bzero(&m_video_shadow_known[0], sizeof m_video_shadow_known);
+		m_video_shadow_generation = m_svga->getModeGeneration();
+	}
+	shadow = reinterpret_cast<uint32_t*>(&m_video_shadow[streamId]);
+	changed = regMask & ~m_video_shadow_known[streamId];
+	for (i = 0U, m = regMask & m_video_shadow_known[streamId]; m; ++i, m >>= 1)
+		if ((m & 1U) && shadow[i] != regArray[i])
+			changed |= (1U << i);
+	for (i = 0U, m = changed; m; ++i, m >>= 1)
+		if (m & 1U)
+			shadow[i] = regArray[i];
+	m_video_shadow_known[streamId] |= changed;
+	return changed;
+}
+
+/*
+ * Note: Both encodings cost one (id, value) pair per register sent, and
+ *   produce the same items when the changed registers are contiguous, so
+ *   the mask form (which counts them with SVGADevice's count_bits) covers
+ *   every case.  Call with device locked.
+ */
+HIDDEN
+void CLASS::emitVideoRegs(uint32_t streamId, struct SVGAOverlayUnit const* regs, uint32_t regMask)
+{
+	if (!regMask)
+		return;
+	m_svga->VideoSetRegsWithMask(streamId, regs, regMask);
+}
+
 HIDDEN
 IOReturn CLASS::VideoSetRegsInRange(uint32_t streamId,
 									struct SVGAOverlayUnit const* regs,
 									uint32_t regMin,
 									uint32_t regMax,
 									uint32_t* fence)
+{
+	uint32_t regMask;
+
+	if (!m_framebuffer)
+		return kIOReturnNoDevice;
+	m_framebuffer->lockDevice();
+	if (regs && regMin <= regMax && regMax < SVGA_VIDEO_NUM_REGS) {
+		regMask = (2U << regMax) - (1U << regMin);
+		emitVideoRegs(streamId, regs, diffVideoRegs(streamId, regs, regMask));
+	}
+	m_svga->VideoFlush(streamId);
+	if (fence)
+		*fence = m_svga->InsertFence();
+	m_svga->RingDoorBell();
+	m_framebuffer->unlockDevice();
+	return kIOReturnSuccess;
+}
+
+HIDDEN
+IOReturn CLASS::VideoSetRegsWithMask(uint32_t streamId,
+									 struct SVGAOverlayUnit const* regs,
+									 uint32_t regMask,
+									 uint32_t* fence)
 {
 	if (!m_framebuffer)
 		return kIOReturnNoDevice;
 	m_framebuffer->lockDevice();
-	if (regs)
-		m_svga->VideoSetRegsInRange(streamId, regs, regMin, regMax);
+	regMask &= (1U << SVGA_VIDEO_NUM_REGS) - 1U;
+	if (regs && regMask)
+		emitVideoRegs(streamId, regs, diffVideoRegs(streamId, regs, regMask));
 	m_svga->VideoFlush(streamId);
 	if (fence)
 		*fence = m_svga->InsertFence();
@@ -1950,10 +2200,16 @@ IOReturn CLASS::VideoSetReg(uint32_t streamId,
 							uint32_t value,
 							uint32_t* fence)
 {
+	SVGAOverlayUnit unit;
+
 	if (!m_framebuffer)
 		return kIOReturnNoDevice;
+	if (registerId >= SVGA_VIDEO_NUM_REGS)
+		return kIOReturnBadArgument;
+	reinterpret_cast<uint32_t*>(&unit)[registerId] = value;
 	m_framebuffer->lockDevice();
-	m_svga->VideoSetReg(streamId, registerId, value);
+	if (diffVideoRegs(streamId, &unit, 1U << registerId))
+		m_svga->VideoSetReg(streamId, registerId, value);
 	m_svga->VideoFlush(streamId);
 	if (fence)
 		*fence = m_svga->InsertFence();
@@ -2043,6 +2299,11 @@ void CLASS::FreeStreamID(uint32_t streamId)
 	lockAccel();
 	m_stream_id_mask &= ~(1U << streamId);
 	unlockAccel();
+	if (m_framebuffer) {
+		m_framebuffer->lockDevice();
+		m_video_shadow_known[streamId] = 0U;
+		m_framebuffer->unlockDevice();
+	}
 }
 
 HIDDEN
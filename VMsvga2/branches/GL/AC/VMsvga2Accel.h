@@ -36,7 +36,9 @@
 
 #define kIOMessageFindSurface iokit_vendor_specific_msg(0x10)
 
-#define AUTO_SYNC_PRESENT_FENCE_COUNT	2
+#define AUTO_SYNC_PRESENT_FENCE_COUNT	2U	// default depth of a PresentTracker
+#define PRESENT_POLL_LIMIT_MS	100U
+#define SYNTHETIC_VBLANK_RATE	60U		// Hz, matches refreshRate reported by VMsvga2
 
 class VMsvga2Accel : public IOAccelerator
 {
@@ -72,6 +74,7 @@ private:
 	 */
 	unsigned bHaveSVGA3D:1;
 	unsigned bHaveScreenObject:1;
+	unsigned bHaveVideo:1;
 	uint64_t m_surface_id_mask[4];
 	uint64_t m_context_id_mask;
 	uint64_t m_gmr_id_mask[2];
@@ -90,12 +93,21 @@ private:
 	/*
 	 * AutoSync area
 	 */
-	FenceTracker<AUTO_SYNC_PRESENT_FENCE_COUNT> m_present_tracker;
+	PresentTracker m_present_tracker;	// for presents from clients without one
+
+	/*
+	 * VBlank area
+	 */
+	uint64_t m_vblank_epoch;	// absolute time
+	uint64_t m_vblank_period;	// absolute time
 
 	/*
 	 * Video area
 	 */
 	uint32_t m_stream_id_mask;
+	uint32_t m_video_shadow_generation;	// SVGADevice mode generation m_video_shadow_known is valid for
+	uint32_t m_video_shadow_known[32];	// per stream, registers whose value in m_video_shadow is on the host
+	SVGAOverlayUnit m_video_shadow[32];
 
 	/*
 	 * OS 10.6 specific
@@ -125,6 +137,9 @@ private:
 #endif
 	void initPrimaryScreen();
 	void cleanupPrimaryScreen();
+	uint32_t diffVideoRegs(uint32_t streamId, struct SVGAOverlayUnit const* regs, uint32_t regMask);
+	void emitVideoRegs(uint32_t streamId, struct SVGAOverlayUnit const* regs, uint32_t regMask);
+	IOReturn waitForPresentFence(uint32_t fence, bool dontBlock);
 
 public:
 	/*
@@ -144,6 +159,13 @@ public:
 	IOReturn SyncFIFO();
 	IOReturn RingDoorBell();
 	IOReturn SyncToFence(uint32_t fence);
+	bool HasFencePassed(uint32_t fence);
+
+	/*
+	 * Synthetic VBlank Methods
+	 */
+	uint64_t currentVBlank() const;
+	void sleepUntilVBlank(uint64_t vbl) const;
 
 	/*
 	 * Methods for supporting VMsvga22DContext
@@ -220,7 +242,10 @@ public:
 							void /* IOAccelBounds */ const* dest_rect);
 	IOReturn surfacePresentAutoSync(uint32_t sid,
 									void /* IOAccelDeviceRegion */ const* region,
-									ExtraInfo const* extra);
+									ExtraInfo const* extra,
+									PresentTracker* tracker = 0);
+	IOReturn throttlePresent(PresentTracker const* tracker, bool dontBlock);
+	IOReturn resizePresentTracker(PresentTracker* tracker, size_t depth);
 	IOReturn surfacePresentReadback(void /* IOAccelDeviceRegion */ const* region);
 	IOReturn setRenderTarget(uint32_t cid,
 							 SVGA3dRenderTargetType rtype,
@@ -249,6 +274,18 @@ public:
 							SVGA3dCopyBox const* copyBox,
 							ExtraInfoEx const* extra,
 							uint32_t* fence = 0);
+	IOReturn surfaceDMA3DExBoxes(SVGA3dSurfaceImageId const* hostImage,
+								 SVGA3dTransferType transfer,
+								 SVGA3dCopyBox const* copyBoxes,
+								 size_t numCopyBoxes,
+								 ExtraInfoEx const* extra,
+								 uint32_t* fence = 0);
+	IOReturn surfaceDMA3DExBatch(SVGA3dSurfaceImageId const* hostImages,
+								 SVGA3dTransferType transfer,
+								 SVGA3dCopyBox const* copyBoxes,
+								 ExtraInfoEx const* extras,
+								 size_t count,
+								 uint32_t* fence = 0);
 
 	/*
 	 * Screen Methods
@@ -300,6 +337,7 @@ public:
 	bool Have3D() const { return bHaveSVGA3D != 0; }
 	bool HaveScreen() const { return bHaveScreenObject != 0; }
 	bool HaveFrontBuffer() const { return bHaveScreenObject != 0 || bHaveSVGA3D != 0; }
+	bool HaveVideoOverlay() const { return bHaveVideo != 0; }
 	bool HaveGLBaseline() const;
 #if __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__ >= 1060
 	unsigned getSurfaceRootUUID() const { return m_surface_root_uuid; }
@@ -330,6 +368,10 @@ public:
 								 uint32_t regMin,
 								 uint32_t regMax,
 								 uint32_t* fence = 0);
+	IOReturn VideoSetRegsWithMask(uint32_t streamId,
+								  struct SVGAOverlayUnit const* regs,
+								  uint32_t regMask,
+								  uint32_t* fence = 0);
 	IOReturn VideoSetReg(uint32_t streamId,
 						 uint32_t registerId,
 						 uint32_t value,
@@ -26,6 +26,7 @@
  *  SOFTWARE.
  */
 
+#include <IOKit/IOLib.h>
 #include <IOKit/IOMemoryDescriptor.h>
 #include "VendorTransferBuffer.h"
 #include "VMsvga2Accel.h"
@@ -110,6 +111,62 @@ void CLASS::complete(VMsvga2Accel* provider)
 	gmr_id = SVGA_ID_INVALID;
 }
 
+/*
+ * Note: Hands the GMR, its prepared md and pending fence over to a
+ *   retired entry on list, so the caller need not wait for the DMA.
+ *   The buffer is left ready for a fresh prepare.
+ */
+HIDDEN
+void CLASS::retire(VMsvga2Accel* provider, VendorTransferRetired** list)
+{
+	VendorTransferRetired* r;
+
+	if (!provider || !list || !isIdValid(gmr_id))
+		return;
+	r = static_cast<VendorTransferRetired*>(IOMalloc(sizeof *r));
+	if (!r) {
+		complete(provider);
+		return;
+	}
+	r->md = md;
+	if (md)
+		md->retain();
+	r->gmr_id = gmr_id;
+	r->fence = fence;
+	r->next = *list;
+	*list = r;
+	gmr_id = SVGA_ID_INVALID;
+	fence = 0U;
+}
+
+HIDDEN
+void CLASS::reap(VMsvga2Accel* provider, VendorTransferRetired** list, bool wait)
+{
+	VendorTransferRetired *r, **link;
+
+	if (!provider || !list)
+		return;
+	link = list;
+	while ((r = *link) != 0) {
+		if (r->fence) {
+			if (wait)
+				provider->SyncToFence(r->fence);
+			else if (!provider->HasFencePassed(r->fence)) {
+				link = &r->next;
+				continue;
+			}
+		}
+		*link = r->next;
+		provider->destroyGMR(r->gmr_id);
+		if (r->md) {
+			r->md->complete();
+			r->md->release();
+		}
+		provider->FreeGMRID(r->gmr_id);
+		IOFree(r, sizeof *r);
+	}
+}
+
 HIDDEN
 void CLASS::discard(void)
 {
@@ -29,6 +29,16 @@
 #ifndef __VENDORTRANSFERBUFFER_H__
 #define __VENDORTRANSFERBUFFER_H__
 
+/*
+ * A GMR handed off by VendorTransferBuffer::retire, torn down once its fence passes
+ */
+struct VendorTransferRetired {
+	VendorTransferRetired* next;
+	class IOMemoryDescriptor* md;
+	uint32_t gmr_id;
+	uint32_t fence;
+};
+
 struct VendorTransferBuffer {
 	uint32_t pad1;			//   0
 	uint32_t gart_ptr;		//   4
@@ -44,7 +54,10 @@ struct VendorTransferBuffer {
 	IOReturn prepare(class VMsvga2Accel* provider);
 	void sync(class VMsvga2Accel* provider);
 	void complete(class VMsvga2Accel* provider);
+	void retire(class VMsvga2Accel* provider, VendorTransferRetired** list);
 	void discard(void);
+
+	static void reap(class VMsvga2Accel* provider, VendorTransferRetired** list, bool wait);
 };
 
 #endif /* __VENDORTRANSFERBUFFER_H__ */
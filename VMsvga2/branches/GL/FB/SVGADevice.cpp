@@ -108,6 +108,7 @@ bool CLASS::Init()
 	m_bounce_buffer = 0;
 	m_next_fence = 1;
 	m_capabilities = 0;
+	m_mode_generation = 0;
 	return true;
 }
 
@@ -297,6 +298,7 @@ bool CLASS::Start(IOPCIDevice* provider)
 void CLASS::Disable()
 {
 	WriteReg(SVGA_REG_ENABLE, 0);
+	++m_mode_generation;
 }
 
 #pragma mark -
@@ -326,6 +328,7 @@ bool CLASS::FIFOInit()
 		LogPrintf(1, "%s: SVGA_CAP_EXTENDED_FIFO failed\n", __FUNCTION__);
 		return false;
 	}
+	++m_mode_generation;
 	m_fifo_ptr[SVGA_FIFO_MIN] = static_cast<uint32_t>(SVGA_FIFO_NUM_REGS * sizeof(uint32_t));
 	m_fifo_ptr[SVGA_FIFO_MAX] = m_fifo_size;
 	m_fifo_ptr[SVGA_FIFO_NEXT_CMD] = m_fifo_ptr[SVGA_FIFO_MIN];
@@ -643,6 +646,7 @@ void CLASS::SetMode(uint32_t width, uint32_t height, uint32_t bpp)
 	m_fb_size = ReadReg(SVGA_REG_FB_SIZE);
 	m_width = width;
 	m_height = height;
+	++m_mode_generation;
 }
 
 bool CLASS::UpdateFramebuffer(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
@@ -74,6 +74,7 @@ private:
 	uint32_t m_vram_size;
 	uint32_t m_fb_size;
 	uint16_t m_io_base;
+	uint32_t m_mode_generation;	// bumped whenever the device may have dropped its state
 	/*
 	 * End Added
 	 */
@@ -147,6 +148,7 @@ public:
 	uint32_t getCurrentFBOffset() const { return m_fb_offset; }
 	uint32_t getVRAMSize() const { return m_vram_size; }
 	uint32_t getCurrentFBSize() const { return m_fb_size; }
+	uint32_t getModeGeneration() const { return m_mode_generation; }
 	bool get3DHWVersion(uint32_t* HWVersion) const;
 	void RegDump();
 	uint32_t const* get3DCapsBlock() const; // use judiciously
@@ -1100,6 +1100,7 @@ bool CLASS::start(IOService* provider)
 	m_display_mode = TryDetectCurrentDisplayMode(3);
 	m_depth_mode = 0;
 	scheduleRefreshTimer(1000U /* m_refresh_quantum_ms */);		// Added
+	VLogStart();
 	return true;
 
 fail:
@@ -1112,6 +1113,7 @@ void CLASS::stop(IOService* provider)
 {
 	LogPrintf(2, "%s: \n", __FUNCTION__);
 	Cleanup();
+	VLogStop();
 	super::stop(provider);
 }
 
@@ -152,6 +152,7 @@ void glrWaitSharedObject(gld_shared_t* shared, gld_sys_object_t* obj)
 	int index;
 	switch (obj->type) {
 		case TEX_TYPE_AGPREF:
+		case TEX_TYPE_VB:
 			index = 0;
 			break;
 		case TEX_TYPE_IOSURFACE:
@@ -404,11 +405,57 @@ uint8_t const* round_ptr(uint8_t const* p, ptrdiff_t c)
 	return (uint8_t const*) (((ptrdiff_t) p) & -c);
 }
 
+enum {
+	FLUSH_UNKNOWN,
+	FLUSH_CLFLUSH,
+	FLUSH_CLFLUSHOPT,
+	FLUSH_CLWB
+};
+
+static int flush_mode = FLUSH_UNKNOWN;
+
+static inline
+void cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t* regs)
+{
+#if defined(__i386__) && defined(__PIC__)
+	__asm__ volatile("xchgl %%ebx, %1\n\tcpuid\n\txchgl %%ebx, %1"
+					 : "=a" (regs[0]), "=&r" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+					 : "0" (leaf), "2" (subleaf));
+#else
+	__asm__ volatile("cpuid"
+					 : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+					 : "0" (leaf), "2" (subleaf));
+#endif
+}
+
+/*
+ * Note: Picked by CPU capability only, CLWB (keeps the line), then
+ *   CLFLUSHOPT, then CLFLUSH.
+ */
+static
+int detect_flush_mode(void)
+{
+	uint32_t regs[4];
+
+	cpuid_count(0U, 0U, &regs[0]);
+	if (regs[0] < 7U)
+		return FLUSH_CLFLUSH;
+	cpuid_count(7U, 0U, &regs[0]);
+	if (regs[1] & (1U << 24))
+		return FLUSH_CLWB;
+	if (regs[1] & (1U << 23))
+		return FLUSH_CLFLUSHOPT;
+	return FLUSH_CLFLUSH;
+}
+
 void glrFlushMemory(int arg0, uint8_t const* base, uint32_t num_bytes)
 {
 	uint8_t const* p;
 	ptrdiff_t clsize;
 	uint32_t v;
+
+	if (flush_mode == FLUSH_UNKNOWN)
+		flush_mode = detect_flush_mode();
 #ifdef __LP64__
 	v = *(uint32_t const*) 0x7FFFFFE00020ULL;
 #else
@@ -417,9 +464,27 @@ void glrFlushMemory(int arg0, uint8_t const* base, uint32_t num_bytes)
 	clsize = 64;
 	if (!(v & 32U))
 		clsize = (v & 64U) ? 128 : 32;
-	for (p = round_ptr(base, clsize); p < base + num_bytes; p += clsize)
-		__builtin_ia32_clflush(p);
-	__builtin_ia32_mfence();
+	p = round_ptr(base, clsize);
+	switch (flush_mode) {
+		case FLUSH_CLWB:
+			/*
+			 * Note: raw encodings, 66 0F AE /6 and /7 with [e|r]di
+			 */
+			for (; p < base + num_bytes; p += clsize)
+				__asm__ volatile(".byte 0x66, 0x0f, 0xae, 0x37" : : "D" (p) : "memory");
+			__builtin_ia32_sfence();
+			break;
+		case FLUSH_CLFLUSHOPT:
+			for (; p < base + num_bytes; p += clsize)
+				__asm__ volatile(".byte 0x66, 0x0f, 0xae, 0x3f" : : "D" (p) : "memory");
+			__builtin_ia32_sfence();
+			break;
+		default:
+			for (; p < base + num_bytes; p += clsize)
+				__builtin_ia32_clflush(p);
+			__builtin_ia32_mfence();
+			break;
+	}
 }
 
 void glrReleaseDrawable(gld_context_t* context)
@@ -0,0 +1,100 @@
+/*
+ *  GLDFenceBitmap.h
+ *  VMsvga2GLDriver
+ *
+ *  Created by Zenith432 on December 6th 2009.
+ *  Copyright 2009-2011 Zenith432. All rights reserved.
+ *
+ *  Permission is hereby granted, free of charge, to any person
+ *  obtaining a copy of this software and associated documentation
+ *  files (the "Software"), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy,
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies
+ *  of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ *  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ *  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ *  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __GLDFENCEBITMAP_H__
+#define __GLDFENCEBITMAP_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Note: One bit per struct GLDFence in the kernel fence area.  This is
+ *   owned by the GLD, only the pointer lives in gld_context_t.
+ */
+struct GLDFenceBitmap {
+	uint32_t hint;			// word to search first
+	uint32_t num_words;
+	uint32_t words[1];
+};
+
+/*
+ * Note: Grows (or allocates if fb is NULL) to num_words, clearing only
+ *   the new words so existing slots stay taken.  Returns NULL on failure,
+ *   in which case fb is untouched.
+ */
+static inline
+struct GLDFenceBitmap* fence_bitmap_resize(struct GLDFenceBitmap* fb, uint32_t num_words)
+{
+	struct GLDFenceBitmap* p;
+	uint32_t old_words = fb ? fb->num_words : 0U;
+
+	if (num_words < old_words || !num_words)
+		return NULL;
+	p = realloc(fb, sizeof *p + (num_words - 1U) * sizeof(uint32_t));
+	if (!p)
+		return NULL;
+	bzero(&p->words[old_words], (num_words - old_words) * sizeof(uint32_t));
+	p->num_words = num_words;
+	p->hint = old_words < num_words ? old_words : 0U;
+	return p;
+}
+
+/*
+ * Note: Takes a free slot, scanning whole words from the hint onward.
+ *   Returns 0 if the bitmap is full.
+ */
+static inline
+int fence_bitmap_alloc(struct GLDFenceBitmap* fb, uint32_t* slot)
+{
+	uint32_t i, j, n;
+
+	i = fb->hint < fb->num_words ? fb->hint : 0U;
+	for (n = fb->num_words; n; --n) {
+		if (~fb->words[i]) {
+			j = (uint32_t) __builtin_ctz(~fb->words[i]);
+			fb->words[i] |= 1U << j;
+			fb->hint = i;
+			*slot = (i << 5) + j;
+			return 1;
+		}
+		if (++i == fb->num_words)
+			i = 0U;
+	}
+	return 0;
+}
+
+static inline
+void fence_bitmap_free(struct GLDFenceBitmap* fb, uint32_t slot)
+{
+	fb->words[slot >> 5] &= ~(1U << (slot & 31U));
+	if ((slot >> 5) < fb->hint)
+		fb->hint = slot >> 5;
+}
+
+#endif /* __GLDFENCEBITMAP_H__ */
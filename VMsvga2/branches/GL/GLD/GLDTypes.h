@@ -194,7 +194,8 @@ typedef struct _gld_context_t {
 	uint32_t pad_size;				// (164, 208)
 	struct GLDFence* kfence_addr;	// (168, 210)
 	size_t kfence_size_bytes;		// (16C, 218)
-	uint32_t* fences_bitmap;		// (170, 220)
+	struct GLDFenceBitmap* fences_bitmap;
+									// (170, 220)
 	void* f20;						// (174, 228)
 	uint32_t f21;					// (178, 230)
 	void* f22;						// (17C, 238)
@@ -39,6 +39,7 @@
 #include "EntryPointNames.h"
 #include "GLDData.h"
 #include "GLDCode.h"
+#include "GLDFenceBitmap.h"
 #include "UCMethods.h"
 #include "VLog.h"
 
@@ -729,10 +730,18 @@ GLDReturn gldCreateContextInternal(gld_context_t** struct_out,
 		free(context);
 		return kCGLBadCodeModule;
 	}
+	context->fences_bitmap = fence_bitmap_resize(NULL,
+												 (uint32_t) (context->kfence_size_bytes >> 8));	/* sizeof(struct GLDFence) * 32 bits/dword = 256 */
+	if (!context->fences_bitmap) {
+		IOServiceClose(context->context_obj);
+		free(context);
+		return kCGLBadAlloc;
+	}
 	pthread_mutex_lock(&shared->mutex);
 	kr = IOConnectAddClient(context->context_obj, shared->obj);
 	if (kr != ERR_SUCCESS) {
 		pthread_mutex_unlock(&shared->mutex);
+		free(context->fences_bitmap);
 		IOServiceClose(context->context_obj);
 		free(context);
 		return kCGLBadCodeModule;
@@ -743,11 +752,6 @@ GLDReturn gldCreateContextInternal(gld_context_t** struct_out,
 	pthread_mutex_unlock(&shared->mutex);
 	context->config0 = shared->config0;
 	context->vramSize = dinfo->config[2];
-	/*
-	 * Note: this is twice the needed size, bug in source
-	 */
-	context->fences_bitmap = malloc(context->kfence_size_bytes >> 5);
-	bzero(context->fences_bitmap, context->kfence_size_bytes >> 5);
 	context->f20 = 0;
 	context->f21 = 0;
 	context->f22 = 0;
@@ -1552,6 +1556,11 @@ GLDReturn gldCreateBuffer(gld_shared_t* shared, gld_buffer_t** struct_out, void*
 	return kCGLNoError;
 }
 
+/*
+ * Note: The argument layout of gldBufferSubData and gldLoadBuffer is not
+ *   known, so there is no dirty range.  gldFlushBuffer flags the whole
+ *   buffer stale and the kernel uploads all of it on the next bind.
+ */
 GLDReturn gldBufferSubData(void)
 {
 	GLDLog(2, "%s()\n", __FUNCTION__);
@@ -1567,6 +1576,7 @@ GLDReturn gldLoadBuffer(void)
 GLDReturn gldFlushBuffer(gld_shared_t* shared, gld_buffer_t* buffer, void const* base, uint32_t num_bytes)
 {
 	uint8_t* p;
+	gld_sys_object_t* sys_obj;
 
 	GLDLog(2, "%s(%p, %p, %p, %d)\n", __FUNCTION__, shared, buffer, base, num_bytes);
 
@@ -1576,6 +1586,15 @@ GLDReturn gldFlushBuffer(gld_shared_t* shared, gld_buffer_t* buffer, void const*
 	if (base)
 		glrFlushMemory(0, base, num_bytes);
 	*p &= ~2U;
+	/*
+	 * Note: The kernel keeps a host copy of the buffer,
+	 *   flag it stale so the next bind uploads it again.
+	 */
+	if (buffer->f2 && *(buffer->f2)) {
+		sys_obj = *(buffer->f2);
+		sys_obj->pageoff[0] |= 1U;
+		sys_obj->pageon[0] &= ~1U;
+	}
 	return kCGLNoError;
 }
 
@@ -1857,55 +1876,62 @@ GLDReturn gldDestroyVertexArray(gld_shared_t* shared, gld_vertex_array_t* vertex
 	return kCGLNoError;
 }
 
+/*
+ * Note: The kernel doubles the fence area on each remap and copies
+ *   the old fences over, so existing slot numbers stay valid.
+ */
+static
+int grow_fences(gld_context_t* context)
+{
+	struct GLDFenceBitmap* fb;
+	uint32_t old_words;
+	kern_return_t kr;
+
+	old_words = context->fences_bitmap->num_words;
+	kr = IOConnectMapMemory(context->context_obj,
+							2U,
+							mach_task_self(),
+#ifdef __LP64__
+							(mach_vm_address_t*) &context->kfence_addr,
+							(mach_vm_size_t*) &context->kfence_size_bytes,
+#else
+							(vm_address_t*) &context->kfence_addr,
+							(vm_size_t*) &context->kfence_size_bytes,
+#endif
+							kIOMapAnywhere);
+	if (kr != ERR_SUCCESS)
+		return 0;
+	fb = fence_bitmap_resize(context->fences_bitmap,
+							 (uint32_t) (context->kfence_size_bytes >> 8));	/* sizeof(struct GLDFence) * 32 bits/dword = 256 */
+	if (!fb)
+		return 0;
+	context->fences_bitmap = fb;
+	return fb->num_words > old_words;
+}
+
 GLDReturn gldCreateFence(gld_context_t* context, gld_fence_t** struct_out)
 {
 	gld_fence_t* p;
 	struct GLDFence* kfence;
-	uint32_t i, j, m, s;
-	kern_return_t kr;
+	uint32_t slot;
 
 	GLDLog(2, "%s(%p, struct_out)\n", __FUNCTION__, context);
 
+	*struct_out = NULL;
 	p = malloc(sizeof *p);
-	bzero(p, sizeof *p);
+	if (!p)
+		return kCGLBadAlloc;
 	GLDLog(3, "  %s fence @%p\n", __FUNCTION__, p);
-	do {
-		s = (uint32_t) (context->kfence_size_bytes >> 8);	/* sizeof(struct GLDFence) * 32 bits/dword = 256 */
-		for (i = 0U; i != s; ++i)
-			if (context->fences_bitmap[i] != 0xFFFFFFFFU)
-				goto found_unused_fence;
-		kr = IOConnectMapMemory(context->context_obj,
-								2U,
-								mach_task_self(),
-#ifdef __LP64__
-								(mach_vm_address_t*) &context->kfence_addr,
-								(mach_vm_size_t*) &context->kfence_size_bytes,
-#else
-								(vm_address_t*) &context->kfence_addr,
-								(vm_size_t*) &context->kfence_size_bytes,
-#endif
-								kIOMapAnywhere);
-		if (kr != ERR_SUCCESS) {
+	while (!fence_bitmap_alloc(context->fences_bitmap, &slot))
+		if (!grow_fences(context)) {
 			free(p);
-			*struct_out = NULL;
 			return kCGLBadAlloc;
 		}
-		/*
-		 * Note: this is twice the needed size, bug in source
-		 */
-		context->fences_bitmap = realloc(context->fences_bitmap,
-										 context->kfence_size_bytes >> 5);	/* sizeof(struct GLDFence) * 4 bits/byte */
-		bzero(context->fences_bitmap + (context->kfence_size_bytes >> 8),
-			  context->kfence_size_bytes >> 6);
-	} while (1);
-found_unused_fence:
-	for (j = 0U, m = 1U; m && (context->fences_bitmap[i] & m); m <<= 1, ++j);
-	context->fences_bitmap[i] |= m;
-	p->f0 = i << 5 + (j & 31U);
-	kfence = context->kfence_addr + p->f0;
+	p->f0 = slot;
+	p->f1 = 1U;
+	kfence = context->kfence_addr + slot;
 	kfence->u = context->command_buffer_ptr[6]; /* stamp */
 	kfence->v = 0U;
-	p->f1 = 1U;
 	*struct_out = p;
 	return kCGLNoError;
 }
@@ -1914,7 +1940,7 @@ GLDReturn gldDestroyFence(gld_context_t* context, gld_fence_t* fence)
 {
 	GLDLog(2, "%s(%p, %p)\n", __FUNCTION__, context, fence);
 
-	context->fences_bitmap[fence->f0 >> 5] &= ~(1U << (fence->f0 & 31U));
+	fence_bitmap_free(context->fences_bitmap, fence->f0);
 	free(fence);
 	return kCGLNoError;
 }
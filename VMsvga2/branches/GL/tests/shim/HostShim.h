@@ -0,0 +1,42 @@
+/*
+ *  HostShim.h
+ *  VMsvga2 host checks
+ *
+ *  The few kernel types and constants the sources under test use,
+ *  so they build unchanged in user space.
+ */
+
+#ifndef __HOSTSHIM_H__
+#define __HOSTSHIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef int IOReturn;
+typedef uintptr_t vm_offset_t;
+typedef size_t vm_size_t;
+typedef uint64_t mach_vm_address_t;
+
+#define kIOReturnSuccess		0
+#define kIOReturnError			((IOReturn) 0xE00002BC)
+#define kIOReturnNoMemory		((IOReturn) 0xE00002BD)
+#define kIOReturnNoResources	((IOReturn) 0xE00002BE)
+#define kIOReturnBadArgument	((IOReturn) 0xE00002C2)
+#define kIOReturnNotReady		((IOReturn) 0xE00002D8)
+#define kIOReturnOverrun		((IOReturn) 0xE00002E8)
+#define kIOReturnUnderrun		((IOReturn) 0xE00002E9)
+
+#ifndef PAGE_SHIFT
+#define PAGE_SHIFT 12
+#endif
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096U
+#endif
+#ifndef PAGE_MASK
+#define PAGE_MASK (PAGE_SIZE - 1U)
+#endif
+
+#endif /* __HOSTSHIM_H__ */
@@ -0,0 +1,14 @@
+/*
+ *  IOLib.h (host shim)
+ *  VMsvga2 host checks
+ */
+
+#ifndef __IOKIT_IOLIB_H
+#define __IOKIT_IOLIB_H
+
+#include "HostShim.h"
+
+static inline void* IOMalloc(vm_size_t size) { return malloc(size); }
+static inline void IOFree(void* p, vm_size_t) { free(p); }
+
+#endif /* __IOKIT_IOLIB_H */
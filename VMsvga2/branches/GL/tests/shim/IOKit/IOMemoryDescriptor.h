@@ -0,0 +1,27 @@
+/*
+ *  IOMemoryDescriptor.h (host shim)
+ *  VMsvga2 host checks
+ *
+ *  Counts prepare/complete and references, so the checks can tell
+ *  every wiring of client memory was undone.
+ */
+
+#ifndef __IOKIT_IOMEMORYDESCRIPTOR_H
+#define __IOKIT_IOMEMORYDESCRIPTOR_H
+
+#include "HostShim.h"
+
+class IOMemoryDescriptor
+{
+public:
+	int refs;
+	int prepared;
+
+	IOMemoryDescriptor() : refs(1), prepared(0) {}
+	IOReturn prepare() { ++prepared; return kIOReturnSuccess; }
+	IOReturn complete() { --prepared; return kIOReturnSuccess; }
+	void retain() { ++refs; }
+	void release() { --refs; }
+};
+
+#endif /* __IOKIT_IOMEMORYDESCRIPTOR_H */
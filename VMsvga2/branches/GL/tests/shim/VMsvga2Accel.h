@@ -0,0 +1,204 @@
+/*
+ *  VMsvga2Accel.h (host shim)
+ *  VMsvga2 host checks
+ *
+ *  Stands in for the accelerator with a simulated host that consumes
+ *  DMAs in submission order, `delay` submissions behind the guest.
+ *  Batched DMAs are recorded in dma_log, GMR ids are counted.
+ *  With done_at set, fences instead complete at the given times on
+ *  a simulated clock, which also drives the synthetic vblank.
+ */
+
+#ifndef __VMSVGA2ACCEL_H__
+#define __VMSVGA2ACCEL_H__
+
+#include "HostShim.h"
+#include "svga_apple_header.h"
+#include "svga3d_reg.h"
+#include "svga_apple_footer.h"
+
+class IOMemoryDescriptor;
+
+class VMsvga2Accel
+{
+	struct Backing {
+		uint8_t const* base;
+		size_t size;
+		uint32_t sid;
+	};
+
+	Backing backings[64];
+	size_t num_backings;
+	uint32_t next_sid;
+	uint32_t next_gmr;
+	uint32_t last_created_sid;
+
+public:
+	struct ExtraInfoEx {
+		vm_offset_t mem_offset_in_gmr;
+		vm_size_t mem_pitch;
+		vm_size_t mem_limit;
+		uint32_t mem_gmr_id;
+		uint32_t suffix_flags;
+	};
+
+	uint32_t submitted;		// last fence handed out
+	uint32_t completed;		// last fence the host consumed
+	uint32_t delay;			// submissions the host lags behind
+	uint64_t num_waits;		// SyncToFence calls that had to wait
+	uint32_t num_surfaces;
+	uint32_t last_dma_sid;
+	uint8_t const* last_dma_ptr;
+	size_t last_dma_size;
+	bool dma_in_range;		// DMA fell inside the surface's backing
+	uint32_t max_gmrs;		// 0 - unlimited
+	uint32_t num_gmrs;		// created and not yet destroyed
+	uint32_t num_gmr_ids;	// allocated and not yet freed
+	uint32_t num_batches;	// surfaceDMA3DExBatch calls
+	struct {
+		SVGA3dSurfaceImageId image;
+		SVGA3dCopyBox box;
+		ExtraInfoEx extra;
+		uint32_t batch;
+	} dma_log[256];
+	size_t dma_log_size;
+	uint64_t now;				// simulated time
+	uint64_t vblank_period;		// in units of now
+	uint64_t const* done_at;	// completion time by fence, 0 - not simulated
+	uint64_t num_sleeps;		// sleepUntilVBlank calls that had to sleep
+
+	VMsvga2Accel() { memset(static_cast<void*>(this), 0, sizeof *this); }
+
+	/*
+	 * Note: One unit of host progress, consumes a DMA if it is
+	 *   more than `delay` behind the guest.
+	 */
+	void tick()
+	{
+		if (submitted > completed + delay)
+			++completed;
+	}
+
+	uint32_t AllocSurfaceID() { return ++next_sid; }
+	void FreeSurfaceID(uint32_t) {}
+	IOReturn createSurface(uint32_t sid, SVGA3dSurfaceFlags, SVGA3dSurfaceFormat, uint32_t, uint32_t)
+	{
+		last_created_sid = sid;
+		++num_surfaces;
+		return kIOReturnSuccess;
+	}
+	IOReturn destroySurface(uint32_t) { --num_surfaces; return kIOReturnSuccess; }
+
+	void* VRAMMalloc(size_t bytes)
+	{
+		uint8_t* p;
+
+		if (num_backings == sizeof backings / sizeof backings[0])
+			return 0;
+		p = static_cast<uint8_t*>(malloc(bytes));
+		backings[num_backings].base = p;
+		backings[num_backings].size = bytes;
+		backings[num_backings].sid = last_created_sid;
+		++num_backings;
+		return p;
+	}
+	void VRAMFree(void* p)
+	{
+		size_t i;
+
+		for (i = 0U; i != num_backings; ++i)
+			if (backings[i].base == p) {
+				backings[i] = backings[--num_backings];
+				break;
+			}
+		free(p);
+	}
+	/*
+	 * Note: VRAM offsets are the kernel addresses themselves
+	 */
+	vm_offset_t offsetInVRAM(void* p) { return reinterpret_cast<vm_offset_t>(p); }
+
+	bool HasFencePassed(uint32_t fence)
+	{
+		if (done_at)
+			return done_at[fence] <= now;
+		return static_cast<int32_t>(completed - fence) >= 0;
+	}
+	IOReturn SyncToFence(uint32_t fence)
+	{
+		if (!HasFencePassed(fence)) {
+			++num_waits;
+			if (done_at)
+				now = done_at[fence];
+			else
+				completed = fence;
+		}
+		return kIOReturnSuccess;
+	}
+
+	uint64_t currentVBlank() const { return now / vblank_period; }
+	void sleepUntilVBlank(uint64_t vbl)
+	{
+		if (now < vbl * vblank_period) {
+			++num_sleeps;
+			now = vbl * vblank_period;
+		}
+	}
+
+	uint32_t AllocGMRID()
+	{
+		if (max_gmrs && num_gmr_ids == max_gmrs)
+			return SVGA_ID_INVALID;
+		++num_gmr_ids;
+		return next_gmr++;
+	}
+	void FreeGMRID(uint32_t) { --num_gmr_ids; }
+	IOReturn createGMR(uint32_t, IOMemoryDescriptor*) { ++num_gmrs; return kIOReturnSuccess; }
+	IOReturn destroyGMR(uint32_t) { --num_gmrs; return kIOReturnSuccess; }
+
+	IOReturn surfaceDMA3DExBatch(SVGA3dSurfaceImageId const* hostImages,
+								 SVGA3dTransferType,
+								 SVGA3dCopyBox const* copyBoxes,
+								 ExtraInfoEx const* extras,
+								 size_t count,
+								 uint32_t* fence)
+	{
+		size_t i;
+
+		if (!count)
+			return kIOReturnSuccess;
+		++num_batches;
+		for (i = 0U; i != count && dma_log_size != sizeof dma_log / sizeof dma_log[0]; ++i, ++dma_log_size) {
+			dma_log[dma_log_size].image = hostImages[i];
+			dma_log[dma_log_size].box = copyBoxes[i];
+			dma_log[dma_log_size].extra = extras[i];
+			dma_log[dma_log_size].batch = num_batches;
+		}
+		if (fence)
+			*fence = ++submitted;
+		return kIOReturnSuccess;
+	}
+
+	IOReturn surfaceDMA3DEx(SVGA3dSurfaceImageId const* hostImage,
+							SVGA3dTransferType,
+							SVGA3dCopyBox const* copyBox,
+							ExtraInfoEx const* extra,
+							uint32_t* fence)
+	{
+		size_t i;
+
+		last_dma_sid = hostImage->sid;
+		last_dma_ptr = reinterpret_cast<uint8_t const*>(extra->mem_offset_in_gmr);
+		last_dma_size = copyBox->w;
+		dma_in_range = false;
+		for (i = 0U; i != num_backings; ++i)
+			if (backings[i].sid == hostImage->sid &&
+				last_dma_ptr >= backings[i].base &&
+				last_dma_ptr + last_dma_size <= backings[i].base + backings[i].size)
+				dma_in_range = true;
+		*fence = ++submitted;
+		return kIOReturnSuccess;
+	}
+};
+
+#endif /* __VMSVGA2ACCEL_H__ */
@@ -0,0 +1,193 @@
+/*
+ *  test_agp_hash.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Stress for the TEX_TYPE_AGP texture hash in AGPHash.h: random insert,
+ *  remove and lookup against a linear scan, and chain lengths for the
+ *  address patterns clients produce.  Run with -b for the chain table.
+ */
+
+#include "HostShim.h"
+#include "AGPHash.h"
+#include <stdio.h>
+
+#define NUM_HANDLES 128U	// NUM_TEXTURE_HANDLES in VMsvga2Shared.cpp
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+struct Texture
+{
+	mach_vm_address_t agp_addr;
+	vm_size_t agp_size;
+	Texture* agp_hash_next;
+	bool hashed;
+};
+
+static
+uint32_t rand32(void)
+{
+	return (static_cast<uint32_t>(rand()) << 16) ^ static_cast<uint32_t>(rand());
+}
+
+/*
+ * Note: Page aligned ranges as new_agp_texture hashes them.  Kinds:
+ *   0 - random addresses and sizes
+ *   1 - one allocator handing out same-sized textures back to back
+ *   2 - 2MB aligned large allocations of a few sizes
+ *   3 - one buffer re-registered at many sizes
+ */
+static
+void make_range(int kind, uint32_t i, mach_vm_address_t* addr, vm_size_t* size)
+{
+	switch (kind) {
+		case 0:
+			*addr = (static_cast<mach_vm_address_t>(rand32()) << PAGE_SHIFT) & 0x7FFFFFFFF000ULL;
+			*size = (1U + rand32() % 1024U) << PAGE_SHIFT;
+			break;
+		case 1:
+			*size = 64U << PAGE_SHIFT;
+			*addr = 0x100000000ULL + i * *size;
+			break;
+		case 2:
+			*size = (1U << (i % 4U)) << 20;
+			*addr = 0x200000000ULL + (static_cast<mach_vm_address_t>(i) << 21) * 8U;
+			break;
+		default:
+			*addr = 0x7F0000000000ULL;
+			*size = (i + 1U) << PAGE_SHIFT;
+			break;
+	}
+}
+
+static
+Texture* linear_find(Texture* t, size_t n, mach_vm_address_t addr, vm_size_t size)
+{
+	size_t i;
+
+	for (i = 0U; i != n; ++i)
+		if (t[i].hashed && t[i].agp_addr == addr && t[i].agp_size == size)
+			return &t[i];
+	return 0;
+}
+
+/*
+ * Note: A live set of NUM_HANDLES textures churned at random, every
+ *   lookup checked against a linear scan, and the table emptied at the end.
+ */
+static
+void test_stress(int kind)
+{
+	Texture tex[NUM_HANDLES];
+	Texture* table[NUM_HANDLES];
+	mach_vm_address_t addr;
+	vm_size_t size;
+	uint32_t mask, i, k, serial;
+	int round;
+
+	mask = agp_hash_buckets(NUM_HANDLES) - 1U;
+	CHECK(mask + 1U >= NUM_HANDLES && !(mask & (mask + 1U)));
+	memset(table, 0, sizeof table);
+	memset(tex, 0, sizeof tex);
+	serial = 0U;
+	for (round = 0; round != 200000; ++round) {
+		k = rand32() % NUM_HANDLES;
+		if (tex[k].hashed) {
+			CHECK(agp_hash_find(table, mask, tex[k].agp_addr, tex[k].agp_size) == &tex[k]);
+			agp_hash_remove(table, mask, &tex[k]);
+			tex[k].hashed = false;
+			CHECK(!agp_hash_find(table, mask, tex[k].agp_addr, tex[k].agp_size));
+		} else {
+			make_range(kind, serial++ % 4096U, &addr, &size);
+			if (linear_find(tex, NUM_HANDLES, addr, size))
+				continue;	// at most one entry per range, see VMsvga2Shared.cpp
+			tex[k].agp_addr = addr;
+			tex[k].agp_size = size;
+			agp_hash_insert(table, mask, &tex[k]);
+			tex[k].hashed = true;
+		}
+		make_range(kind, rand32() % 4096U, &addr, &size);
+		CHECK(agp_hash_find(table, mask, addr, size) == linear_find(tex, NUM_HANDLES, addr, size));
+	}
+	for (i = 0U; i != NUM_HANDLES; ++i)
+		if (tex[i].hashed)
+			agp_hash_remove(table, mask, &tex[i]);
+	for (i = 0U; i <= mask; ++i)
+		CHECK(!table[i]);
+}
+
+/*
+ * Note: Longest chain with NUM_HANDLES textures hashed into buckets
+ */
+static
+uint32_t max_chain(int kind, uint32_t buckets)
+{
+	Texture tex[NUM_HANDLES];
+	Texture** table;
+	Texture* p;
+	uint32_t i, n, longest;
+
+	table = static_cast<Texture**>(calloc(buckets, sizeof *table));
+	for (i = 0U; i != NUM_HANDLES; ++i) {
+		make_range(kind, i, &tex[i].agp_addr, &tex[i].agp_size);
+		agp_hash_insert(table, buckets - 1U, &tex[i]);
+	}
+	longest = 0U;
+	for (i = 0U; i != buckets; ++i) {
+		for (n = 0U, p = table[i]; p; p = p->agp_hash_next)
+			++n;
+		if (n > longest)
+			longest = n;
+	}
+	free(table);
+	return longest;
+}
+
+static
+void test_chains(void)
+{
+	int kind;
+
+	for (kind = 0; kind != 4; ++kind)
+		CHECK(max_chain(kind, agp_hash_buckets(NUM_HANDLES)) <= 6U);
+}
+
+static
+void bench(void)
+{
+	static uint32_t const buckets[] = { 16U, 64U, 128U, 256U };
+	static char const* const kinds[] = { "random", "sequential", "2MB aligned", "one buffer" };
+	size_t b;
+	int kind;
+
+	printf("%12s", "buckets");
+	for (b = 0U; b != sizeof buckets / sizeof buckets[0]; ++b)
+		printf(" %6u", buckets[b]);
+	printf("   (longest chain, %u textures)\n", NUM_HANDLES);
+	for (kind = 0; kind != 4; ++kind) {
+		srand(1);
+		printf("%12s", kinds[kind]);
+		for (b = 0U; b != sizeof buckets / sizeof buckets[0]; ++b)
+			printf(" %6u", max_chain(kind, buckets[b]));
+		printf("\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int kind;
+
+	srand(1);
+	for (kind = 0; kind != 4; ++kind)
+		test_stress(kind);
+	test_chains();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_agp_hash: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_agp_hash: ok\n");
+	return 0;
+}
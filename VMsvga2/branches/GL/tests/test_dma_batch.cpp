@@ -0,0 +1,184 @@
+/*
+ *  test_dma_batch.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Checks the texture upload coalescing: DMABatch.h packing all paged-off
+ *  levels into few surfaceDMA3DExBatch submissions, including the OOB
+ *  last-row split, and VendorTransferBuffer.cpp (unchanged) tearing the
+ *  GMR down only once its fence has passed.
+ */
+
+#include "VMsvga2Accel.h"
+#include <IOKit/IOMemoryDescriptor.h>
+#include "VendorTransferBuffer.h"
+#include "DMABatch.h"
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+/*
+ * Note: Queues a face/mipmap chain as alloc_and_load_texture does,
+ *   levels of size >> mip, 4 bytes per pixel, packed in client memory.
+ */
+static
+vm_size_t queue_chain(VMsvga2Accel* host, DMABatch* batch, uint32_t faces, uint32_t mips,
+					  uint32_t size, vm_size_t gmr_limit, uint32_t* fence)
+{
+	SVGA3dSurfaceImageId hostImage;
+	SVGA3dCopyBox copyBox;
+	VMsvga2Accel::ExtraInfoEx extra;
+	vm_size_t offset;
+	uint32_t w;
+
+	memset(&hostImage, 0, sizeof hostImage);
+	memset(&copyBox, 0, sizeof copyBox);
+	memset(&extra, 0, sizeof extra);
+	extra.mem_limit = 0xFFFFFFFFU;
+	extra.suffix_flags = 3U;
+	hostImage.sid = 7U;
+	batch->count = 0U;
+	offset = 0U;
+	for (hostImage.face = 0U; hostImage.face != faces; ++hostImage.face)
+		for (hostImage.mipmap = 0U; hostImage.mipmap != mips; ++hostImage.mipmap) {
+			w = size >> hostImage.mipmap;
+			if (!w)
+				w = 1U;
+			copyBox.w = w;
+			copyBox.h = w;
+			copyBox.d = 1U;
+			extra.mem_offset_in_gmr = offset;
+			extra.mem_pitch = 4U * w + 64U;	// padded rows, as the GLD lays them out
+			offset += (w - 1U) * extra.mem_pitch + 4U * w;
+			CHECK(dma_batch_add_level(host, batch, &hostImage, &copyBox, &extra,
+									  gmr_limit, 4U * w, fence) == kIOReturnSuccess);
+		}
+	CHECK(dma_batch_flush(host, batch, fence) == kIOReturnSuccess);
+	return offset;
+}
+
+/*
+ * Note: A 6 face, 10 level cube map goes up in ceil(60 / 15) submissions,
+ *   one fence each, every level exactly once and in order.
+ */
+static
+void test_coalescing(void)
+{
+	VMsvga2Accel host;
+	DMABatch batch;
+	uint32_t fence = 0U;
+	size_t i;
+
+	queue_chain(&host, &batch, 6U, 10U, 512U, 0U, &fence);
+	CHECK(host.dma_log_size == 60U);
+	CHECK(host.num_batches == 4U);
+	CHECK(fence == host.submitted && host.submitted == 4U);
+	for (i = 0U; i != host.dma_log_size; ++i) {
+		CHECK(host.dma_log[i].image.face == i / 10U);
+		CHECK(host.dma_log[i].image.mipmap == i % 10U);
+		CHECK(host.dma_log[i].box.h == host.dma_log[i].box.w);
+		CHECK(host.dma_log[i].extra.suffix_flags == 3U);
+	}
+	queue_chain(&host, &batch, 1U, 8U, 64U, 0U, &fence);
+	CHECK(host.num_batches == 5U && host.dma_log_size == 68U);
+	queue_chain(&host, &batch, 1U, 0U, 64U, 0U, &fence);
+	CHECK(host.num_batches == 5U);	// nothing paged off, nothing sent
+}
+
+/*
+ * Note: With an OOB client range ending right after the last level's
+ *   last pixel, that level splits into its first h - 1 rows and a last
+ *   row with pitch == width_bytes, and together they cover the level.
+ */
+static
+void test_oob_split(void)
+{
+	VMsvga2Accel host;
+	DMABatch batch;
+	uint32_t fence = 0U;
+	vm_size_t end;
+	size_t i, n;
+
+	end = queue_chain(&host, &batch, 1U, 1U, 64U, 0U, &fence);
+	host.dma_log_size = 0U;
+	queue_chain(&host, &batch, 1U, 1U, 64U, end, &fence);
+	CHECK(host.dma_log_size == 2U);
+	CHECK(host.dma_log[0].box.y == 0U && host.dma_log[0].box.h == 63U);
+	CHECK(host.dma_log[0].extra.suffix_flags == 3U);
+	CHECK(host.dma_log[1].box.y == 63U && host.dma_log[1].box.h == 1U);
+	CHECK(host.dma_log[1].extra.mem_pitch == 256U && host.dma_log[1].extra.suffix_flags == 2U);
+	CHECK(host.dma_log[1].extra.mem_offset_in_gmr == 63U * host.dma_log[0].extra.mem_pitch);
+	CHECK(host.dma_log[1].extra.mem_offset_in_gmr + 256U == end);
+	CHECK(host.dma_log[0].batch == host.dma_log[1].batch);
+	/*
+	 * A split level never straddles a submission, 65536 down to 2 is 16
+	 *   levels so the split lands where the first batch would fill up.
+	 */
+	host.dma_log_size = 0U;
+	end = queue_chain(&host, &batch, 1U, 16U, 65536U, 0U, &fence);
+	host.dma_log_size = 0U;
+	host.num_batches = 0U;
+	queue_chain(&host, &batch, 1U, 16U, 65536U, end, &fence);
+	for (n = 0U, i = 0U; i != host.dma_log_size; ++i)
+		if (host.dma_log[i].extra.suffix_flags == 2U) {
+			++n;
+			CHECK(i == 16U && host.dma_log[i - 1U].batch == host.dma_log[i].batch);
+		}
+	CHECK(n == 1U && host.dma_log_size == 17U && host.num_batches == 2U);
+}
+
+/*
+ * Note: retire hands the GMR off without waiting, reap frees only what the
+ *   host has consumed, and a wait reap frees the rest.
+ */
+static
+void test_deferred_teardown(void)
+{
+	VMsvga2Accel host;
+	IOMemoryDescriptor md[4];
+	VendorTransferBuffer xfer[4];
+	VendorTransferRetired* retired = 0;
+	int i;
+
+	host.delay = 100U;
+	host.max_gmrs = 4U;
+	for (i = 0; i != 4; ++i) {
+		memset(&xfer[i], 0, sizeof xfer[i]);
+		xfer[i].init();
+		xfer[i].md = &md[i];
+		CHECK(xfer[i].prepare(&host) == kIOReturnSuccess);
+		xfer[i].fence = ++host.submitted;
+		xfer[i].retire(&host, &retired);
+		CHECK(xfer[i].gmr_id == SVGA_ID_INVALID && !xfer[i].fence);
+	}
+	CHECK(host.num_waits == 0U && host.num_gmrs == 4U);
+	CHECK(xfer[0].prepare(&host) == kIOReturnNoResources);	// all ids held by retired GMRs
+	host.completed = 2U;
+	VendorTransferBuffer::reap(&host, &retired, false);
+	CHECK(host.num_gmrs == 2U && host.num_gmr_ids == 2U && host.num_waits == 0U);
+	CHECK(md[0].prepared == 0 && md[1].prepared == 0 && md[2].prepared == 1);
+	CHECK(xfer[0].prepare(&host) == kIOReturnSuccess);
+	xfer[0].complete(&host);
+	VendorTransferBuffer::reap(&host, &retired, true);
+	CHECK(!retired && host.num_gmrs == 0U && host.num_gmr_ids == 0U);
+	CHECK(host.num_waits == 1U);	// one wait covers both remaining fences
+	for (i = 0; i != 4; ++i) {
+		CHECK(md[i].prepared == 0 && md[i].refs == 1);
+		xfer[i].discard();
+		CHECK(md[i].refs == 0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	test_coalescing();
+	test_oob_split();
+	test_deferred_teardown();
+	if (failures) {
+		fprintf(stderr, "test_dma_batch: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_dma_batch: ok\n");
+	return 0;
+}
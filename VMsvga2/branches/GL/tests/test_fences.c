@@ -0,0 +1,147 @@
+/*
+ *  test_fences.c
+ *  VMsvga2GLDriver host checks
+ *
+ *  Checks the GLD fence slot allocator in GLDFenceBitmap.h.
+ *  Run with -b for a create/destroy throughput benchmark.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "GLDFenceBitmap.h"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+static
+int is_taken(struct GLDFenceBitmap const* fb, uint32_t slot)
+{
+	return (fb->words[slot >> 5] >> (slot & 31U)) & 1U;
+}
+
+static
+void test_fill_and_free(void)
+{
+	struct GLDFenceBitmap* fb;
+	uint32_t i, slot;
+
+	fb = fence_bitmap_resize(NULL, 4U);
+	CHECK(fb && fb->num_words == 4U && fb->hint == 0U);
+	for (i = 0U; i != 128U; ++i) {
+		CHECK(fence_bitmap_alloc(fb, &slot));
+		CHECK(slot == i);
+	}
+	CHECK(!fence_bitmap_alloc(fb, &slot));
+	fence_bitmap_free(fb, 77U);
+	CHECK(!is_taken(fb, 77U));
+	CHECK(fb->hint == 2U);
+	CHECK(fence_bitmap_alloc(fb, &slot));
+	CHECK(slot == 77U);
+	fence_bitmap_free(fb, 127U);
+	fence_bitmap_free(fb, 3U);
+	CHECK(fb->hint == 0U);
+	CHECK(fence_bitmap_alloc(fb, &slot) && slot == 3U);
+	CHECK(fence_bitmap_alloc(fb, &slot) && slot == 127U);
+	free(fb);
+}
+
+/*
+ * Note: Growth must keep every taken slot and hand out the new ones next
+ */
+static
+void test_grow(void)
+{
+	struct GLDFenceBitmap* fb;
+	uint32_t i, slot;
+
+	fb = fence_bitmap_resize(NULL, 1U);
+	for (i = 0U; i != 32U; ++i)
+		CHECK(fence_bitmap_alloc(fb, &slot));
+	fence_bitmap_free(fb, 5U);
+	fb = fence_bitmap_resize(fb, 2U);
+	CHECK(fb && fb->num_words == 2U && fb->hint == 1U);
+	for (i = 0U; i != 32U; ++i)
+		CHECK(is_taken(fb, i) == (i != 5U));
+	CHECK(fence_bitmap_alloc(fb, &slot) && slot == 32U);
+	CHECK(fence_bitmap_resize(fb, 1U) == NULL);
+	free(fb);
+}
+
+/*
+ * Note: The scan wraps around from the hint to the words before it
+ */
+static
+void test_wrap(void)
+{
+	struct GLDFenceBitmap* fb;
+	uint32_t slot;
+
+	fb = fence_bitmap_resize(NULL, 3U);
+	fb->words[0] = 0xFFFFFFF7U;
+	fb->words[1] = ~0U;
+	fb->words[2] = ~0U;
+	fb->hint = 2U;
+	CHECK(fence_bitmap_alloc(fb, &slot) && slot == 3U);
+	CHECK(fb->hint == 0U);
+	free(fb);
+}
+
+static
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Note: Keeps `live` fences outstanding and recycles them in FIFO order,
+ *   which is how apps retire fences.
+ */
+static
+void bench(uint32_t live, uint32_t rounds)
+{
+	struct GLDFenceBitmap* fb;
+	uint32_t* ring;
+	uint32_t i, head, slot;
+	double t;
+
+	fb = fence_bitmap_resize(NULL, (live + 31U) >> 5);
+	ring = malloc(live * sizeof *ring);
+	for (i = 0U; i != live; ++i)
+		fence_bitmap_alloc(fb, &ring[i]);
+	t = now();
+	for (i = 0U, head = 0U; i != rounds; ++i) {
+		fence_bitmap_free(fb, ring[head]);
+		if (!fence_bitmap_alloc(fb, &slot))
+			abort();
+		ring[head] = slot;
+		if (++head == live)
+			head = 0U;
+	}
+	t = now() - t;
+	printf("%8u live fences: %6.1f M create/destroy per sec\n", live, rounds / t * 1e-6);
+	free(ring);
+	free(fb);
+}
+
+int main(int argc, char* argv[])
+{
+	test_fill_and_free();
+	test_grow();
+	test_wrap();
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		bench(64U, 10000000U);
+		bench(4096U, 10000000U);
+		bench(65536U, 10000000U);
+	}
+	if (failures) {
+		fprintf(stderr, "test_fences: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_fences: ok\n");
+	return 0;
+}
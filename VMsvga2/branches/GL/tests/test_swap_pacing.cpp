@@ -0,0 +1,251 @@
+/*
+ *  test_swap_pacing.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Simulates a GL client swapping on a surface: some CPU work, a
+ *  command buffer holding the swap, then pace_swap in SwapPacing.h,
+ *  against a host that completes each buffer some time after it's
+ *  submitted and a 60 Hz synthetic vblank.  Checks the frames queued
+ *  ahead of the host stay bounded, swaps land swap_interval vblanks
+ *  apart, and a late frame doesn't cause a burst.  Also checks a
+ *  PresentTracker keeps the fences in flight when its depth changes.
+ *  Run with -b for the table of rates, queue depths and latencies
+ *  against no pacing.
+ */
+
+#include "VMsvga2Accel.h"
+#include "FenceTracker.h"
+#include "SwapPacing.h"
+#include <stdio.h>
+
+#define FRAMES_IN_FLIGHT 2U	// GL_FRAMES_IN_FLIGHT in VMsvga2Surface.h
+#define PERIOD 1000U		// simulated time units per vblank
+#define MAX_SWAPS 4096
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+struct SimResult
+{
+	double swaps_per_vbl;
+	uint32_t max_queued;	// swaps not completed by the host, after pacing
+	double mean_latency;	// start of frame to host completion, in vblanks
+	uint64_t min_spacing;	// vblanks between consecutive swaps returning
+	uint64_t max_spacing;
+	uint64_t sleeps;
+};
+
+/*
+ * Note: hitch_at adds 10 vblanks of CPU work to that swap.
+ *   paced == false stands for the old unpaced Swap token.
+ */
+static
+SimResult simulate(uint32_t interval, uint64_t cpu, uint64_t gpu, int swaps, bool paced, int hitch_at)
+{
+	static uint64_t done_at[MAX_SWAPS + 1];
+	VMsvga2Accel host;
+	FenceTracker<FRAMES_IN_FLIGHT> tracker;
+	SimResult r;
+	uint64_t last_vbl, vbl, prev_vbl, start, latency;
+	uint32_t stamp, queued, j;
+	int k;
+
+	host.vblank_period = PERIOD;
+	host.done_at = &done_at[0];
+	done_at[0] = 0U;
+	tracker.init();
+	last_vbl = 0U;
+	prev_vbl = 0U;
+	latency = 0U;
+	r.max_queued = 0U;
+	r.min_spacing = ~0ULL;
+	r.max_spacing = 0U;
+	for (k = 1; k <= swaps; ++k) {
+		start = host.now;
+		host.now += cpu;
+		if (k == hitch_at)
+			host.now += 10U * PERIOD;
+		stamp = ++host.submitted;
+		done_at[stamp] = (host.now > done_at[stamp - 1U] ? host.now : done_at[stamp - 1U]) + gpu;
+		latency += done_at[stamp] - start;
+		if (paced)
+			pace_swap(&host, &tracker, &last_vbl, interval, stamp);
+		for (queued = 0U, j = stamp; j && done_at[j] > host.now; --j)
+			++queued;
+		if (queued > r.max_queued)
+			r.max_queued = queued;
+		vbl = host.currentVBlank();
+		if (k > 1) {
+			if (vbl - prev_vbl < r.min_spacing)
+				r.min_spacing = vbl - prev_vbl;
+			if (vbl - prev_vbl > r.max_spacing)
+				r.max_spacing = vbl - prev_vbl;
+		}
+		prev_vbl = vbl;
+	}
+	r.swaps_per_vbl = static_cast<double>(swaps) * PERIOD / static_cast<double>(host.now);
+	r.mean_latency = static_cast<double>(latency) / swaps / PERIOD;
+	r.sleeps = host.num_sleeps;
+	return r;
+}
+
+static
+void test_frames_in_flight(void)
+{
+	SimResult r;
+	uint32_t i;
+
+	/*
+	 * GPU bound, the host takes 3 vblanks a frame
+	 */
+	for (i = 0U; i <= 2U; ++i) {
+		r = simulate(i, 100U, 3U * PERIOD, 1000, true, 0);
+		CHECK(r.max_queued <= FRAMES_IN_FLIGHT);
+		CHECK(r.mean_latency < (FRAMES_IN_FLIGHT + 1U) * 3.0 + 0.1);
+		CHECK(r.swaps_per_vbl > 0.33 && r.swaps_per_vbl < 0.34);
+	}
+	r = simulate(0U, 100U, 3U * PERIOD, 1000, false, 0);
+	CHECK(r.max_queued > 500U);		// what the limit is for
+	CHECK(r.mean_latency > 100.0);
+}
+
+static
+void test_interval(void)
+{
+	SimResult r;
+	uint32_t i;
+
+	/*
+	 * Fast client, swaps land exactly interval vblanks apart
+	 */
+	for (i = 1U; i <= 2U; ++i) {
+		r = simulate(i, 100U, 200U, 1000, true, 0);
+		CHECK(r.min_spacing == i && r.max_spacing == i);
+		CHECK(r.swaps_per_vbl > 0.99 / i && r.swaps_per_vbl <= 1.0 / i);
+		CHECK(r.max_queued <= 1U);
+	}
+	r = simulate(0U, 100U, 200U, 1000, true, 0);
+	CHECK(!r.sleeps);
+	CHECK(r.swaps_per_vbl > 4.9);	// GPU bound, 5 a vblank
+}
+
+static
+void test_late_frames(void)
+{
+	SimResult r;
+	uint32_t i;
+
+	/*
+	 * A hitch, then back to fast frames: no catch-up burst
+	 */
+	for (i = 1U; i <= 2U; ++i) {
+		r = simulate(i, 100U, 200U, 1000, true, 100);
+		CHECK(r.min_spacing == i);
+		CHECK(r.max_spacing >= 10U);
+	}
+	/*
+	 * Every frame misses its vblank, each takes the next one
+	 */
+	r = simulate(1U, 1500U, 200U, 1000, true, 0);
+	CHECK(r.min_spacing >= 1U);
+	CHECK(r.swaps_per_vbl > 0.49 && r.swaps_per_vbl <= 0.5);
+}
+
+/*
+ * Note: A present waits on before(), then records its fence with
+ *   after(), as throttlePresent and surfacePresentAutoSync do.
+ */
+static
+void test_resize(void)
+{
+	PresentTracker t;
+	unsigned f;
+	size_t d, e;
+
+	/*
+	 * Shrinking keeps the newest fences, growing adds passed slots
+	 */
+	t.init(2U);
+	for (f = 1U; f <= 5U; ++f)
+		t.after(f);
+	t.resize(4U);
+	CHECK(t.depth == 4U);
+	CHECK(t.before() == 0U);
+	t.after(6U);
+	CHECK(t.before() == 0U);
+	t.after(7U);
+	CHECK(t.before() == 4U);
+	t.after(8U);
+	CHECK(t.before() == 5U);
+	t.resize(1U);
+	CHECK(t.before() == 8U);
+	t.after(9U);
+	CHECK(t.before() == 9U);
+	t.resize(0U);
+	CHECK(t.depth == MAX_PRESENT_FENCE_COUNT);
+	/*
+	 * From any depth and ring position, the next present waits on
+	 *   the one e back if it was still tracked.  Otherwise on none,
+	 *   as a present d back has already been waited on.
+	 */
+	for (d = 1U; d <= MAX_PRESENT_FENCE_COUNT; ++d)
+		for (e = 1U; e <= MAX_PRESENT_FENCE_COUNT; ++e)
+			for (f = 1U; f <= 9U; ++f) {
+				unsigned k, n;
+
+				t.init(d);
+				for (k = 1U; k <= f; ++k)
+					t.after(k);
+				t.resize(e);
+				for (n = 0U; n != 2U * MAX_PRESENT_FENCE_COUNT; ++n) {
+					k = f + n + 1U;
+					CHECK(t.before() == (k > e && k - e + d > f ? k - e : 0U));
+					t.after(k);
+				}
+			}
+}
+
+static
+void bench(void)
+{
+	static struct {
+		uint64_t cpu, gpu;
+	} const loads[] = {
+		{ 100U, 200U },
+		{ 100U, 3U * PERIOD },
+		{ 1500U, 200U },
+	};
+	SimResult r;
+	size_t l;
+	int i;
+
+	printf("%6s %6s %9s %8s %8s %11s\n", "cpu", "gpu", "interval", "swaps/s", "queued", "latency ms");
+	for (l = 0U; l != sizeof loads / sizeof loads[0]; ++l)
+		for (i = -1; i <= 2; ++i) {
+			r = simulate(i < 0 ? 0U : static_cast<uint32_t>(i), loads[l].cpu, loads[l].gpu, MAX_SWAPS, i >= 0, 0);
+			printf("%6llu %6llu %9s %8.1f %8u %11.1f\n",
+				   static_cast<unsigned long long>(loads[l].cpu),
+				   static_cast<unsigned long long>(loads[l].gpu),
+				   i < 0 ? "none" : i == 0 ? "0" : i == 1 ? "1" : "2",
+				   r.swaps_per_vbl * 60.0,
+				   r.max_queued,
+				   r.mean_latency * 1000.0 / 60.0);
+		}
+}
+
+int main(int argc, char* argv[])
+{
+	test_frames_in_flight();
+	test_interval();
+	test_late_frames();
+	test_resize();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_swap_pacing: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_swap_pacing: ok\n");
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ *  test_vconv.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Checks convert_vertices in VertexConvert.h against the single switch
+ *  loop it replaced and against a per-op reference.  Run with -b for
+ *  throughput of both.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "VertexConvert.h"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+/*
+ * Note: Vertex layout like the IPP's, position, color, then two texcoords
+ */
+#define STRIDE 40U
+#define OFS_COLOR 16U
+#define OFS_TC0 20U
+#define OFS_TC1 32U
+
+static float scales[2][4] = {
+	{ 1.0F / 640.0F, 1.0F / 480.0F, 1.0F, 1.0F },
+	{ 1.0F / 17.0F, 1.0F / 3.0F, 1.0F, 1.0F },
+};
+
+static
+size_t make_ops(VertexConvertOp* ops, bool flatshade)
+{
+	size_t n = 0U;
+
+	ops[n].kind = VCONV_TEXCOORD;
+	ops[n].offset = OFS_TC0;
+	ops[n++].scale = scales[0];
+	if (flatshade) {
+		ops[n].kind = VCONV_FLATSHADE;
+		ops[n].offset = OFS_COLOR;
+		ops[n++].color = 0U;
+	}
+	ops[n].kind = VCONV_TEXCOORD;
+	ops[n].offset = OFS_TC1;
+	ops[n++].scale = scales[1];
+	return n;
+}
+
+/*
+ * Note: The single loop switching on each op, per vertex
+ */
+static
+void convert_switch(uint8_t* vertex_array,
+					size_t num_vertices,
+					size_t stride,
+					VertexConvertOp* ops,
+					size_t num_ops)
+{
+	size_t i, j;
+	float* q;
+
+	for (i = 0U; i != num_ops; ++i)
+		if (ops[i].kind == VCONV_FLATSHADE)
+			ops[i].color = *reinterpret_cast<uint32_t const*>(vertex_array + ops[i].offset);
+	for (j = 0U; j != num_vertices; ++j, vertex_array += stride)
+		for (i = 0U; i != num_ops; ++i) {
+			q = reinterpret_cast<float*>(vertex_array + ops[i].offset);
+			switch (ops[i].kind) {
+				case VCONV_TEXCOORD:
+					q[0] = (q[0] + 0.5F) * ops[i].scale[0];
+					q[1] = (q[1] + 0.5F) * ops[i].scale[1];
+					break;
+				case VCONV_FLATSHADE:
+					*reinterpret_cast<uint32_t*>(q) = ops[i].color;
+					break;
+			}
+		}
+}
+
+static
+void fill_vertices(uint8_t* va, size_t num_vertices)
+{
+	float* f;
+	size_t i, k;
+
+	for (i = 0U; i != num_vertices; ++i, va += STRIDE) {
+		f = reinterpret_cast<float*>(va);
+		for (k = 0U; k != STRIDE / sizeof(float); ++k)
+			f[k] = static_cast<float>(rand() % 2048) - 512.0F;
+		*reinterpret_cast<uint32_t*>(va + OFS_COLOR) = static_cast<uint32_t>(rand());
+	}
+}
+
+/*
+ * Note: Also checks the ops leave the other fields of each vertex alone,
+ *   including the texcoord's third component next to the pair converted.
+ */
+static
+void test_convert(bool flatshade)
+{
+	uint8_t orig[STRIDE * 33], a[STRIDE * 33], b[STRIDE * 33];
+	VertexConvertOp ops[MAX_NUM_DECLS];
+	float const* o;
+	float const* r;
+	uint32_t color;
+	size_t n, i, num_ops;
+
+	for (n = 0U; n <= 33U; ++n) {
+		fill_vertices(orig, 33U);
+		memcpy(a, orig, sizeof orig);
+		memcpy(b, orig, sizeof orig);
+		num_ops = make_ops(ops, flatshade);
+		convert_vertices(a, n, STRIDE, ops, num_ops);
+		num_ops = make_ops(ops, flatshade);
+		convert_switch(b, n, STRIDE, ops, num_ops);
+		CHECK(!memcmp(a, b, sizeof a));
+		color = *reinterpret_cast<uint32_t const*>(orig + OFS_COLOR);
+		for (i = 0U; i != 33U; ++i) {
+			o = reinterpret_cast<float const*>(orig + i * STRIDE);
+			r = reinterpret_cast<float const*>(a + i * STRIDE);
+			if (i >= n) {
+				CHECK(!memcmp(o, r, STRIDE));
+				continue;
+			}
+			CHECK(!memcmp(o, r, OFS_COLOR));
+			CHECK(*reinterpret_cast<uint32_t const*>(a + i * STRIDE + OFS_COLOR) ==
+				  (flatshade ? color : *reinterpret_cast<uint32_t const*>(orig + i * STRIDE + OFS_COLOR)));
+			CHECK(r[5] == (o[5] + 0.5F) * scales[0][0]);
+			CHECK(r[6] == (o[6] + 0.5F) * scales[0][1]);
+			CHECK(r[7] == o[7]);
+			CHECK(r[8] == (o[8] + 0.5F) * scales[1][0]);
+			CHECK(r[9] == (o[9] + 0.5F) * scales[1][1]);
+		}
+	}
+}
+
+static
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+double bench_one(void (*convert)(uint8_t*, size_t, size_t, VertexConvertOp*, size_t), uint8_t* va, size_t num_vertices)
+{
+	VertexConvertOp ops[MAX_NUM_DECLS];
+	size_t num_ops;
+	int i;
+	double t;
+
+	t = now();
+	for (i = 0; i != 200; ++i) {
+		num_ops = make_ops(ops, true);
+		convert(va, num_vertices, STRIDE, ops, num_ops);
+	}
+	t = now() - t;
+	return 200.0 * num_vertices / t * 1e-6;
+}
+
+static
+void bench(void)
+{
+	size_t const num_vertices = 65536U;
+	uint8_t* va;
+
+	va = static_cast<uint8_t*>(malloc(num_vertices * STRIDE));
+	fill_vertices(va, num_vertices);
+	printf("switch loop: %7.1f Mvertex/s\n", bench_one(convert_switch, va, num_vertices));
+	fill_vertices(va, num_vertices);
+	printf("per kind:    %7.1f Mvertex/s\n", bench_one(convert_vertices, va, num_vertices));
+	free(va);
+}
+
+int main(int argc, char* argv[])
+{
+	srand(1);
+	test_convert(false);
+	test_convert(true);
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_vconv: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_vconv: ok\n");
+	return 0;
+}
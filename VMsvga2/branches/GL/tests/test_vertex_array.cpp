@@ -0,0 +1,164 @@
+/*
+ *  test_vertex_array.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Runs the segmented VertexArray ring (VertexArray.cpp, unchanged)
+ *  against a simulated host that consumes DMAs some submissions late.
+ *  Run with -b for the delayed-consumer simulation table.
+ */
+
+#include "VMsvga2Accel.h"
+#include "VertexArray.h"
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+/*
+ * Note: An upload must go to the segment its pointer came from, even
+ *   after a later alloc moved the ring on to another segment.
+ */
+static
+void test_upload_after_roll(void)
+{
+	VMsvga2Accel host;
+	VertexArray va;
+	uint8_t *a, *b;
+	uint32_t sid_a, sid_b;
+
+	va.init();
+	CHECK(va.alloc(&host, VERTEX_ARRAY_SEGMENT_SIZE - 64U, &a) == kIOReturnSuccess);
+	CHECK(va.alloc(&host, 4096U, &b) == kIOReturnSuccess);
+	CHECK(b < a || b >= a + VERTEX_ARRAY_SEGMENT_SIZE - 64U);	// a not rewound under b
+	CHECK(va.upload(&host, a, VERTEX_ARRAY_SEGMENT_SIZE - 64U, &sid_a) == kIOReturnSuccess);
+	CHECK(host.dma_in_range && host.last_dma_ptr == a && host.last_dma_sid == sid_a);
+	CHECK(va.upload(&host, b, 4096U, &sid_b) == kIOReturnSuccess);
+	CHECK(host.dma_in_range && host.last_dma_ptr == b && host.last_dma_sid == sid_b);
+	CHECK(sid_a != sid_b);
+	CHECK(va.upload(&host, b + 4096U, 4U, 0) != kIOReturnSuccess);	// past the allocation
+	CHECK(va.getStats(&host)->num_segments == 2U);
+	va.purge(&host);
+	CHECK(host.num_surfaces == 0U);
+}
+
+/*
+ * Note: bytes in flight must fall back to 0 once the host catches up,
+ *   with no further allocations.
+ */
+static
+void test_in_flight_settles(void)
+{
+	VMsvga2Accel host;
+	VertexArray va;
+	uint8_t* p;
+	int i;
+
+	host.delay = 1000U;
+	va.init();
+	for (i = 0; i != 10; ++i) {
+		CHECK(va.alloc(&host, 1000U, &p) == kIOReturnSuccess);
+		CHECK(va.upload(&host, p, 1000U, 0) == kIOReturnSuccess);
+	}
+	CHECK(va.getStats(&host)->bytes_in_flight == 10000U);
+	host.completed = host.submitted;
+	CHECK(va.getStats(&host)->bytes_in_flight == 0U);
+	CHECK(va.getStats(&host)->max_bytes_in_flight == 10000U);
+	va.purge(&host);
+}
+
+struct SimResult
+{
+	uint64_t stalls;
+	uint64_t waits;
+	uint64_t max_in_flight;
+	uint32_t segments;
+};
+
+/*
+ * Note: Each draw allocates and uploads 1-16 KiB, then the host makes
+ *   one unit of progress.  The host lags `delay` DMAs behind.
+ */
+static
+SimResult simulate(uint32_t delay, int draws)
+{
+	VMsvga2Accel host;
+	VertexArray va;
+	SimResult r;
+	uint8_t* p;
+	size_t n;
+	int i;
+
+	srand(1);
+	host.delay = delay;
+	va.init();
+	for (i = 0; i != draws; ++i) {
+		n = 1024U * (1U + static_cast<size_t>(rand()) % 16U);
+		if (va.alloc(&host, n, &p) != kIOReturnSuccess ||
+			va.upload(&host, p, n, 0) != kIOReturnSuccess ||
+			!host.dma_in_range) {
+			++failures;
+			break;
+		}
+		host.tick();
+	}
+	r.stalls = va.getStats(&host)->num_stalls;
+	r.waits = host.num_waits;
+	r.max_in_flight = va.getStats(&host)->max_bytes_in_flight;
+	r.segments = va.getStats(&host)->num_segments;
+	va.purge(&host);
+	CHECK(host.num_surfaces == 0U);
+	return r;
+}
+
+static
+void test_simulation(void)
+{
+	SimResult r;
+
+	/*
+	 * A host lagging 16 draws (~136 KiB) fits in the ring once it
+	 *   has grown, so uploads never wait.
+	 */
+	r = simulate(16U, 20000);
+	CHECK(r.stalls == 0U && r.waits == 0U);
+	CHECK(r.segments <= VERTEX_ARRAY_MAX_SEGMENTS);
+	/*
+	 * One lagging 200 draws can't fit in 8 segments, the ring must
+	 *   stall but keep working, and only wait on its own fences.
+	 */
+	r = simulate(200U, 20000);
+	CHECK(r.stalls != 0U && r.stalls == r.waits);
+	CHECK(r.segments == VERTEX_ARRAY_MAX_SEGMENTS);
+}
+
+static
+void bench(void)
+{
+	static uint32_t const delays[] = { 0U, 4U, 16U, 32U, 64U, 128U, 256U };
+	SimResult r;
+	size_t i;
+
+	printf("%8s %8s %10s %16s\n", "delay", "segments", "stalls", "max in flight");
+	for (i = 0U; i != sizeof delays / sizeof delays[0]; ++i) {
+		r = simulate(delays[i], 100000);
+		printf("%8u %8u %10llu %16llu\n", delays[i], r.segments,
+			   static_cast<unsigned long long>(r.stalls),
+			   static_cast<unsigned long long>(r.max_in_flight));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	test_upload_after_roll();
+	test_in_flight_settles();
+	test_simulation();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_vertex_array: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_vertex_array: ok\n");
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ *  test_video_frames.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Simulates a video client on a YUV surface: lock, write a frame, flush
+ *  to the overlay, with the host reading each flushed frame some flushes
+ *  late.  Checks rotate_video_frame in VideoFrames.h never hands the
+ *  client a frame the host is still reading, and only waits when every
+ *  frame is in flight.  Run with -b for the table of waits and tears.
+ */
+
+#include "VMsvga2Accel.h"
+#include <IOKit/IOMemoryDescriptor.h>
+#include "VideoFrames.h"
+#include <stdio.h>
+
+#define MAX_FRAMES 4U	// VIDEO_NUM_FRAMES in VMsvga2Surface.h is 2 - 4
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+struct SimResult
+{
+	uint64_t waits;
+	uint64_t tears;		// locks handing out a frame still being read
+};
+
+/*
+ * Note: As context_lock_memory and surface_flush_video do it, with
+ *   num_frames == 1 standing for the old single-buffered surface.
+ */
+static
+SimResult simulate(uint32_t num_frames, uint32_t delay, int flushes)
+{
+	static uint8_t pixels[MAX_FRAMES];
+	VMsvga2Accel host;
+	VideoFrame backing, spares[MAX_FRAMES - 1U];
+	SimResult r;
+	uint32_t i, next;
+	bool flipped, seen[MAX_FRAMES];
+	int k;
+
+	host.delay = delay;
+	memset(&backing, 0, sizeof backing);
+	backing.vtb.init();
+	backing.self = &pixels[0];
+	for (i = 0U; i != num_frames - 1U; ++i) {
+		memset(&spares[i], 0, sizeof spares[i]);
+		spares[i].vtb.init();
+		spares[i].self = &pixels[i + 1U];
+	}
+	r.tears = 0U;
+	next = 0U;
+	flipped = false;
+	for (k = 0; k != flushes; ++k) {
+		if (flipped && num_frames > 1U) {
+			next = rotate_video_frame(&host, &backing, &spares[0], next, num_frames - 1U);
+			flipped = false;
+		}
+		if (backing.vtb.fence && !host.HasFencePassed(backing.vtb.fence))
+			++r.tears;
+		backing.vtb.fence = ++host.submitted;	// VideoSetRegsWithMask
+		flipped = true;
+		host.tick();
+	}
+	r.waits = host.num_waits;
+	/*
+	 * No frame lost or duplicated by the swaps
+	 */
+	memset(seen, 0, sizeof seen);
+	seen[backing.self - &pixels[0]] = true;
+	for (i = 0U; i != num_frames - 1U; ++i) {
+		CHECK(!seen[spares[i].self - &pixels[0]]);
+		seen[spares[i].self - &pixels[0]] = true;
+	}
+	return r;
+}
+
+static
+void test_rotation(void)
+{
+	SimResult r;
+	uint32_t n, d;
+
+	for (n = 2U; n <= MAX_FRAMES; ++n)
+		for (d = 0U; d != 8U; ++d) {
+			r = simulate(n, d, 10000);
+			CHECK(!r.tears);
+			if (d < n)
+				CHECK(!r.waits);	// n frames hide a lag of n - 1 flushes
+			else
+				CHECK(r.waits != 0U);
+		}
+	r = simulate(1U, 1U, 10000);
+	CHECK(r.tears != 0U);	// what rotation is for
+}
+
+static
+void bench(void)
+{
+	SimResult r;
+	uint32_t n, d;
+
+	printf("%6s %6s %10s %10s\n", "frames", "delay", "waits", "tears");
+	for (n = 1U; n <= MAX_FRAMES; ++n)
+		for (d = 0U; d != 5U; ++d) {
+			r = simulate(n, d, 100000);
+			printf("%6u %6u %10llu %10llu\n", n, d,
+				   static_cast<unsigned long long>(r.waits),
+				   static_cast<unsigned long long>(r.tears));
+		}
+}
+
+int main(int argc, char* argv[])
+{
+	test_rotation();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_video_frames: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_video_frames: ok\n");
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ *  test_yuv.cpp
+ *  VMsvga2Accel host checks
+ *
+ *  Checks the UYVY/YUY2 -> X8R8G8B8 rows in YUVConvert.h: the SSE2 path
+ *  against the scalar one, and both against a BT.601 reference.
+ *  Run with -b for throughput.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <emmintrin.h>
+
+namespace simd {
+#define VECTORIZE
+#include "YUVConvert.h"
+#undef VECTORIZE
+}
+
+#undef __YUVCONVERT_H__
+#undef YUV_CY
+#undef YUV_CRV
+#undef YUV_CGU
+#undef YUV_CGV
+#undef YUV_CBU
+
+namespace scalar {
+#include "YUVConvert.h"
+}
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+static
+int channel(uint32_t p, int shift)
+{
+	return static_cast<int>((p >> shift) & 0xFFU);
+}
+
+static
+int ref_clamp(double v)
+{
+	v = floor(v + 0.5);
+	return v < 0.0 ? 0 : (v > 255.0 ? 255 : static_cast<int>(v));
+}
+
+/*
+ * Note: BT.601 video range, in floating point
+ */
+static
+uint32_t ref_xrgb(int y, int u, int v)
+{
+	double yy = 1.164 * (y - 16);
+
+	return 0xFF000000U |
+		(static_cast<uint32_t>(ref_clamp(yy + 1.596 * (v - 128))) << 16) |
+		(static_cast<uint32_t>(ref_clamp(yy - 0.391 * (u - 128) - 0.813 * (v - 128))) << 8) |
+		static_cast<uint32_t>(ref_clamp(yy + 2.018 * (u - 128)));
+}
+
+static
+void fill_random(uint8_t* p, size_t n)
+{
+	for (; n; --n)
+		*p++ = static_cast<uint8_t>(rand());
+}
+
+/*
+ * Note: The vector loop must match the scalar tail bit for bit, for
+ *   every width including odd ones that end in the tail.
+ */
+static
+void test_simd_matches_scalar(void)
+{
+	uint8_t src[2 * 72];
+	uint32_t a[72], b[72];
+	uint32_t width;
+	int uyvy, round;
+
+	for (round = 0; round != 200; ++round)
+		for (uyvy = 0; uyvy != 2; ++uyvy)
+			for (width = 0U; width <= 64U; ++width) {
+				fill_random(src, sizeof src);
+				memset(a, 0, sizeof a);
+				memset(b, 0, sizeof b);
+				simd::yuv422_row_to_xrgb(a, src, width, uyvy != 0);
+				scalar::yuv422_row_to_xrgb(b, src, width, uyvy != 0);
+				CHECK(!memcmp(a, b, sizeof a));
+				CHECK(!a[width]);	// no write past the row
+			}
+}
+
+/*
+ * Note: Sweeps Y exhaustively and U, V in steps of 3, each channel must
+ *   be within 2 of the reference.  Out of range (super-white/black)
+ *   inputs are included since clients do send them.
+ */
+static
+void test_accuracy(void)
+{
+	uint8_t src[16];
+	uint32_t out[8], ref;
+	int y, u, v, i, err, max_err;
+
+	max_err = 0;
+	for (u = 0; u < 256; u += 3)
+		for (v = 0; v < 256; v += 3)
+			for (y = 0; y < 256; y += 8) {
+				for (i = 0; i != 8; i += 2) {
+					src[2 * i + 0] = static_cast<uint8_t>(u);
+					src[2 * i + 1] = static_cast<uint8_t>(y + i);
+					src[2 * i + 2] = static_cast<uint8_t>(v);
+					src[2 * i + 3] = static_cast<uint8_t>(y + i + 1);
+				}
+				simd::yuv422_row_to_xrgb(out, src, 8U, true);
+				for (i = 0; i != 8; ++i) {
+					ref = ref_xrgb(y + i, u, v);
+					CHECK((out[i] >> 24) == 0xFFU);
+					err = abs(channel(out[i], 16) - channel(ref, 16));
+					if (err > max_err) max_err = err;
+					err = abs(channel(out[i], 8) - channel(ref, 8));
+					if (err > max_err) max_err = err;
+					err = abs(channel(out[i], 0) - channel(ref, 0));
+					if (err > max_err) max_err = err;
+				}
+			}
+	CHECK(max_err <= 2);
+	printf("test_yuv: max error vs BT.601 reference %d\n", max_err);
+}
+
+/*
+ * Note: The SSE2 blend rounds differently from lerp_xrgb, allow 1
+ */
+static
+void test_lerp(void)
+{
+	uint32_t a[37], b[37], x[37], y[37];
+	uint32_t f, i;
+	int c;
+
+	for (f = 0U; f <= 128U; ++f) {
+		fill_random(reinterpret_cast<uint8_t*>(a), sizeof a);
+		fill_random(reinterpret_cast<uint8_t*>(b), sizeof b);
+		simd::lerp_xrgb_row(x, a, b, 37U, f);
+		scalar::lerp_xrgb_row(y, a, b, 37U, f);
+		for (i = 0U; i != 37U; ++i)
+			for (c = 0; c != 32; c += 8)
+				CHECK(abs(channel(x[i], c) - channel(y[i], c)) <= 1);
+	}
+	for (i = 0U; i != 37U; ++i)
+		a[i] = 0x00102030U;
+	scalar::lerp_xrgb_row(y, a, b, 37U, 0U);
+	simd::lerp_xrgb_row(x, a, b, 37U, 0U);
+	CHECK(!memcmp(x, a, sizeof a) && !memcmp(y, a, sizeof a));
+}
+
+static
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+void bench(void)
+{
+	uint32_t const width = 1920U, height = 1080U;
+	uint8_t* src;
+	uint32_t* dst;
+	uint32_t y;
+	int frame;
+	double t;
+
+	src = static_cast<uint8_t*>(malloc(2U * width * height));
+	dst = static_cast<uint32_t*>(malloc(4U * width * height));
+	fill_random(src, 2U * width * height);
+	t = now();
+	for (frame = 0; frame != 50; ++frame)
+		for (y = 0U; y != height; ++y)
+			scalar::yuv422_row_to_xrgb(dst + y * width, src + 2U * y * width, width, true);
+	t = now() - t;
+	printf("1080p UYVY scalar: %7.1f Mpixel/s\n", 50.0 * width * height / t * 1e-6);
+	t = now();
+	for (frame = 0; frame != 50; ++frame)
+		for (y = 0U; y != height; ++y)
+			simd::yuv422_row_to_xrgb(dst + y * width, src + 2U * y * width, width, true);
+	t = now() - t;
+	printf("1080p UYVY SSE2:   %7.1f Mpixel/s\n", 50.0 * width * height / t * 1e-6);
+	free(src);
+	free(dst);
+}
+
+int main(int argc, char* argv[])
+{
+	srand(1);
+	test_simd_matches_scalar();
+	test_accuracy();
+	test_lerp();
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	if (failures) {
+		fprintf(stderr, "test_yuv: %d failures\n", failures);
+		return 1;
+	}
+	printf("test_yuv: ok\n");
+	return 0;
+}
@@ -43,8 +43,8 @@
 #define BDOORHB_CMD_MESSAGE 0U
 
 #define BACKDOOR_VARS() \
-	unsigned eax = 0U, edx = 0U, edi = 0U; \
-	unsigned long ebx = 0U, ecx = 0U, esi = 0U;
+	unsigned eax = 0U, edx = 0U; \
+	unsigned long ebx = 0U, ecx = 0U, esi = 0U, edi = 0U;
 
 #define BACKDOOR_ASM(op, port) \
 	{ \
@@ -112,6 +112,102 @@ char VMLog_SendString(char const* str)
 	return 1;
 }
 
+/*
+ * Note: The functions below keep a channel open across several messages.
+ *   Each message must have its reply consumed before the next is sent.
+ */
+__attribute__((visibility("hidden")))
+int VMLog_OpenChannel(void)
+{
+	BACKDOOR_VARS()
+
+	ecx = BDOOR_CMD_MESSAGE | 0x00000000U;  /* Open */
+	ebx = PROTO;
+	BACKDOOR_ASM_IN()
+
+	if (!(ecx & 0x00010000U))
+		return -1;
+	return (int) (edx >> 16);
+}
+
+__attribute__((visibility("hidden")))
+char VMLog_SendChannel(int channel, char const* str, unsigned long size)
+{
+	char reply[16];
+	unsigned short channel_id;
+
+	if (channel < 0 || !str)
+		return 0;
+
+	BACKDOOR_VARS()
+
+	channel_id = (unsigned short) channel;
+	ecx = BDOOR_CMD_MESSAGE | 0x00010000U;  /* Send size */
+	ebx = size;
+	edx = channel_id << 16;
+	BACKDOOR_ASM_IN()
+
+	if (((ecx >> 16) & 0x0081U) != 0x0081U)
+		return 0;
+
+	ebx = 0x00010000U | BDOORHB_CMD_MESSAGE;
+	ecx = size;
+	edx = channel_id << 16;
+	esi = (unsigned long) str;
+	edi = 0U;
+	BACKDOOR_ASM_HB_OUT()
+
+	if (!(ebx & 0x00010000U))
+		return 0;
+
+	ecx = BDOOR_CMD_MESSAGE | 0x00030000U;  /* Receive size */
+	ebx = 0U;
+	edx = channel_id << 16;
+	esi = edi = 0U;
+	BACKDOOR_ASM_IN()
+
+	if (!(ecx & 0x00010000U))
+		return 0;
+	if (!(ecx & 0x00020000U))		/* No reply */
+		return 1;
+	size = ebx;
+	if ((edx >> 16) != 0x0001U || size > sizeof reply)
+		return 0;
+
+	if (size) {
+		ebx = 0x00010000U | BDOORHB_CMD_MESSAGE;
+		ecx = size;
+		edx = channel_id << 16;
+		esi = 0U;
+		edi = (unsigned long) &reply[0];
+		BACKDOOR_ASM_HB_IN()
+
+		if (!(ebx & 0x00010000U))
+			return 0;
+	}
+
+	ecx = BDOOR_CMD_MESSAGE | 0x00050000U;  /* Receive status */
+	ebx = 0x0001U;
+	edx = channel_id << 16;
+	esi = edi = 0U;
+	BACKDOOR_ASM_IN()
+
+	return (ecx & 0x00010000U) != 0U;
+}
+
+__attribute__((visibility("hidden")))
+void VMLog_CloseChannel(int channel)
+{
+	if (channel < 0)
+		return;
+
+	BACKDOOR_VARS()
+
+	ecx = BDOOR_CMD_MESSAGE | 0x00060000U;  /* Close */
+	edx = ((unsigned short) channel) << 16;
+	BACKDOOR_ASM_IN()
+}
+
 __attribute__((visibility("hidden")))
 void VMGetScreenSize(unsigned short* width, unsigned short* height)
 {
@@ -31,27 +31,223 @@
 #ifdef KERNEL
 #include <libkern/libkern.h>
 #include <IOKit/IOLib.h>
+#include <kern/thread_call.h>
 #else
 #include <stdio.h>
 #endif
 #include "VLog.h"
 
 #define VLOG_BUF_SIZE 256
+#define VLOG_RING_SIZE 64U			/* power of 2 */
+#define VLOG_MSG_SIZE 4096
+
+/*
+ * Note: Lines are formatted at the call site, because %s arguments
+ *   need not outlive the call.  Only the backdoor traffic is deferred.
+ */
+typedef struct VLogSlot
+{
+	unsigned volatile seq;
+	unsigned len;
+	char text[VLOG_BUF_SIZE];
+} VLogSlot;
+
+static VLogSlot vlog_ring[VLOG_RING_SIZE];
+static unsigned volatile vlog_head;
+static unsigned vlog_tail;
+static unsigned volatile vlog_dropped;
+static int volatile vlog_draining;
+static char vlog_msg[VLOG_MSG_SIZE];
+#ifdef KERNEL
+static thread_call_t volatile vlog_call;
+static int volatile vlog_scheduled;
+static int volatile vlog_running;
+static int volatile vlog_kicking;
+static int vlog_users;
+#endif
+
+#define VLOG_LAP(pos) ((pos) & ~(VLOG_RING_SIZE - 1U))
+
+/*
+ * Bounded multi-producer queue, each slot's seq is
+ *   VLOG_LAP(pos)       free for the producer at pos
+ *   VLOG_LAP(pos) + 1   holds the line at pos
+ *   so the zero-filled ring starts out free.
+ */
+static VLogSlot* vlog_claim(unsigned* pos)
+{
+	unsigned p;
+	int d;
+	VLogSlot* slot;
+
+	for (;;) {
+		p = vlog_head;
+		slot = &vlog_ring[p & (VLOG_RING_SIZE - 1U)];
+		d = (int) (slot->seq - VLOG_LAP(p));
+		if (!d) {
+			if (__sync_bool_compare_and_swap(&vlog_head, p, p + 1U))
+				break;
+		} else if (d < 0) {
+			__sync_fetch_and_add(&vlog_dropped, 1U);
+			return 0;
+		}
+	}
+	*pos = p;
+	return slot;
+}
+
+static void vlog_append(size_t* l, char const* str, size_t len)
+{
+	if (*l + len > sizeof vlog_msg)
+		len = sizeof vlog_msg - *l;
+	memcpy(&vlog_msg[*l], str, len);
+	*l += len;
+}
+
+/*
+ * Single consumer, guarded by vlog_draining.  Packs as many lines as fit
+ *   into one "log" message and keeps the channel open for the whole drain.
+ */
+static void vlog_drain(void)
+{
+	VLogSlot* slot;
+	size_t l;
+	unsigned dropped;
+	int channel;
+	char note[64];
+
+again:
+	if (!__sync_bool_compare_and_swap(&vlog_draining, 0, 1))
+		return;
+	channel = -1;
+	for (;;) {
+		l = 0U;
+		vlog_append(&l, "log ", 4U);
+		dropped = vlog_dropped;
+		if (dropped) {
+			__sync_fetch_and_sub(&vlog_dropped, dropped);
+			snprintf(&note[0], sizeof note, "VLog: %u lines dropped\n", dropped);
+			vlog_append(&l, &note[0], strlen(&note[0]));
+		}
+		while (1) {
+			slot = &vlog_ring[vlog_tail & (VLOG_RING_SIZE - 1U)];
+			if (slot->seq != VLOG_LAP(vlog_tail) + 1U)
+				break;
+			if (l > 4U && l + slot->len > sizeof vlog_msg)
+				break;
+			vlog_append(&l, &slot->text[0], slot->len);
+			__sync_synchronize();
+			slot->seq = VLOG_LAP(vlog_tail) + VLOG_RING_SIZE;
+			++vlog_tail;
+		}
+		if (l == 4U)
+			break;
+		if (channel < 0)
+			channel = VMLog_OpenChannel();
+		if (!VMLog_SendChannel(channel, &vlog_msg[0], l)) {
+			VMLog_CloseChannel(channel);
+			channel = -1;
+		}
+	}
+	VMLog_CloseChannel(channel);
+	__sync_synchronize();
+	vlog_draining = 0;
+	/*
+	 * Pick up a line published after the last check
+	 */
+	if (vlog_ring[vlog_tail & (VLOG_RING_SIZE - 1U)].seq == VLOG_LAP(vlog_tail) + 1U)
+		goto again;
+}
+
+#ifdef KERNEL
+static void vlog_drain_call(thread_call_param_t param0, thread_call_param_t param1)
+{
+	__sync_fetch_and_add(&vlog_running, 1);
+	vlog_scheduled = 0;
+	__sync_synchronize();
+	vlog_drain();
+	__sync_fetch_and_sub(&vlog_running, 1);
+}
+
+/*
+ * Note: Until VLogStart is called, and after VLogStop, lines are
+ *   sent from the calling thread.
+ */
+__attribute__((visibility("hidden")))
+void VLogStart(void)
+{
+	thread_call_t call;
+
+	if (vlog_users++)
+		return;
+	call = thread_call_allocate(&vlog_drain_call, 0);
+	if (call && !__sync_bool_compare_and_swap(&vlog_call, 0, call))
+		thread_call_free(call);
+}
+
+__attribute__((visibility("hidden")))
+void VLogStop(void)
+{
+	thread_call_t call;
+
+	if (!vlog_users || --vlog_users)
+		return;
+	call = vlog_call;
+	if (!call || !__sync_bool_compare_and_swap(&vlog_call, call, 0))
+		return;
+	while (vlog_kicking)
+		IOSleep(1U);
+	thread_call_cancel(call);
+	while (vlog_running)
+		IOSleep(1U);
+	thread_call_free(call);
+	vlog_scheduled = 0;
+	vlog_drain();
+}
+#endif
 
 __attribute__((visibility("hidden"), format(printf, 2, 3)))
 void VLog(char const* prefix_str, char const* fmt, ...)
 {
 	va_list ap;
 	size_t l;
-	char print_buf[VLOG_BUF_SIZE];
+	unsigned pos;
+	VLogSlot* slot;
+#ifdef KERNEL
+	thread_call_t call;
+#endif
 
-	va_start(ap, fmt);
-	l = strlcpy(&print_buf[0], "log ", sizeof print_buf);
-	l += strlcpy(&print_buf[l], prefix_str, sizeof print_buf - l);
-	vsnprintf(&print_buf[l], sizeof print_buf - l, fmt, ap);
-	va_end(ap);
+	slot = vlog_claim(&pos);
+	if (slot) {
+		va_start(ap, fmt);
+		l = strlcpy(&slot->text[0], prefix_str, sizeof slot->text);
+		if (l < sizeof slot->text)
+			vsnprintf(&slot->text[l], sizeof slot->text - l, fmt, ap);
+		va_end(ap);
+		l = strlen(&slot->text[0]);
+		if (l && slot->text[l - 1U] != '\n') {
+			if (l == sizeof slot->text - 1U)
+				--l;
+			slot->text[l++] = '\n';
+			slot->text[l] = '\0';
+		}
+		slot->len = (unsigned) l;
 #if defined(KERNEL) && defined(VLOG_LOCAL)
-	IOLog("%s", &print_buf[4]);
+		IOLog("%s", &slot->text[0]);
+#endif
+		__sync_synchronize();
+		slot->seq = VLOG_LAP(pos) + 1U;
+	}
+#ifdef KERNEL
+	__sync_fetch_and_add(&vlog_kicking, 1);
+	call = vlog_call;
+	if (call) {
+		if (__sync_bool_compare_and_swap(&vlog_scheduled, 0, 1))
+			thread_call_enter(call);
+		__sync_fetch_and_sub(&vlog_kicking, 1);
+		return;
+	}
+	__sync_fetch_and_sub(&vlog_kicking, 1);
 #endif
-	VMLog_SendString(&print_buf[0]);
+	vlog_drain();
 }
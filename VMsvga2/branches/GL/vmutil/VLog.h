@@ -34,9 +34,16 @@ extern "C" {
 #endif
 
 char VMLog_SendString(char const* str);
+int VMLog_OpenChannel(void);
+char VMLog_SendChannel(int channel, char const* str, unsigned long size);
+void VMLog_CloseChannel(int channel);
 __attribute__((format(printf, 2, 3)))
 void VLog(char const* prefix_str, char const* fmt, ...);
 void VMGetScreenSize(unsigned short* width, unsigned short* height);
+#ifdef KERNEL
+void VLogStart(void);
+void VLogStop(void);
+#endif
 
 #ifdef __cplusplus
 }